@@ -8,6 +8,7 @@
 
 typedef enum {false,true} bool;
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
+#define MAX(x,y) (((x) > (y)) ? (x) : (y))
 
 /* Error check posix threads */
 #define PTH_ERRCK(fun_call,cleaning)  \
@@ -0,0 +1,55 @@
+#ifndef _GREEN_H_
+#define _GREEN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include "common.h"
+
+
+/* Default size of the stack of a green node (see st_setstacksize) */
+#define GR_STACKSIZE (256*1024)
+
+/* Number of lists of parked nodes (power of 2) */
+#define GR_NBBUCKETS 256
+
+struct s_node;
+
+/**
+ * Coroutine of a green node:
+ * a green node runs on its own stack, carried by the workers of 
+ * a pool. When it would block waiting for data or space it gives
+ * the worker back (yield) and is parked until the waited buffer
+ * signals a change, then it is resumed by any worker. A node is
+ * parked on the address it waits for (a condition or a word):
+ * a signal only resumes the nodes waiting on the same address.
+ */
+struct gr_coro {
+    struct s_node* nd;          /* Node running in the coroutine */
+    ucontext_t ctx;             /* Context of the node */
+    ucontext_t* carrier;        /* Context of the worker carrying it */
+    void* stack;                /* Stack of the node, above a guard
+                                   page catching overflows */
+    size_t sizestack;           /* Size of the stack */
+
+    bool started;               /* The node's routine was entered */
+    bool finished;              /* The node's routine returned */
+    void* ret;                  /* Value returned by the routine */
+
+    const void* key;            /* Address waited (condition or word) */
+    pthread_mutex_t* unlock;    /* Mutex to release once yielded */
+    unsigned int* waddr;        /* Word waited once yielded (when */
+    unsigned int wval;          /* no mutex), while equal to wval */
+};
+
+
+int gr_resume(struct s_node* nd);
+int gr_yield(pthread_cond_t* cond, pthread_mutex_t* mutex);
+int gr_yieldword(unsigned int* addr, unsigned int val);
+bool gr_ingreen(void);
+void gr_wake(const void* key);
+void gr_forget(void);
+void gr_destroy(struct gr_coro* co);
+
+#endif
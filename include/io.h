@@ -3,10 +3,13 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <pthread.h>
+#include <sys/uio.h>
 #include "straph.h"
 #include "linked_fifo.h"
 #include "common.h"
+#include "sync.h"
 
 
 
@@ -27,25 +30,79 @@ struct out_buf {
     unsigned char type;      /* Type of the buffer */
     void* buf;               /* Output buffer */
     unsigned int nreaders;   /* Number of readers actives */
+    struct s_node* owner;    /* Node writing into the buffer */
+
+    char* stage;             /* Reservations which can't be done 
+                                directly into the buffer */
+    size_t sizestage;        /* Size of stage */
+    size_t reserved;         /* Size of the current reservation */
+    bool staged;             /* The current reservation is in stage */
+    bool reserving;          /* A reservation waits for its commit */
+};
+
+
+/**
+ * Segment of a linear buffer
+ */
+struct lb_seg {
+    struct lb_seg* next;   /* Next segment, NULL if last */
+    char data[];           /* sizeseg bytes */
 };
 
 
 /**
  * Linear buffer:
  * A linear buffer provides a finite write and
- * read capability (max sizebuf). The data written
- * out of the capacity of the buffer shall be ignored.
+ * read capability (max sizebuf). The writes beyond
+ * the capacity of the buffer are short.
+ *
+ * With the option BOPT_SEGMENT the buffer is rather a list
+ * of segments of sizeseg bytes, allocated as the data comes:
+ * its capability is unlimited. The data never moves, the 
+ * segments are kept when the buffer is rewinded.
+ *
+ * A MAP_BUF is a linear buffer whose memory is a mapped file,
+ * it can be larger than the memory: the writer writes back the 
+ * data and the readers drop it from the memory as they go (see 
+ * bm_writeback, bm_dropbehind).
  */
 struct l_buf {
-    char* buf;             /* Pointer to the buf */
-    unsigned int sizebuf;  /* Size of the buf */
-    unsigned int of_empty; /* Offset to the unwritten zone */
+    char* buf;             /* Pointer to the buf (NULL if segmented) */
+    size_t sizebuf;        /* Size of the buf */
+    int memflags;          /* Memory options (BMEM_*) */
+    size_t of_empty;       /* Offset to the unwritten zone */
+
+    int fd;                /* File mapped by a MAP_BUF, -1 otherwise */
+    bool retain;           /* The file is named, kept with the data */
+    bool sealed;           /* File opened read-only, always complete */
+    size_t of_written;     /* Data written back by the writer */
+
+    size_t sizeseg;        /* Size of a segment, 0 if not segmented */
+    struct lb_seg* first;  /* First segment */
+    struct lb_seg* wseg;   /* Segment being written */
+    size_t of_wseg;        /* Offset of wseg in the data */
+    unsigned int nb_segs;  /* Number of segments allocated */
     
     char status;           /* Indicates if the buf is 
                               receiving data or not   */
 
-    pthread_mutex_t mutex; /* To regulate of_empty access  */
+    pthread_mutex_t mutex; /* Held by the readers going to sleep */
     pthread_cond_t  cond;  /* To signal new available data */
+    unsigned int waiters;  /* Readers sleeping (or about to) on cond */
+    unsigned int failed;   /* A process died holding mutex */
+    struct st_waitpol wait;/* Wait policy of the readers */
+};
+
+
+/**
+ * Cursor of a reader of a ring:
+ * each one is alone on its cache line
+ */
+struct cb_cursor {
+    size_t pos;                 /* Total data consumed by the reader */
+    unsigned int busy;          /* The reader is using the memory of the
+                                   ring (see cb_ringenter) */
+    char pad[64 - sizeof(size_t) - sizeof(unsigned int)];
 };
 
 
@@ -54,16 +111,55 @@ struct l_buf {
  * A circular buffer provides an unlimited write and read capability. At every
  * write the data is incorporated inside one or more chunks. 
  * Each chunk is so composed:
- *          2 byte      2 byte      n bytes
+ *          2 byte      4 byte      n bytes
  *      +------------+-----------+------------+
  *      | read count | size data | data ...   |
  *      +------------+-----------+------------+
  * - read count: indicates how many times the chunk has been read 
  * - size data : size in bytes of the data contained in the chunk
+ *
+ * With the option BOPT_MIRROR the size of the buffer is a power of two
+ * and its memory is mapped twice back-to-back (see bm_mirror): chunks
+ * and reads never wrap.
+ *
+ * When the buffer has a single reader, or when one of the options
+ * BOPT_BROADCAST or BOPT_MESSAGE is set, the chunks are not used: the
+ * buffer is a plain ring of bytes.
+ * The writer only moves the head and every reader only moves its own
+ * cursor, all without lock. The writer can reuse the space up to the 
+ * slowest cursor. They sleep on an event when the ring is full (writer)
+ * or empty (readers).
+ *
+ * An elastic ring (BOPT_ELASTIC) is enlarged by its writer when it 
+ * has waited long enough for space. The readers are kept out of the
+ * memory of the ring while its unread data is moved.
+ *
+ * In message mode (BOPT_MESSAGE) every write is preceded in the ring
+ * by its size:
+ *          4 bytes      n bytes
+ *      +------------+------------+
+ *      | size data  | data ...   |
+ *      +------------+------------+
  */
 struct c_buf {
     char* buf;                  /* Pointer to the buf */
     unsigned int sizebuf;       /* Size of the buf */
+    bool broadcast;             /* Use the ring with any number of readers */
+    bool mirror;                /* Memory mapped twice, sizebuf is a power of 2 */
+    int memflags;               /* Memory options (BMEM_*) */
+    bool message;               /* Every write is a message */
+    size_t maxsize;             /* Max size of an elastic ring, 0 if not elastic */
+    size_t initsize;            /* Size given at the creation */
+    size_t peaksize;            /* Largest size reached */
+    bool shrink;                /* Back to initsize when rewinded */
+    uint64_t growwait;          /* Time waited by the writer before growing (ns) */
+    uint64_t blocked;           /* Time waited since the last growth (ns) */
+    unsigned int nb_grown;      /* Number of growths */
+    size_t minchunk;            /* Data published at once by the writer */
+    size_t maxchunk;            /* Max size of the data of a chunk */
+    bool ckopen;                /* A chunk is being filled by the writer */
+    size_t ckfill;              /* Size of the data of the open chunk */
+    struct st_waitpol wait;     /* Wait policy of the readers and the writer */
 
     size_t ref_datawritten;        /* Total data written to buf */
     size_t ref_datatransf;         /* Total data writtan to the buf
@@ -72,42 +168,100 @@ struct c_buf {
     pthread_mutex_t lock_ckcount;    /* Concurrent reads/writes of the 
                                         count header of the chunks */
     pthread_cond_t  cond_free;
+    size_t freeseq;                  /* Incremented when chunks are freed */
+    bool wwaiting;                   /* The writer waits for free chunks */
+    unsigned int pubchunks;          /* Chunks read published at once */
+    size_t pubbytes;                 /* Bytes read published at once */
 
     /* XXX dont need a lock for datatransf (only the writer uses it) */
     pthread_mutex_t lock_refs;       /* Concurrent reads/writes of
                                         ref_datawritten and ref_datatransf */
     pthread_cond_t  cond_acquire;
-
+    unsigned int failed;             /* A process died holding one of
+                                        the mutexes (see st_lock) */
+    unsigned int done;               /* The writer is done: nothing
+                                        more will be written */
+
+    /* Ring, the head and each cursor on their own cache line */
+    struct cb_cursor *cursors;  /* Cursors of the readers */
+    unsigned int nb_cursors;    /* Number of cursors allocated */
+    unsigned int nb_attached;   /* Number of readers given a cursor */
+    char pad_head[64];
+    size_t head;                /* Total data published */
+    size_t pending;             /* Data written after the head */
+    size_t minpos;              /* Slowest cursor known by the writer */
+    struct st_event ev_data;    /* Signals new data */
+    char pad_space[64];
+    size_t spacepos;            /* Cursor position awaited by the writer */
+    unsigned int growing;       /* The writer is enlarging the ring */
+    struct st_event ev_space;   /* Signals new space */
+    char pad_end[64];
 };
 
 
 /**
- * Read a 16 bits unsigned int from a circular buffer
+ * Offset inside a circular buffer
+ * @param cb Pointer to a circular buffer (struct c_buf*)
+ * @param o Position in the stream of data
+ */
+#define CB_OF(cb,o) ((cb)->mirror ? (o) & ((cb)->sizebuf - 1) :  \
+                                    (o) % (cb)->sizebuf)
+
+/**
+ * Tell if a circular buffer is used as a ring (rather than chunks)
+ * @param cb Pointer to a circular buffer (struct c_buf*)
+ * @param nreaders Number of readers of the buffer
+ */
+#define CB_ISRING(cb,nreaders) ((nreaders) == 1 || (cb)->broadcast || \
+                                (cb)->message || (cb)->maxsize > 0)
+
+/**
+ * Read a field of n bytes from a circular buffer
  * @param cb Pointer to a circular buffer (struct c_buf*)
  * @param o Offset from where start reading
  * @param a Address where to store the result
+ * @param n Size of the field
  */
-#define CB_READUI16(cb,o,a) { ((unsigned char*) a)[0] = cb->buf[(o) % cb->sizebuf];       \
-                              ((unsigned char*) a)[1] = cb->buf[((o)+1) % cb->sizebuf];   \
-                           }
+#define CB_READFIELD(cb,o,a,n) { if ((cb)->mirror){                                     \
+                                     memcpy(a, &(cb)->buf[CB_OF(cb,o)], n);             \
+                                 } else {                                               \
+                                     size_t _i;                                         \
+                                     for (_i = 0; _i < (n); _i++)                       \
+                                         ((unsigned char*) (a))[_i] =                   \
+                                             (cb)->buf[((o)+_i) % (cb)->sizebuf];       \
+                                 }                                                      \
+                               }
 
 /**
- * Write a 16 bits unsigned int into a circular buffer
+ * Write a field of n bytes into a circular buffer
  * @param cb Pointer to a circular buffer (struct c_buf*)
  * @param o Offset from where start writing
  * @param a Address pointing to the data to write 
+ * @param n Size of the field
  */
-#define CB_WRITEUI16(cb,o,a) { cb->buf[(o) % cb->sizebuf] = ((unsigned char*) a)[0];      \
-                               cb->buf[((o)+1) % cb->sizebuf] = ((unsigned char*) a)[1];  \
-                            }
+#define CB_WRITEFIELD(cb,o,a,n) { if ((cb)->mirror){                                    \
+                                      memcpy(&(cb)->buf[CB_OF(cb,o)], a, n);            \
+                                  } else {                                              \
+                                      size_t _i;                                        \
+                                      for (_i = 0; _i < (n); _i++)                      \
+                                          (cb)->buf[((o)+_i) % (cb)->sizebuf] =         \
+                                              ((unsigned char*) (a))[_i];               \
+                                  }                                                     \
+                                }
 
 
 typedef uint16_t ckcount_t; /* Number times a chunk was read */
-typedef uint16_t cksize_t ; /* Size of the chunk in bytes */
+typedef uint32_t cksize_t ; /* Size of the chunk in bytes */
 
 #define SIZE_CKHEAD (sizeof(ckcount_t)+sizeof(cksize_t))
-#define MAX_CKDATASIZE 0xffff /* Max uint16_t */
-#define MAX_CKSIZE  (SIZE_CKHEAD + MAX_CKDATASIZE)
+#define CB_DEFPUBCHUNKS 16 /* Default chunks read published at once */
+#define CB_DEFGROWWAIT 1000000 /* Default time waited before growing (ns) */
+#define MAX_CKDATASIZE 0xffffffff /* Max uint32_t */
+
+typedef uint32_t msgsize_t; /* Size of a message in bytes */
+
+#define SIZE_MSGHEAD sizeof(msgsize_t)
+#define MAX_MSGSIZE  0xffffffff /* Max uint32_t */
 
 /* Header of a chunk */
 struct cb_ckhead{
@@ -144,7 +298,10 @@ struct inslot {
  */
 struct inslot_l {
     struct out_buf* src;      /* Source buffer */
-    unsigned int of_start;    /* Offset to the unread data */
+    size_t of_start;          /* Offset to the unread data */
+    struct lb_seg* seg;       /* Segment being read (if segmented) */
+    size_t of_seg;            /* Offset of seg in the data */
+    size_t of_dropped;        /* Data dropped from the memory (MAP_BUF) */
 };
 
 /**
@@ -156,8 +313,16 @@ struct inslot_c {
     struct out_buf* src;      /* Source buffer */
 
     size_t data_read;         /* Total data read */
+    unsigned int cursor;      /* Index of the cursor (ring only) */
     size_t of_ck;             /* Offset current chunk */
 
+    /* Chunks read but not counted yet (see isc_publish) */
+    size_t of_unpub;          /* Offset of the first one */
+    unsigned int cks_unpub;   /* Number of chunks */
+    size_t size_unpub;        /* Size of the chunks */
+
+    bool viewing;             /* A view of the ring is held (see cb_peek) */
+
     /* Cache */
     char cache[SIZE_CACHE];   /* Circular buffer. Each read must 
                                  consume all the readable data storing
@@ -169,6 +334,15 @@ struct inslot_c {
 };
 
 
+/**
+ * Storage for any type of input slot
+ */
+union inslot_any {
+    struct inslot_l l;
+    struct inslot_c c;
+};
+
+
 struct cb_transf {
     size_t data_size;        /* Data transferred */
     size_t real_size;        /* Total size transferred */
@@ -181,6 +355,10 @@ struct cb_transf {
 /* General */
 void* st_makeb(unsigned char buftype, size_t bufsize);
 int st_destroyb(struct out_buf *buf);
+int st_reuseb(struct out_buf *buf, unsigned char buftype, size_t bufsize);
+int st_bufplace(struct out_buf *buf, int numa);
+int st_bufreaders(struct out_buf *buf);
+bool st_bufshared(struct out_buf *buf);
 
 
 /* Circular buffer */
@@ -188,23 +366,43 @@ ssize_t cb_releasable (struct c_buf *cb, ckcount_t maxreads, bool blocking);
 int cb_release(struct c_buf *cb, size_t nbyte);
 int cb_acquire(struct c_buf *cb, size_t nbyte);
 size_t cb_cacheread(struct inslot_c* in, void* buf, size_t nbyte);
-size_t cb_dowrite(struct c_buf *cb, size_t of_start, const void *buf, size_t nbyte);
 ssize_t cb_write(struct c_buf *cb, unsigned int nreaders, const void *buf, size_t nbyte);
 struct cb_transf cb_read(struct c_buf *cb, size_t data_av, struct inslot_c *in, void *buf, size_t nbyte);
 struct c_buf* cb_make(size_t sizebuf);
 int cb_destroy(struct c_buf* b);
 int isc_icc(struct inslot_c* isc, size_t of_startck, unsigned int ncks);
-size_t isc_getavailable(struct inslot_c *in);
+ssize_t isc_getavailable(struct inslot_c *in);
+int isc_publish(struct inslot_c *in);
+int cb_finis(struct inslot_c *in);
 ssize_t st_cbread(struct inslot_c* in, void* buf, size_t nbyte);
-struct inslot_c* cb_makeis(struct out_buf* b);
+int st_bufstatcb(struct c_buf* cb, int status);
+void cb_initis(struct inslot_c* is, struct out_buf* b);
+int cb_setreaders(struct c_buf *cb, unsigned int nreaders);
+int cb_peek(struct inslot_c *in, const void **ptr, size_t *len);
+int cb_consume(struct inslot_c *in, size_t nbyte);
+ssize_t cb_msgsize(struct inslot_c *in);
+ssize_t cb_readmsg(struct inslot_c *in, void *buf, size_t nbyte);
+ssize_t cb_readmsgv(struct inslot_c *in, struct iovec *iov, int iovcnt);
+int cb_setmirror(struct c_buf *cb, bool mirror);
+int cb_setmem(struct c_buf *cb, int flags);
+struct c_buf* cb_share(struct c_buf *cb);
+int cb_flush(struct c_buf *cb);
+int cb_wake(struct c_buf *cb);
+int cb_fail(struct c_buf *cb);
 
 
 /* Linear buffer */
 ssize_t lb_write(struct l_buf *lb, const void* buf, size_t nbyte);
 int st_bufstatlb(struct l_buf* lb, int status);
 ssize_t st_readlb(struct inslot_l* in, void* buf, size_t nbyte);
+int lb_peek(struct inslot_l* in, const void **ptr, size_t *len);
+int lb_consume(struct inslot_l* in, size_t nbyte);
 struct l_buf* lb_make(size_t sizebuf);
+struct l_buf* lb_makefile(size_t sizebuf);
 int lb_destroy(struct l_buf* b);
-struct inslot_l* lb_makeis(struct out_buf* b);
+void lb_initis(struct inslot_l* is, struct out_buf* b);
+int lb_setsegment(struct l_buf* lb, size_t sizeseg);
+int lb_setmem(struct l_buf* lb, int flags);
+struct l_buf* lb_share(struct l_buf* lb);
 
 #endif
@@ -0,0 +1,51 @@
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+#include "common.h"
+
+
+/* 
+ Buffers of at least BM_MAPSIZE bytes get their own
+ mapping, which can be moved to a given NUMA node.
+ Smaller buffers are allocated with malloc.
+*/
+#define BM_MAPSIZE (64*1024)
+
+/* Max number of NUMA nodes handled */
+#define BM_MAXNODES 64
+
+/* 
+ Memory shared with the processes forked afterwards (see 
+ BOPT_SHARED), given to bm_alloc besides the BMEM_* options
+*/
+#define BM_SHARED 0x100
+
+/* Size of an explicit huge page */
+#define BM_HUGESIZE (2*1024*1024)
+
+/* 
+ Memory-mapped files are written back and dropped from
+ the memory by windows of BM_DROPSIZE bytes
+*/
+#define BM_DROPSIZE (16*1024*1024)
+
+
+void* bm_alloc(size_t size, int flags);
+void bm_free(void *mem, size_t size, int flags);
+size_t bm_mirrorsize(size_t size, int flags);
+void* bm_mirror(size_t size, int flags);
+void bm_unmirror(void *mem, size_t size);
+int bm_tmpfile(void);
+void* bm_mapfile(int fd, size_t size, bool writable);
+void bm_unmapfile(void *mem, size_t size);
+void bm_writeback(void *mem, int fd, size_t of, size_t len);
+void bm_dropbehind(void *mem, int fd, size_t of, size_t len);
+int bm_place(void *mem, size_t size, int numa);
+int bm_nbnodes(void);
+const cpu_set_t* bm_nodecpus(int numa);
+int bm_setnode(size_t setsize, const cpu_set_t *set);
+
+#endif
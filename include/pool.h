@@ -0,0 +1,81 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include "common.h"
+
+
+struct s_node;
+
+/**
+ * Task of a queue
+ */
+struct pl_task {
+    struct s_node* nd;         /* Node to run */
+    unsigned long seq;         /* Order of submission */
+};
+
+/**
+ * Priority queue of tasks:
+ * a binary heap of tasks, the most urgent at the root. The 
+ * owner worker pushes and pops tasks, idle workers steal 
+ * the most urgent one.
+ */
+struct pl_queue {
+    struct pl_task* tasks;     /* Heap of tasks */
+    unsigned int size;         /* Capacity of the heap */
+    unsigned int nb;           /* Number of queued tasks */
+    unsigned long seq;         /* Submissions so far */
+    bool lifo;                 /* Most recent first on ties */
+    pthread_spinlock_t lock;   /* Concurrent accesses owner/thieves */
+};
+
+/**
+ * Worker of a pool 
+ */
+struct pl_worker {
+    pthread_t id;              /* Thread of the worker */
+    struct s_pool* pl;         /* Pool of the worker */
+    unsigned int idx;          /* Index of the worker in the pool */
+    struct pl_queue pq;        /* Tasks launched by this worker */
+    cpu_set_t home;            /* Cpus of the worker when idle */
+    cpu_set_t cpus;            /* Cpus of the worker right now */
+};
+
+/**
+ * Worker pool:
+ * a set of persistent threads executing nodes as tasks. 
+ * Nodes launched by a worker are pushed on the worker's own
+ * queue: the worker runs the most urgent one as soon as it is
+ * free while idle workers steal the others. Nodes launched from
+ * any other thread are queued on a shared queue.
+ * A pool can be shared by several straphs.
+ */
+typedef struct s_pool {
+    struct pl_worker* workers;   /* Workers */
+    unsigned int nb_workers;     /* Number of workers */
+
+    struct pl_queue shared;      /* Nodes launched out of the pool */
+    bool stop;                   /* Workers must terminate */
+
+    unsigned int nb_tasks;       /* Tasks queued, in any queue */
+    unsigned int nb_idle;        /* Workers waiting for tasks */
+
+    pthread_mutex_t lock;        /* Protects the sleep of the 
+                                    workers and the completion 
+                                    of the tasks */
+    pthread_cond_t  cond_task;   /* Signal new tasks or stop */
+    pthread_cond_t  cond_done;   /* Signal terminated tasks */
+} *pool;
+
+
+pool st_makepool(unsigned int nb_workers);
+int st_destroypool(pool pl);
+int pl_submit(pool pl, struct s_node* nd);
+int pl_wait(pool pl, struct s_node* nd);
+int pl_done(pool pl, struct s_node* nd, void* ret);
+
+#endif
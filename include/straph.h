@@ -4,19 +4,69 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/uio.h>
 #include "linked_fifo.h"
 #include "common.h"
+#include "pool.h"
 
 
 /* Buffer types */
 #define NO_BUF   0 /* Empty slot      */
 #define CIR_BUF  1 /* Circular buffer */
 #define LIN_BUF  2 /* Linear buffer   */
+#define MAP_BUF  3 /* Linear buffer mapping a file */
+
+/* Buffer options (see st_bufopt) */
+#define BOPT_BROADCAST 0 /* CIR_BUF: readers advance their own cursor */
+#define BOPT_MIRROR    1 /* CIR_BUF: memory mapped twice, chunks never wrap */
+#define BOPT_MESSAGE   2 /* CIR_BUF: every write is a message (st_readmsg) */
+#define BOPT_MINCHUNK  3 /* CIR_BUF: coalesce the writes up to this size */
+#define BOPT_MAXCHUNK  4 /* CIR_BUF: max size of the data of a chunk */
+#define BOPT_WAIT      5 /* Wait policy of the readers and of the writer */
+#define BOPT_SPINS     6 /* Rounds of polling of the wait policy */
+#define BOPT_PUBCHUNKS 7 /* CIR_BUF: chunks read given back at once */
+#define BOPT_PUBBYTES  8 /* CIR_BUF: bytes read given back at once */
+#define BOPT_ELASTIC   9 /* CIR_BUF: max size of a ring growing under pressure */
+#define BOPT_GROWWAIT 10 /* CIR_BUF: time waited by the writer before growing */
+#define BOPT_SHRINK   11 /* CIR_BUF: back to the initial size when rewinded */
+#define BOPT_SEGMENT  12 /* LIN_BUF: grows by segments of this size */
+#define BOPT_MEMORY   13 /* Memory options of the buffer (BMEM_*) */
+#define BOPT_SHARED   14 /* Buffer shared with the forked nodes (PROC_EXEC) */
+
+/* Memory options (see BOPT_MEMORY) */
+#define BMEM_HUGE     0x1 /* Transparent huge pages */
+#define BMEM_HUGETLB  0x2 /* Explicit huge pages, reserved by the system */
+#define BMEM_PREFAULT 0x4 /* Pages committed at the allocation */
+#define BMEM_LOCK     0x8 /* Pages locked in memory (mlock) */
+
+/* Wait policies (see BOPT_WAIT) */
+#define WAIT_BLOCK     0 /* Sleep at once (default) */
+#define WAIT_SPIN      1 /* Spin a bounded number of rounds, then sleep */
+#define WAIT_SPINYIELD 2 /* Spin, then yield the CPU, then sleep */
+#define WAIT_POLL      3 /* Never sleep */
+#define WAIT_DEFSPINS  1000 /* Default number of rounds */
 
 /* Run modes */
 #define PAR_MODE 0  /* Parallel */
 #define SEQ_MODE 1  /* Sequential */
 
+/* Execution modes */
+#define POOL_EXEC   0  /* Run by a worker of the straph's pool */
+#define THREAD_EXEC 1  /* Run by a dedicated thread */
+#define GREEN_EXEC  2  /* Run as a coroutine carried by the pool */
+#define PROC_EXEC   3  /* Run in a forked process */
+
+/* Placement policies of the buffers */
+#define PLACE_NONE   0  /* Leave the memory where it is allocated */
+#define PLACE_WRITER 1  /* On the NUMA node of the writer */
+#define PLACE_READER 2  /* On the NUMA node of most readers */
+#define PLACE_AUTO   3  /* Co-locate the nodes of a same flow, 
+                           buffers on the NUMA node of the writer */
+
+struct s_straph;
+struct gr_coro;
+
 /**
  * This struct is used to link each
  * node with its neighbours: the nodes
@@ -57,31 +107,63 @@ struct neighbour {
 #define ACTIVE     1
 #define TERMINATED 2
 #define JOINED     3
-#define DOOMED     4
+#define DOOMED     4  /* Not run: failed to launch (see st_join) */
 
 /**
  * Main structure representing node
  */
 typedef struct s_node {
 
-    pthread_spinlock_t launch_lock;  /* Lock used while launching 
-                                        the node to avoid multiple 
-                                        executions */
-
     void* (*entry)(struct s_node*);  /* Entry point of the module */
     unsigned int nb_parents;         /* Nb of parents liked to this node */
-    unsigned int nb_startrequests;   /* Nb of times a parent tried to 
-                                        launch this node */
+    unsigned int nb_pending;         /* Start requests still needed 
+                                        before launching the node
+                                        (atomic countdown) */
     unsigned char status;            /* Status of this node */
+    unsigned char exec_mode;         /* Execution mode of this node */
     pthread_t id;                    /* Id of the module */
     void* ret;                       /* Return value */
 
+    /* Execution context */
+    struct s_straph* st;             /* Straph compiled with or running
+                                        this node */
+    unsigned int idx;                /* Index in the straph's plan */
+    struct s_node* next;             /* Next node in a queue */
+    struct s_node* launched;         /* Next launched node whose 
+                                        children must be requested */
+    struct gr_coro* coro;            /* Coroutine (green nodes) */
+    size_t sizestack;                /* Size of the stack of the 
+                                        coroutine (0 for the default) */
+    bool done;                       /* Execution terminated (pool) */
+    bool visited;                    /* Mark used by graph walks */
+
+    /* Iterations (st_run) */
+    unsigned int iter_started;       /* Iterations launched */
+    unsigned int iter_done;          /* Iterations terminated */
+    bool running;                    /* Running an iteration */
+
+    /* Placement */
+    cpu_set_t* cpuset;               /* Cpus allowed (NULL for any) */
+    size_t setsize;                  /* Size of cpuset in bytes */
+    int numa;                        /* NUMA node of the node (-1 if 
+                                        unknown), set at compilation */
+
+    /* Scheduling */
+    int priority;                    /* Run before lower priorities */
+    uint64_t cost;                   /* Cost hint in ns (0 if none) */
+    uint64_t measured;               /* Measured cost in ns (average) */
+    uint64_t rank;                   /* Cost of the longest path of 
+                                        execution starting here */
+    uint64_t queued;                 /* Time of the admission request */
+
     /* Input flow */    
     unsigned int nb_inslots;         /* Number of input slots */
     void ** inslots;                 /* Pointers to the output buffer
                                         of the source nodes when not 
                                         active. Pointers to the input
                                         slots when active */
+    void* isstore;                   /* Storage of the input slots */
+    unsigned int nb_isstore;         /* Capacity of the storage */
 
     /* Output flow */    
     unsigned int nb_outslots;         /* Number of output buffers */
@@ -96,6 +178,47 @@ typedef struct s_node {
 } *node;
     
 
+/**
+ * Execution plan:
+ * the frozen topology of a straph. Nodes are stored in 
+ * topological order and identified by their index in
+ * this order. The children of the node i are the nodes
+ * adj[adj_off[i]] to adj[adj_off[i+1]-1], linked with the
+ * run modes adj_mode[adj_off[i]] to adj_mode[adj_off[i+1]-1].
+ * Parents (par), nodes writing into the input slots (wr) and 
+ * nodes reading from the output buffers (rd) are stored
+ * the same way.
+ */
+struct st_plan {
+    unsigned int nb_nodes;      /* Number of nodes */
+    node* order;                /* Nodes in topological order */
+    unsigned int* adj_off;      /* Offset of the children of each node */
+    unsigned int* adj;          /* Children (index of the node) */
+    unsigned char* adj_mode;    /* Run mode of each child */
+    unsigned int* nb_parents;   /* Number of parents of each node */
+
+    unsigned int* par_off;      /* Offset of the parents of each node */
+    unsigned int* par;          /* Parents (index of the node) */
+    unsigned char* par_mode;    /* Run mode of the edge from the parent */
+
+    unsigned int* wr_off;       /* Offset of the writers of each node */
+    unsigned int* wr;           /* Writers (index of the node) */
+    unsigned int* rd_off;       /* Offset of the readers of each node */
+    unsigned int* rd;           /* Readers (index of the node) */
+};
+
+/**
+ * Admission counters of a straph
+ */
+struct st_stats {
+    unsigned int nb_running;   /* Nodes admitted and not terminated */
+    unsigned int nb_queued;    /* Nodes waiting for admission */
+    unsigned int max_queued;   /* Highest number of nodes waiting */
+    unsigned long nb_admitted; /* Nodes admitted since the creation */
+    unsigned long nb_delayed;  /* Nodes which had to wait */
+    uint64_t wait_time;        /* Time spent waiting in ns (total) */
+};
+
 /**
  * A straph is the entry point of each
  * program. A straph can be use to lauch
@@ -104,31 +227,92 @@ typedef struct s_node {
 typedef struct s_straph { 
     node* entries;           /* Entry points */
     unsigned int nb_entries; /* Number of neighbours */
+    pool pl;                 /* Pool running the nodes (if any) */
+    struct st_plan* plan;    /* Execution plan (NULL if not compiled) */
+    unsigned char placement; /* Placement policy of the buffers */
+
+    /* Completion (st_start) */
+    unsigned int nb_alive;   /* Nodes not terminated yet (atomic 
+                                countdown) */
+    bool completed;          /* Every node has terminated */
+    int launch_err;          /* First error launching a node (errno),
+                                reported by st_join */
+    int efd;                 /* Eventfd signaling the completion 
+                                (-1 if not created yet) */
+
+    /* Admission control */
+    unsigned int max_parallel; /* Max nodes running (0 for no limit) */
+    unsigned int nb_admitted;  /* Nodes running */
+    struct s_node* adm_first;  /* Least recent node waiting */
+    struct s_node* adm_last;   /* Most recent node waiting */
+    struct st_stats stats;     /* Admission counters */
+    pthread_mutex_t adm_lock;  /* Protects the admission */
+
+    /* Iterations (st_run) */
+    unsigned int run_iters;  /* Number of iterations (0 if not in st_run) */
+    size_t run_left;         /* Node iterations not terminated yet */
+    unsigned int nb_running; /* Nodes currently running */
+    int run_err;             /* First error occurred (errno) */
+
+    pthread_mutex_t lock;    /* Protects the state of the run */
+    pthread_cond_t  cond;    /* Signal the progress of the run */
 } *straph;
 
 
 void* st_threadwrapper(void *n);
-int st_starter(struct linked_fifo *lf);
-int st_nstart(node nd);
-int st_nup(node nd);
+void* st_nfork(node nd);
+void st_nfinish(node nd, void *ret);
+int st_starter(straph st, node nd);
+int st_nstart(straph st, node nd);
+int st_nup(straph st, node nd);
 void st_ndown(node nd);
+uint64_t st_clock(void);
+void st_nmeasure(node nd, uint64_t elapsed);
+const cpu_set_t* st_ncpus(node nd, size_t *setsize);
 
 
 straph st_create(void);
 node st_makenode(void* (*entry)(node));
 int st_addnode(straph g, node n);
+int st_compile(straph s);
 int st_start(straph s);
 int st_join(straph s);
+int st_tryjoin(straph s);
+int st_waitany(straph *s, unsigned int nb, int timeout);
+int st_fd(straph s);
+int st_ndone(node n);
+int st_run(straph s, unsigned int n_iterations);
 int st_ndestroy(node n);
 int st_destroy(straph s);
 int st_setbuffer(node n, unsigned int idx_buf, unsigned char buftype, size_t bufsize);
+int st_setpool(straph s, pool pl);
+int st_setexec(node n, unsigned char mode);
+int st_setstacksize(node n, size_t size);
+int st_setaffinity(node n, size_t setsize, const cpu_set_t *set);
+int st_setplacement(straph s, unsigned char policy);
+int st_setpriority(node n, int priority);
+int st_setcost(node n, uint64_t cost);
+int st_setmaxparallel(straph s, unsigned int max);
+int st_getstats(straph s, struct st_stats *stats);
 int st_nlink(node a, node b, unsigned char mode);
 int st_addflow(node a, unsigned int idx_buf, node b, unsigned int is);
 int st_nrewind(node n);
 int st_rewind(straph s);
 ssize_t st_read(node n, unsigned int slot, void* buf, size_t nbyte);
+int st_readpeek(node n, unsigned int slot, const void **ptr, size_t *len);
+int st_readconsume(node n, unsigned int slot, size_t nbyte);
+ssize_t st_readmsg(node n, unsigned int slot, void *buf, size_t nbyte);
+ssize_t st_readmsgv(node n, unsigned int slot, struct iovec *iov, int iovcnt);
+ssize_t st_msgsize(node n, unsigned int slot);
 ssize_t st_write(node n, unsigned int slot, const void* buf, size_t nbyte);
+void* st_writereserve(node n, unsigned int slot, size_t size);
+ssize_t st_writecommit(node n, unsigned int slot, size_t used);
 int st_bufstat(node n, unsigned int slot, int status);
+int st_bufopt(node n, unsigned int slot, int opt, size_t value);
+int st_flush(node n, unsigned int slot);
+ssize_t st_bufsize(node n, unsigned int slot);
+int st_bufretain(node n, unsigned int slot, const char *path);
+int st_bufopen(node n, unsigned int slot, const char *path);
 
 
 
@@ -0,0 +1,47 @@
+#ifndef _SYNC_H_
+#define _SYNC_H_
+
+#include <pthread.h>
+#include "common.h"
+
+
+/**
+ * Event:
+ * lets a thread (or a green node) sleep until another one 
+ * signals a change of a lock-free state. The waiter arms the
+ * event before checking the state one last time, the signaler
+ * looks at the event after updating the state: one of the two
+ * always sees the other. Signals cost a single load when the
+ * event is not armed, and the first signal disarms it: a waiter
+ * is woken up once, not at every change.
+ */
+struct st_event {
+    unsigned int seq;           /* Incremented at every wake up */
+    unsigned int armed;         /* Someone is about to wait */
+    unsigned int pshared;       /* Waiters may be in other processes */
+};
+
+
+/**
+ * Wait policy:
+ * tells how long a waiter polls the awaited state
+ * before sleeping (see st_backoff)
+ */
+struct st_waitpol {
+    unsigned char policy;       /* One of WAIT_* */
+    unsigned int spins;         /* Rounds of each polling phase */
+};
+
+
+int st_mutexinit(pthread_mutex_t* mutex, bool pshared);
+int st_condinit(pthread_cond_t* cond, bool pshared);
+int st_lock(pthread_mutex_t* mutex, unsigned int* failed);
+int st_condwait(pthread_cond_t* cond, pthread_mutex_t* mutex, 
+                unsigned int* failed);
+int st_condbroadcast(pthread_cond_t* cond);
+unsigned int st_evprepare(struct st_event* ev);
+int st_evwait(struct st_event* ev, unsigned int seq);
+void st_evsignal(struct st_event* ev);
+bool st_backoff(const struct st_waitpol* w, unsigned int* round);
+
+#endif
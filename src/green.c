@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "green.h"
+#include "straph.h"
+
+
+/* Coroutine running on the current thread (if any) */
+static __thread struct gr_coro* gr_current = NULL;
+
+/* Context of the current thread when carrying a coroutine */
+static __thread ucontext_t gr_carrier;
+
+/**
+ * List of parked nodes, waiting for a buffer to signal a change.
+ * The nodes waiting on a same address are in the same list,
+ * each list on its own cache lines.
+ */
+struct gr_bucket {
+    pthread_mutex_t lock;       /* Protects the list */
+    node parked;                /* Parked nodes (chained by 'next') */
+    unsigned int nbparked;      /* Number of parked nodes */
+    char pad[128 - sizeof(pthread_mutex_t) - sizeof(node)
+             - sizeof(unsigned int)];
+};
+
+static struct gr_bucket gr_buckets[GR_NBBUCKETS];
+static pthread_once_t gr_once = PTHREAD_ONCE_INIT;
+
+
+
+
+
+/**
+ * @brief Initialize the lists of parked nodes
+ */
+static void gr_init(void){
+    unsigned int i;
+
+    for (i = 0; i < GR_NBBUCKETS; i++){
+        pthread_mutex_init(&gr_buckets[i].lock, NULL);
+        gr_buckets[i].parked = NULL;
+        gr_buckets[i].nbparked = 0;
+    }
+}
+
+
+
+
+
+/**
+ * @brief Find the list of the nodes waiting on an address
+ * @param key address waited
+ * @return the list of parked nodes
+ */
+static inline struct gr_bucket* gr_bucket(const void *key){
+    uint32_t h = (uint32_t) ((uintptr_t) key >> 4) * 2654435761u;
+    return &gr_buckets[h >> 24 & (GR_NBBUCKETS - 1)];
+}
+
+
+
+
+
+/**
+ * @brief Entry point of every coroutine
+ *
+ * Runs the routine of the node, then gives the worker back for
+ * the last time. Everything else (bringing the node down, launching
+ * the children) is done by the worker, out of the node's stack
+ */
+static void gr_trampoline(void){
+    struct gr_coro *co = gr_current;
+    node nd = co->nd;
+    uint64_t start;
+
+    /* The measure includes the time spent parked */
+    start = st_clock();
+    co->ret = nd->entry(nd);
+    st_nmeasure(nd, st_clock() - start);
+    co->finished = true;
+
+    swapcontext(&co->ctx, co->carrier);
+}
+
+
+
+
+
+/**
+ * @brief Allocate the coroutine of a node
+ * @param sizestack size of the stack, 0 for GR_STACKSIZE
+ * @return a coroutine or NULL in case of error, in this
+ *         case errno is set
+ */
+static struct gr_coro* gr_make(size_t sizestack){
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct gr_coro *co;
+    char *mem;
+
+    pthread_once(&gr_once, gr_init);
+
+    co = calloc(1, sizeof(struct gr_coro));
+    if (co == NULL) return NULL;
+
+    if (sizestack == 0) sizestack = GR_STACKSIZE;
+    co->sizestack = (sizestack + page - 1) / page * page;
+
+    /* Pages are only committed when touched */
+    mem = mmap(NULL, co->sizestack + page, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+               MAP_STACK, -1, 0);
+    if (mem == MAP_FAILED){
+        free(co);
+        return NULL;
+    }
+
+    /* The stack grows down: an overflow faults on the guard page */
+    if (mprotect(mem, page, PROT_NONE) == -1){
+        munmap(mem, co->sizestack + page);
+        free(co);
+        return NULL;
+    }
+    co->stack = mem + page;
+
+    return co;
+}
+
+
+
+
+
+/**
+ * @brief Free the coroutine of a node
+ * @param co a coroutine which is not running
+ */
+void gr_destroy(struct gr_coro *co){
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    if (co == NULL) return;
+
+    munmap((char*) co->stack - page, co->sizestack + page);
+    free(co);
+}
+
+
+
+
+
+/**
+ * @brief Park a node which yielded
+ * @param nd node to park
+ * @param key address waited by the node
+ */
+static void gr_park(node nd, const void *key){
+    struct gr_bucket *bk = gr_bucket(key);
+
+    pthread_mutex_lock(&bk->lock);
+
+    __atomic_add_fetch(&bk->nbparked, 1, __ATOMIC_SEQ_CST);
+    nd->next = bk->parked;
+    bk->parked = nd;
+
+    pthread_mutex_unlock(&bk->lock);
+}
+
+
+
+
+
+/**
+ * @brief Start or resume the execution of a green node
+ *        on the current thread
+ *
+ * Switches to the node's stack until the node either returns
+ * or yields. A node which yields is parked and the mutex it was
+ * waiting on is released.
+ *
+ * @param nd a green node
+ * @return 1 if the node's routine has returned (the value returned
+ *         is stored in nd->coro->ret), 0 if the node yielded or -1
+ *         in case of error, in this case errno is set
+ */
+int gr_resume(node nd){
+    pthread_mutex_t *mutex;
+    unsigned int *waddr, wval;
+    struct gr_coro *co = nd->coro;
+
+    if (co == NULL){
+        if ((co = gr_make(nd->sizestack)) == NULL) return -1;
+        co->nd = nd;
+        nd->coro = co;
+    }
+
+    if (co->started == false){
+        if (getcontext(&co->ctx) == -1) return -1;
+        co->ctx.uc_stack.ss_sp = co->stack;
+        co->ctx.uc_stack.ss_size = co->sizestack;
+        co->ctx.uc_link = NULL;
+        makecontext(&co->ctx, gr_trampoline, 0);
+
+        co->started  = true;
+        co->finished = false;
+    }
+
+    /* Run the node */
+    co->carrier = &gr_carrier;
+    co->unlock = NULL;
+    co->waddr = NULL;
+    gr_current = co;
+
+    if (swapcontext(&gr_carrier, &co->ctx) == -1){
+        gr_current = NULL;
+        return -1;
+    }
+
+    gr_current = NULL;
+
+    if (co->finished){
+        co->started = false;
+        return 1;
+    }
+
+    /*
+     The node yielded: park it before releasing the mutex,
+     this way the next broadcast on the buffer finds it.
+     Once parked the node can be resumed at any time.
+    */
+    mutex = co->unlock;
+    waddr = co->waddr;
+    wval  = co->wval;
+    gr_park(nd, co->key);
+
+    if (mutex != NULL){
+        pthread_mutex_unlock(mutex);
+    } else if (__atomic_load_n(waddr, __ATOMIC_SEQ_CST) != wval){
+        /* Changed before the node was parked: nobody saw it */
+        gr_wake(waddr);
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Yield the worker carrying the current green node
+ *
+ * Shall be called by a green node instead of waiting on a
+ * condition. The mutex is released once the node is parked and
+ * locked again when the node is resumed, like pthread_cond_wait
+ * the function may return without the condition being signaled.
+ *
+ * @param cond condition waited, the node is resumed by gr_wake(cond)
+ * @param mutex locked mutex protecting the waited condition
+ * @return 0 in case of success, an error number otherwise
+ */
+int gr_yield(pthread_cond_t *cond, pthread_mutex_t *mutex){
+    struct gr_coro *co = gr_current;
+
+    co->key = cond;
+    co->unlock = mutex;
+    if (swapcontext(&co->ctx, co->carrier) == -1) return errno;
+
+    /* Resumed, possibly by another worker */
+    return pthread_mutex_lock(mutex);
+}
+
+
+
+
+
+/**
+ * @brief Yield the worker carrying the current green node
+ *        until a word changes
+ *
+ * Same as gr_yield for a wait without mutex (see st_evwait): 
+ * the node is parked while *addr is equal to val. The function
+ * may return without the word being changed.
+ *
+ * @param addr address of the waited word, the node is resumed 
+ *        by gr_wake(addr)
+ * @param val value of the word when the wait started
+ * @return 0 in case of success, an error number otherwise
+ */
+int gr_yieldword(unsigned int *addr, unsigned int val){
+    struct gr_coro *co = gr_current;
+
+    co->key = addr;
+    co->waddr = addr;
+    co->wval  = val;
+    if (swapcontext(&co->ctx, co->carrier) == -1) return errno;
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Tell if the current thread is running a green node
+ * @return true if running a green node
+ */
+bool gr_ingreen(void){
+    return gr_current != NULL;
+}
+
+
+
+
+
+/**
+ * @brief Terminate a parked node which can't be resumed
+ *
+ * The node is brought down as if its routine failed, its stack
+ * is left as it is and started again at the next execution.
+ *
+ * @param nd a green node taken out of its list
+ */
+static void gr_abandon(node nd){
+    nd->coro->started = false;
+    nd->coro->ret = (void*) 1;
+    st_nfinish(nd, nd->coro->ret);
+}
+
+
+
+
+
+/**
+ * @brief Resume the nodes parked on an address
+ *
+ * Hands the nodes waiting on the address back to the pool of 
+ * their straph. The nodes check again their condition and yield
+ * again if it is not satisfied. A node the pool can't take is
+ * terminated (see gr_abandon). Costs a single load when no node
+ * is parked on the list of the address.
+ *
+ * @param key address signaled (condition or word)
+ */
+void gr_wake(const void *key){
+    struct gr_bucket *bk = gr_bucket(key);
+    node nd, next, *prev, woken = NULL;
+
+    if (__atomic_load_n(&bk->nbparked, __ATOMIC_SEQ_CST) == 0) return;
+
+    /* The list may hold nodes waiting on other addresses */
+    pthread_mutex_lock(&bk->lock);
+    prev = &bk->parked;
+    for (nd = bk->parked; nd != NULL; nd = next){
+        next = nd->next;
+        if (nd->coro->key != key){
+            prev = &nd->next;
+            continue;
+        }
+
+        *prev = next;
+        nd->next = woken;
+        woken = nd;
+        __atomic_sub_fetch(&bk->nbparked, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&bk->lock);
+
+    while (woken != NULL){
+        next = woken->next;
+        if (pl_submit(woken->st->pl, woken) == -1) gr_abandon(woken);
+        woken = next;
+    }
+}
+
+
+
+
+
+/**
+ * @brief Forget the parked nodes in a forked process
+ *
+ * The parked nodes belong to the parent process, only it
+ * shall resume them. Shall be called by the child right after
+ * the fork, the lock may have been held by another thread.
+ */
+void gr_forget(void){
+    gr_init();
+}
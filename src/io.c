@@ -3,8 +3,14 @@
 #include <string.h>
 #include <errno.h>
 #include <stddef.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <sys/stat.h>
 #include "io.h"
+#include "sync.h"
+#include "mem.h"
 
 
 
@@ -16,6 +22,31 @@
 /*************************************************************/
 
 
+/**
+ * @brief Allocate the memory of a circular buffer
+ * @param size Size of the memory
+ * @param mirror true to map the memory twice (see bm_mirror)
+ * @param flags Memory options (BMEM_*)
+ * @return the memory or NULL in case of error
+ */
+static char* cb_alloc(size_t size, bool mirror, int flags){
+    return mirror ? bm_mirror(size, flags) : bm_alloc(size, flags);
+}
+
+
+/**
+ * @brief Free the memory of a circular buffer
+ * @param mem Memory given by cb_alloc
+ * @param size Size of the memory
+ * @param mirror true if the memory is mirrored
+ * @param flags Memory options given to cb_alloc
+ */
+static void cb_free(char *mem, size_t size, bool mirror, int flags){
+    if (mirror) bm_unmirror(mem, size);
+    else bm_free(mem, size, flags);
+}
+
+
 /**
  * @brief get the count field of a chunk (i.e. number of times
  *        the chunk was read)
@@ -23,9 +54,9 @@
  * @param of_ck Offset to the chunk
  * @return The number of times the chunk was read
  */
-static inline ckcount_t cb_getckcount(struct c_buf *cb, unsigned int of_ck){
+static inline ckcount_t cb_getckcount(struct c_buf *cb, size_t of_ck){
     ckcount_t s;
-    CB_READUI16(cb,of_ck,&s);
+    CB_READFIELD(cb,of_ck,&s,sizeof(ckcount_t));
     return s;
 }
 
@@ -36,56 +67,69 @@ static inline ckcount_t cb_getckcount(struct c_buf *cb, unsigned int of_ck){
  * @param of_ck Offset to the chunk
  * @return Size of the chunk in bytes
  */
-static inline cksize_t cb_getcksize(struct c_buf *cb, unsigned int of_ck){
+static inline cksize_t cb_getcksize(struct c_buf *cb, size_t of_ck){
     cksize_t s;
-    CB_READUI16(cb,of_ck+2,&s);
+    CB_READFIELD(cb,of_ck+sizeof(ckcount_t),&s,sizeof(cksize_t));
     return s;
 }
 
 
 /**
- * @brief Calculate the effective space available for
- *        data transfer by calculation the number of chunks 
- *        needed and subtracting the size of the headers
- * @param free_space Total free space       
- * @return Effective free space for data transfer
+ * @brief Calculate the space the writer can use: the space
+ *        of the open chunk is not free
+ * @param cb Pointer to a circular buffer
+ * @return Free space in bytes
  */
-static inline size_t cb_realfreespace(size_t free_space){
-    size_t min_chunks;
+static inline size_t cb_freespace(struct c_buf *cb){
+    size_t used;
+
+    /* No need to lock the references when a writer is reading them */
+    used = cb->ref_datawritten - cb->ref_datatransf;
+    if (cb->ckopen) used += SIZE_CKHEAD + cb->ckfill;
 
-    if (free_space <= SIZE_CKHEAD) return 0;
-    min_chunks = (free_space+MAX_CKSIZE-1) / MAX_CKSIZE;
-    return free_space - SIZE_CKHEAD*min_chunks;
+    return cb->sizebuf - used;
 }
 
 
-/* Note: Does not update of_lastck */
-/* Note: Does not check for free space*/
-/* Note: Supposes that bufsize > nbyte */
-static inline void cb_writechunk
-(struct c_buf *cb, size_t offset, const void *buf, cksize_t nbyte){
+/**
+ * @brief Copy data into a circular buffer (the space is
+ *        supposed to be free)
+ * @param cb Pointer to a circular buffer
+ * @param pos Position of the data in the stream
+ * @param buf A buffer containing the data to write
+ * @param nbyte Number of bytes to write
+ */
+static inline void cb_copyin(struct c_buf *cb, size_t pos, 
+                             const void *buf, size_t nbyte){
+    size_t of, linear_size;
+
+    /* First write on contiguous memory (all of it if mirrored) */
+    of = CB_OF(cb, pos);
+    linear_size = cb->mirror ? nbyte : MIN(nbyte, cb->sizebuf - of);
+    memcpy(&cb->buf[of], buf, linear_size);
+
+    /* Second write on contiguous memory */
+    memcpy(cb->buf, (const char*) buf + linear_size, nbyte - linear_size);
+}
 
-    cksize_t linear_size;
-    ckcount_t count;
 
-    /* Write header */
-    count = 0;
-    CB_WRITEUI16(cb, offset, &count);
-    CB_WRITEUI16(cb, offset+sizeof(ckcount_t), &nbyte);
 
-    /* Calculate data offset */
-    offset = (offset + SIZE_CKHEAD) % cb->sizebuf;
+/**
+ * @brief Copy data out of a circular buffer, without consuming it
+ * @param cb Pointer to a circular buffer
+ * @param pos Position of the data in the stream
+ * @param buf Buffer where to transfer the data
+ * @param nbyte Number of bytes to copy (already written)
+ */
+static inline void cb_copyout(struct c_buf *cb, size_t pos, void *buf, 
+                              size_t nbyte){
+    size_t of, linear_size;
 
-    /* First write on contiguous memory */
-    linear_size = MIN(cb->sizebuf-offset,nbyte);
-    memcpy(&cb->buf[offset], buf, linear_size);
+    of = CB_OF(cb, pos);
+    linear_size = cb->mirror ? nbyte : MIN(nbyte, cb->sizebuf - of);
 
-    if ( linear_size < nbyte){
-        /* Second write on contiguous memory */
-        buf = (char*) buf + linear_size;
-        offset = (offset + linear_size) % cb->sizebuf;
-        memcpy(&cb->buf[offset], buf, nbyte-linear_size);
-    }
+    memcpy(buf, &cb->buf[of], linear_size);
+    memcpy((char*) buf + linear_size, cb->buf, nbyte - linear_size);
 }
 
 
@@ -104,46 +148,71 @@ static inline void cb_writechunk
 ssize_t cb_releasable 
 (struct c_buf *cb, ckcount_t maxreads, bool blocking){
     ssize_t freedsize;
-    size_t of_ck, end;
+    size_t ck, end, seq;
+    unsigned int round;
   
     freedsize = 0; 
+    round = 0;
 
     /* No need to lock the references when a writer
        is reading them */
-    of_ck = cb->ref_datatransf % cb->sizebuf;
-    end   = cb->ref_datawritten % cb->sizebuf;
+    ck  = cb->ref_datatransf;
+    end = cb->ref_datawritten;
 
-    PTH_ERRCK_NC(pthread_mutex_lock(&cb->lock_ckcount))
+    PTH_ERRCK_NC(st_lock(&cb->lock_ckcount, &cb->failed))
 
     while (1){
 
-        while (1){
+        /* Stop when every written ck has been considered */
+        while (ck < end){
             ckcount_t ckcount;
             cksize_t cksize;
+            size_t of_ck = CB_OF(cb, ck);
 
             /* Check ck read count */
-            CB_READUI16(cb,of_ck,&ckcount);
+            ckcount = cb_getckcount(cb, of_ck);
             if (ckcount < maxreads) break;
 
             /* Consider the total size of the ck as free */ 
-            CB_READUI16(cb,of_ck+sizeof(ckcount_t),&cksize);
+            cksize = cb_getcksize(cb, of_ck);
             freedsize += SIZE_CKHEAD + cksize;
 
             /* Move to next ck */
-            of_ck = (of_ck + SIZE_CKHEAD+cksize) % cb->sizebuf;
-            
-            /* Stop, ck finished */
-            if (of_ck == end) break; 
+            ck += SIZE_CKHEAD+cksize;
         }
 
         if ( blocking == false || freedsize != 0) break;
 
+        /* A reader died: its reads will never come */
+        if (cb->failed){
+            PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_ckcount))
+            errno = EOWNERDEAD;
+            return -1;
+        }
+
+        /* The readers publish their reads at once from now on */
+        __atomic_store_n(&cb->wwaiting, true, __ATOMIC_SEQ_CST);
+
+        /* Poll the frees of the readers before sleeping */
+        if (cb->wait.policy != WAIT_BLOCK){
+            seq = cb->freeseq;
+            PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_ckcount))
+
+            while (__atomic_load_n(&cb->freeseq, __ATOMIC_ACQUIRE) == seq &&
+                   st_backoff(&cb->wait, &round));
+
+            PTH_ERRCK_NC(st_lock(&cb->lock_ckcount, &cb->failed))
+            if (cb->freeseq != seq) continue;
+        }
+
         /* TODO look for eventual cleaning */
-        PTH_ERRCK_NC(pthread_cond_wait(&cb->cond_free, 
-                        &cb->lock_ckcount))
+        PTH_ERRCK(st_condwait(&cb->cond_free, &cb->lock_ckcount, 
+                              &cb->failed), 
+                  pthread_mutex_unlock(&cb->lock_ckcount);)
 
     }
 
+    __atomic_store_n(&cb->wwaiting, false, __ATOMIC_SEQ_CST);
     PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_ckcount))
 
     return freedsize;
@@ -163,7 +232,7 @@ ssize_t cb_releasable
  */
 int cb_release(struct c_buf *cb, size_t nbyte){
 
-    PTH_ERRCK_NC(pthread_mutex_lock(&cb->lock_refs))
+    PTH_ERRCK_NC(st_lock(&cb->lock_refs, &cb->failed))
 
     cb->ref_datatransf += nbyte;
 
@@ -181,51 +250,78 @@ int cb_release(struct c_buf *cb, size_t nbyte){
  */
 int cb_acquire(struct c_buf *cb, size_t nbyte){
 
-    PTH_ERRCK_NC(pthread_mutex_lock(&cb->lock_refs))
+    PTH_ERRCK_NC(st_lock(&cb->lock_refs, &cb->failed))
 
-    cb->ref_datawritten +=  nbyte;
+    __atomic_store_n(&cb->ref_datawritten, cb->ref_datawritten + nbyte,
+                     __ATOMIC_RELEASE);
 
     PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_refs))
-    PTH_ERRCK_NC(pthread_cond_broadcast(&cb->cond_acquire))
+    PTH_ERRCK_NC(st_condbroadcast(&cb->cond_acquire))
 
     return 0;
 }
 
 /**
- * @brief writes directly data into cb (as chunks) without
- *        any previous check (the space is supposed to be free)
+ * @brief Publish the chunk being filled by the writer
  * @param cb Pointer to a circular buffer
- * @param of_start Offset from where start writing
- * @param buf A buffer containing the data to write
- * @param nbyte Number of bytes to write
- * @return space used
+ * @return 0 in case of success, -1 otherwise
  */
-size_t cb_dowrite(struct c_buf *cb, size_t of_start, const void *buf, size_t nbyte){
+static int cb_closechunk(struct c_buf *cb){
+    size_t of_ck = cb->ref_datawritten;
+    ckcount_t count = 0;
+    cksize_t size = cb->ckfill;
+
+    if (cb->ckopen == false) return 0;
+    cb->ckopen = false;
+
+    /* Nothing was written: drop the chunk */
+    if (size == 0) return 0;
+
+    CB_WRITEFIELD(cb, of_ck, &count, sizeof(ckcount_t));
+    CB_WRITEFIELD(cb, of_ck + sizeof(ckcount_t), &size, sizeof(cksize_t));
+
+    return cb_acquire(cb, SIZE_CKHEAD + size);
+}
+
+
 
-    size_t size_written = 0;
-    cksize_t size_chunk = 0;
-    if (nbyte == 0) return 0;
 
-    while (nbyte > size_written){
 
-        /* Write nbyte bytes chunk by chunk */
-        size_chunk = MIN(MAX_CKSIZE, nbyte-size_written);
-        cb_writechunk(cb, of_start+size_written, buf, size_chunk);
+/**
+ * @brief Wait for free space, reclaiming the chunks read by 
+ *        every reader. The open chunk is published before
+ *        waiting (readers may be waiting for it)
+ * @param cb Pointer to a circular buffer
+ * @param nreaders Number of readers 
+ * @param need Number of free bytes needed (at most sizebuf)
+ * @return 0 in case of success, -1 otherwise
+ */
+static int cb_waitspace(struct c_buf *cb, unsigned int nreaders, 
+                        size_t need){
+    ssize_t freed;
+
+    while (cb_freespace(cb) < need){
+        if (cb_closechunk(cb) == -1) return -1;
+        if (cb_freespace(cb) >= need) break;
 
-        buf = (char*) buf + size_chunk;
-        size_written += size_chunk; 
+        if ((freed = cb_releasable(cb, nreaders, true)) == -1 ||
+             cb_release(cb, freed) == -1) return -1;
     }
 
-    return size_written+SIZE_CKHEAD*(size_written+MAX_CKSIZE-1)/MAX_CKSIZE; 
+    return 0;
 }
 
 
 
 
 
-
 /**
  * @brief Writes data to a circular buffer
+ *
+ * The data is appended to the open chunk. A chunk is published when
+ * it holds at least minchunk bytes, when it reaches maxchunk bytes or
+ * when the writer has to wait for free space (see also cb_flush)
+ *
  * @param cb Pointer to a circular buffer
  * @param nreaders Number of readers 
  * @param buf A buffer containing the data to write
@@ -234,427 +330,2476 @@ size_t cb_dowrite(struct c_buf *cb, size_t of_start, const void *buf, size_t nby
  */
 ssize_t cb_write
 (struct c_buf *cb, unsigned int nreaders, const void *buf, size_t nbyte){
+    size_t size, written;
 
-    unsigned int of_start;
-    size_t total_freespace, real_freespace;
-    ssize_t new_freespace;
-    size_t size_written, space_used;
+    written = 0;
+    while (written < nbyte){
 
-    /* Amout of data transferred to cb */
-    size_written = 0;
+        /* Open a new chunk */
+        if (cb->ckopen == false){
+            if (cb_waitspace(cb, nreaders, SIZE_CKHEAD + 1) == -1) 
+                return -1;
+            cb->ckopen = true;
+            cb->ckfill = 0;
+        }
+
+        /* Fill the chunk as much as possible */
+        size = MIN(nbyte - written, cb->maxchunk - cb->ckfill);
+        size = MIN(size, cb_freespace(cb));
+        if (size == 0){
+            if (cb_waitspace(cb, nreaders, 1) == -1) return -1;
+            continue;
+        }
+
+        cb_copyin(cb, cb->ref_datawritten + SIZE_CKHEAD + cb->ckfill, 
+                  (const char*) buf + written, size);
+        cb->ckfill += size;
+        written += size;
+
+        if (cb->ckfill >= cb->minchunk || cb->ckfill == cb->maxchunk){
+            if (cb_closechunk(cb) == -1) return -1;
+        }
+    }
+
+    return written;
+}
 
-    /* No need to lock the references when a writer
-       is reading them */
 
-    /* Offset from where we will start writing */
-    of_start = cb->ref_datawritten % cb->sizebuf;
 
-    /* Get available free space */
-    total_freespace = cb->sizebuf - (cb->ref_datawritten - cb->ref_datatransf);
-    real_freespace  = cb_realfreespace(total_freespace);
 
-    /* If the space is not enough try to free some more */
-    if (real_freespace < nbyte){
-       
-        /* If there isn't free space at all it's ok to wait */
-        bool blocking = (real_freespace == 0);
 
-        /* Update values if new space is available */
-        if ((new_freespace = cb_releasable(cb, nreaders, blocking)) == -1) 
+/**
+ * @brief Reserve contiguous space at the end of the open chunk
+ *
+ * A new chunk is opened if the data doesn't fit into the open one.
+ * Waits until the chunk fits into the buffer. The data is added to
+ * the chunk by cb_commit
+ *
+ * @param cb Pointer to a circular buffer
+ * @param nreaders Number of readers 
+ * @param nbyte Size of the data to reserve
+ * @param mem Pointer where to store the reserved space, NULL if 
+ *        the space can't be contiguous in the buffer
+ * @return 0 in case of success, -1 otherwise
+ */
+static int cb_reserve(struct c_buf *cb, unsigned int nreaders, 
+                      size_t nbyte, void **mem){
+    size_t of_data;
+
+    *mem = NULL;
+    if (nbyte > cb->maxchunk || SIZE_CKHEAD + nbyte > cb->sizebuf) 
+        return 0;
+
+    if (cb->ckopen && (cb->ckfill + nbyte > cb->maxchunk || 
+                       cb_freespace(cb) < nbyte)){
+        if (cb_closechunk(cb) == -1) return -1;
+    }
+
+    if (cb->ckopen == false){
+        if (cb_waitspace(cb, nreaders, SIZE_CKHEAD + nbyte) == -1) 
             return -1;
-        if (new_freespace > 0){
-            total_freespace += new_freespace;
-            real_freespace = cb_realfreespace(total_freespace);
-            /* XXX is release necessary ? */
-            if (cb_release(cb, new_freespace) == -1) return -1; 
-        }
+        cb->ckopen = true;
+        cb->ckfill = 0;
     }
 
-    
-    while (1){
+    of_data = CB_OF(cb, cb->ref_datawritten + SIZE_CKHEAD + cb->ckfill);
+    if (!cb->mirror && of_data + nbyte > cb->sizebuf) return 0;
+
+    *mem = &cb->buf[of_data];
+    return 0;
+}
+
 
-        /*
-          Write as much data as possible: the size of the 
-          write is limited by real_freespace 
-        */ 
-        size_t size_write = MIN(real_freespace, nbyte-size_written);
-        space_used = cb_dowrite(cb, of_start, 
-            (char*) buf + size_written, size_write);
-        of_start += space_used; total_freespace -= space_used;
 
-        /* Update cb and notify new data */
-        if (cb_acquire(cb, space_used) == -1) return -1; 
 
-        /* Stop writing if we wrote nbyte of data */
-        size_written += size_write;
-        if (size_written >= nbyte) break;
 
-        /* Free more data, waiting if necessary */
-        if ((new_freespace = cb_releasable(cb, nreaders, true)) == -1 ||
-            /* XXX is release necessary ? */
-             cb_release(cb, new_freespace) == -1 ) return -1;
+/**
+ * @brief Add to the open chunk the data written into the space
+ *        reserved by cb_reserve
+ * @param cb Pointer to a circular buffer
+ * @param nbyte Size of the data written
+ * @return 0 in case of success, -1 otherwise
+ */
+static int cb_commit(struct c_buf *cb, size_t nbyte){
+    cb->ckfill += nbyte;
 
-        /* Update free space count */
-        total_freespace += new_freespace;
-        real_freespace  = cb_realfreespace(total_freespace);
+    if (cb->ckfill >= cb->minchunk || cb->ckfill == cb->maxchunk){
+        return cb_closechunk(cb);
     }
 
-    return size_written;
+    return 0;
 }
 
 
+
+
+
 /**
- * @brief Read as much data as possible (up to nbyte) from the cache
- * @param in Input slot 
- * @param buf Buffer where to write the data
- * @param nbyte Max size of the read in bytes 
- * return the number of bytes transferred
+ * @brief Position of the slowest reader of a ring
+ * @param cb Pointer to a circular buffer
+ * @param nreaders Number of readers
+ * @return the smallest cursor, or the head if there are no readers
  */
-size_t cb_cacheread(struct inslot_c* in, void* buf, size_t nbyte){
-    size_t size2read, linear_size;
-   
-    /* Size that will be read from the cache */
-    size2read = MIN(in->size_cdata, nbyte);
-    if (size2read == 0) return 0;
-    
-    /* First contiguous read */
-    linear_size = MIN(SIZE_CACHE - in->of_cdata, size2read);
-    memcpy(buf, &in->cache[in->of_cdata], linear_size);
-
-    /* Update cache */
-    in->of_cdata = (in->of_cdata + linear_size) % SIZE_CACHE;
+static size_t cb_mincursor(struct c_buf *cb, unsigned int nreaders){
+    size_t pos, min;
+    unsigned int i;
 
-    if (linear_size < size2read){
-        /* Second read on contiguous memory */
-        buf = (char*) buf + linear_size;
-        memcpy(buf, &in->cache[in->of_cdata], size2read-linear_size);
-        in->of_cdata = (in->of_cdata + linear_size) % SIZE_CACHE;
+    min = cb->head;
+    for (i = 0; i < nreaders; i++){
+        pos = __atomic_load_n(&cb->cursors[i].pos, __ATOMIC_SEQ_CST);
+        if (pos < min) min = pos;
     }
 
-    in->size_cdata -= size2read;
-   
-    return size2read;
+    return min;
 }
 
 
 
+
+
 /**
- * @brief 
- * @param cb Circular buffer where to read from
- * @param data_av Data available (for read) on the circular buffer
- * @param in Input slot 
- * @param buf Buffer where to transfer the read data
- * @param nbyte Number of bytes to read
- * @return
- */
- /* XXX 
-    1) what about taking data_av out of the parameter and check it
-    directly inside this function ? 
-    2) the return type is quite messy, is there any better way ?
+ * @brief Publish the data pending in a ring
+ * @param cb Pointer to a circular buffer
  */
-struct cb_transf cb_read(struct c_buf *cb, size_t data_av, 
- struct inslot_c *in, void *buf, size_t nbyte){
+static void cb_ringflush(struct c_buf *cb){
+    if (cb->pending == 0) return;
 
-/* BIG TODO: naming !!!!! */
+    __atomic_store_n(&cb->head, cb->head + cb->pending, __ATOMIC_SEQ_CST);
+    cb->pending = 0;
+    st_evsignal(&cb->ev_data);
+}
 
-    size_t linear_size; /* Size of the next contiguos read */
-    size_t of_ckend;    /* End of the current chunk */
-    size_t of_read;
-    cksize_t cksize;    /* Size of the current chunk */
-    
-    struct cb_transf tr = {0,0,0};
-    of_read = in->data_read % cb->sizebuf;
 
-    while (tr.data_size < nbyte && tr.real_size < data_av){
 
-        /* Calculate end of the current chunk */
-        cksize   = cb_getcksize(cb,in->of_ck);
-        of_ckend = (in->of_ck + cksize + SIZE_CKHEAD) % cb->sizebuf;
 
-        /* If we are at the beginning of the chunk, consider the header as read */
-        if (of_read == in->of_ck){
-            of_read = (in->of_ck + SIZE_CKHEAD) % cb->sizebuf;
-            tr.real_size += SIZE_CKHEAD;
+
+/**
+ * @brief Enlarge an elastic ring keeping its unread data
+ *
+ * The ring is doubled, up to maxsize. The readers are kept out of
+ * the memory of the ring while the data is moved (see cb_ringenter).
+ * The growth is given up if the space needed gets free meanwhile.
+ *
+ * @param cb Pointer to a circular buffer
+ * @param nreaders Number of readers
+ * @param need Number of free bytes needed
+ * @return true if the ring was enlarged
+ */
+static bool cb_ringgrow(struct c_buf *cb, unsigned int nreaders, 
+                        size_t need){
+    size_t sizebuf, pos, end, size;
+    unsigned int i, seq;
+    char *mem;
+
+    /* A mirrored ring stays a power of two, sizebuf is on 32 bits */
+    sizebuf = MIN((size_t) cb->sizebuf * 2, cb->maxsize);
+    if (sizebuf <= cb->sizebuf || sizebuf > UINT_MAX ||
+        (cb->mirror && sizebuf != (size_t) cb->sizebuf * 2)) return false;
+    mem = cb_alloc(sizebuf, cb->mirror, cb->memflags);
+    if (mem == NULL) return false;
+
+    /* Wait for the readers to leave the memory */
+    end = cb->head + cb->pending;
+    __atomic_store_n(&cb->growing, 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < cb->nb_cursors; i++){
+        while (__atomic_load_n(&cb->cursors[i].busy, __ATOMIC_SEQ_CST)){
+            if (cb->sizebuf - (end - cb_mincursor(cb, nreaders)) >= need){
+                __atomic_store_n(&cb->growing, 0, __ATOMIC_SEQ_CST);
+                st_evsignal(&cb->ev_data);
+                cb_free(mem, sizebuf, cb->mirror, cb->memflags);
+                return false;
+            }
+
+            seq = st_evprepare(&cb->ev_space);
+            if (__atomic_load_n(&cb->cursors[i].busy, __ATOMIC_SEQ_CST)){
+                st_evwait(&cb->ev_space, seq);
+            }
         }
+    }
 
-        /*** First read on contiguous memory ***/
+    /* Move the unread data at its offset in the new ring */
+    pos = cb_mincursor(cb, nreaders);
+    cb->minpos = pos;
+    while (pos < end){
+        size = MIN(end - pos, cb->sizebuf - pos % cb->sizebuf);
+        size = MIN(size, sizebuf - pos % sizebuf);
+        memcpy(&mem[pos % sizebuf], &cb->buf[pos % cb->sizebuf], size);
+        pos += size;
+    }
 
-        /* Check if the rest of the ck reach the end of the cb */
-        if (of_read <= of_ckend){
-            /* Can read all the remaining ck */
-            linear_size = of_ckend - of_read;
-        } else {
-            /* Read first contiguous part of the ck */
-            linear_size = cb->sizebuf - of_read;
-        }
+    cb_free(cb->buf, cb->sizebuf, cb->mirror, cb->memflags);
+    cb->buf = mem;
+    cb->sizebuf = sizebuf;
+    if (sizebuf > cb->peaksize) cb->peaksize = sizebuf;
+    cb->nb_grown++;
 
-        /* Limited by the space available on the buffer */
-        linear_size = MIN(linear_size,nbyte-tr.data_size);
+    /* Let the readers in */
+    __atomic_store_n(&cb->growing, 0, __ATOMIC_SEQ_CST);
+    st_evsignal(&cb->ev_data);
 
+    return true;
+}
 
-        memcpy(&((char*)buf)[tr.data_size], 
-               &cb->buf[of_read], linear_size);
-    
 
-        /* Update size read data and offset unread data */
-        tr.data_size += linear_size;
-        tr.real_size += linear_size;
-        of_read = (of_read + linear_size) % cb->sizebuf;
 
-        if (of_read == 0 && tr.data_size < nbyte){
-            /*** Second read on contiguous memory ***/
 
-            linear_size = MIN(of_ckend,nbyte-tr.data_size);
-            memcpy(&((char*)buf)[tr.data_size], 
-                   &cb->buf[0], linear_size);
-            tr.data_size += linear_size;
-            tr.real_size += linear_size;
-            of_read = (of_read + linear_size) % cb->sizebuf;
+
+/**
+ * @brief Wait for free space in a ring
+ *
+ * The cursors are only scanned when the space known by the 
+ * writer is insufficient. An elastic ring grows instead of waiting 
+ * once the writer waited growwait in total since the last growth.
+ *
+ * @param cb Pointer to a circular buffer
+ * @param nreaders Number of readers
+ * @param need Number of free bytes needed (at most sizebuf)
+ * @return the number of free bytes
+ */
+static size_t cb_ringspace(struct c_buf *cb, unsigned int nreaders, 
+                           size_t need){
+    size_t head = cb->head + cb->pending;
+    unsigned int seq, round = 0;
+    uint64_t start = 0;
+
+    while (cb->sizebuf - (head - cb->minpos) < need){
+
+        /* Look for the slowest reader */
+        cb->minpos = cb_mincursor(cb, nreaders);
+        if (cb->sizebuf - (head - cb->minpos) >= need) break;
+
+        /* The readers may be waiting for the pending data */
+        cb_ringflush(cb);
+
+        /* Elastic ring: grow rather than keep waiting */
+        if (cb->maxsize > cb->sizebuf){
+            if (start == 0) start = st_clock();
+            if (cb->blocked + st_clock() - start >= cb->growwait){
+                cb->blocked = 0;
+                start = st_clock();
+                if (cb_ringgrow(cb, nreaders, need)) continue;
+            }
         }
-  
-        /* If we read all the chunk point to the next one */ 
-        if (of_read == of_ckend){
-            in->of_ck = of_ckend;
-            tr.cks_passed += 1;
+
+        if (st_backoff(&cb->wait, &round)) continue;
+
+        /* 
+         Wait for a quarter of the ring (or what is needed) to be 
+         free: the readers only signal when their cursor goes past
+         spacepos
+        */
+        __atomic_store_n(&cb->spacepos, head - cb->sizebuf + 
+                         MIN(cb->sizebuf, need + cb->sizebuf / 4), 
+                         __ATOMIC_SEQ_CST);
+        seq = st_evprepare(&cb->ev_space);
+        if (cb_mincursor(cb, nreaders) < cb->spacepos){
+            st_evwait(&cb->ev_space, seq);
         }
     }
 
-    in->data_read += tr.real_size;
+    if (start != 0) cb->blocked += st_clock() - start;
 
-    return tr;
+    return cb->sizebuf - (head - cb->minpos);
 }
 
 
-/* Increment cnt chunks from of_startck to of_endck excluded */
+
+
+
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Add data written after the head of a ring, the data
+ *        is published once there are at least minchunk bytes
+ *        pending (see cb_ringflush)
+ * @param cb Pointer to a circular buffer
+ * @param nbyte Number of bytes written
  */
-int isc_incrementcounts(struct inslot_c* isc, size_t of_startck, unsigned int ncks){
+static void cb_ringcommit(struct c_buf *cb, size_t nbyte){
+    cb->pending += nbyte;
+    if (cb->pending >= cb->minchunk) cb_ringflush(cb);
+}
 
-    int freed;
-    ckcount_t cnt;
-    cksize_t  sizeck;
-    struct c_buf *cb;
-    unsigned int i;
 
 
-    freed = 0;
-    cb = isc->src->buf;
 
-    PTH_ERRCK_NC(pthread_mutex_lock(&cb->lock_ckcount))
 
-    for (i = 0; i < ncks; i++){
-        /* Increment count of current chunk */
-        cnt  = cb_getckcount(cb,of_startck) + 1;
-        CB_WRITEUI16(cb,of_startck,&cnt)
+/**
+ * @brief Writes data to a ring
+ *
+ * Copies the data into the ring as space becomes available,
+ * waiting for the slowest reader when the ring is full
+ *
+ * @param cb Pointer to a circular buffer
+ * @param nreaders Number of readers
+ * @param buf A buffer containing the data to write
+ * @param nbyte Number of bytes to write
+ * @return the number of bytes written into the buf
+ */
+static ssize_t cb_ringwrite(struct c_buf *cb, unsigned int nreaders,
+                            const void *buf, size_t nbyte){
+    size_t size, written;
 
-        if (cnt >= isc->src->nreaders) freed++;
-       
-        /* Go to the nex chunk */ 
-        sizeck = cb_getcksize(cb,of_startck);
-        of_startck = (of_startck+SIZE_CKHEAD+sizeck) % cb->sizebuf; 
-    }
+    written = 0;
 
-    PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_ckcount))
+    while (written < nbyte){
+        size = MIN(cb_ringspace(cb, nreaders, 1), nbyte - written);
+        cb_copyin(cb, cb->head + cb->pending, 
+                  (const char*) buf + written, size);
 
-    if (freed > 0){
-        PTH_ERRCK_NC(pthread_cond_broadcast(&cb->cond_free));
+        /* Publish the data */
+        cb_ringcommit(cb, size);
+        written += size;
     }
-    return freed;
+
+    return written;
 }
 
-/* TODO rename */
-/* TODO add conditional blocking */
+
+
+
+
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Reserve contiguous space at the head of a ring
+ *
+ * Waits for nbyte free bytes. The space is published
+ * by cb_ringcommit
+ *
+ * @param cb Pointer to a circular buffer
+ * @param nreaders Number of readers
+ * @param nbyte Number of bytes to reserve
+ * @return a pointer to the reserved space, or NULL if nbyte
+ *         contiguous bytes can't be found in the ring
  */
-size_t isc_getavailable(struct inslot_c *in){
-    struct c_buf *cb = in->src->buf;
-    size_t data_available;
+static void* cb_ringreserve(struct c_buf *cb, unsigned int nreaders, 
+                            size_t nbyte){
+    size_t of = CB_OF(cb, cb->head + cb->pending);
 
-    /* Wait for new data if necessary */
-    PTH_ERRCK_NC(pthread_mutex_lock(&cb->lock_refs))
-        while (in->data_read >= cb->ref_datawritten){
-            PTH_ERRCK(pthread_cond_wait(&cb->cond_acquire, &cb->lock_refs), 
-                      pthread_mutex_unlock(&cb->lock_refs);)
-        }
+    if (nbyte > cb->sizebuf) return NULL;
+    if (!cb->mirror && of + nbyte > cb->sizebuf) return NULL;
 
-        data_available = cb->ref_datawritten - in->data_read;
-    PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_refs))
+    cb_ringspace(cb, nreaders, nbyte);
 
-    return data_available;
+    /* An elastic ring may have grown */
+    of = CB_OF(cb, cb->head + cb->pending);
+    if (!cb->mirror && of + nbyte > cb->sizebuf) return NULL;
+
+    return &cb->buf[of];
 }
 
 
 
 
+
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Wait for data in a ring
+ * @param in Input slot of the reader
+ * @param nbyte Number of unread bytes needed
+ * @return the number of unread bytes, less than nbyte only if
+ *         the writer is done, or -1 if the writer died before 
+ *         writing them (errno is EOWNERDEAD)
  */
-ssize_t st_cbread(struct inslot_c* in, void* buf, size_t nbyte){
+static ssize_t cb_ringdata(struct inslot_c *in, size_t nbyte){
+    struct c_buf *cb = in->src->buf;
+    size_t head;
+    unsigned int seq, round = 0;
+
+    while ((head = __atomic_load_n(&cb->head, __ATOMIC_ACQUIRE)) - 
+            in->data_read < nbyte){
+
+        /* The head published before 'done' is the last one */
+        if (__atomic_load_n(&cb->done, __ATOMIC_SEQ_CST) ||
+            __atomic_load_n(&cb->failed, __ATOMIC_SEQ_CST)){
+            head = __atomic_load_n(&cb->head, __ATOMIC_ACQUIRE);
+            if (head - in->data_read >= nbyte) break;
+            if (__atomic_load_n(&cb->failed, __ATOMIC_SEQ_CST)){
+                errno = EOWNERDEAD;
+                return -1;
+            }
+            break;
+        }
 
-    struct cb_transf tr; /* Transfer infos */
-    ssize_t data_av;     /* Unread data available on the buffer */
+        if (st_backoff(&cb->wait, &round)) continue;
+        seq = st_evprepare(&cb->ev_data);
+        if (__atomic_load_n(&cb->head, __ATOMIC_SEQ_CST) - 
+            in->data_read < nbyte && 
+            !__atomic_load_n(&cb->done, __ATOMIC_SEQ_CST) &&
+            !__atomic_load_n(&cb->failed, __ATOMIC_SEQ_CST)){
+            st_evwait(&cb->ev_data, seq);
+        }
+    }
+
+    return head - in->data_read;
+}
+
+
+
+
+
+/**
+ * @brief Publish the cursor of a reader of a ring: the space
+ *        before in->data_read can be given back to the writer
+ * @param in Input slot of the reader
+ */
+static void cb_ringrelease(struct inslot_c *in){
+    struct c_buf *cb = in->src->buf;
+
+    __atomic_store_n(&cb->cursors[in->cursor].pos, in->data_read, 
+                     __ATOMIC_SEQ_CST);
+    if (in->data_read >= __atomic_load_n(&cb->spacepos, 
+                                         __ATOMIC_SEQ_CST)){
+        st_evsignal(&cb->ev_space);
+    }
+}
+
+
+
+
+
+/**
+ * @brief Enter the memory of an elastic ring: the ring can't grow
+ *        until the reader leaves (see cb_ringleave)
+ *
+ * A reader shall not wait for data while being inside the memory.
+ * Does nothing if the ring is not elastic.
+ *
+ * @param in Input slot of the reader
+ */
+static void cb_ringenter(struct inslot_c *in){
+    struct c_buf *cb = in->src->buf;
+    struct cb_cursor *cur;
+    unsigned int seq;
+
+    if (cb->maxsize == 0) return;
+
+    cur = &cb->cursors[in->cursor];
+    while (1){
+        __atomic_add_fetch(&cur->busy, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&cb->growing, __ATOMIC_SEQ_CST) == 0) return;
+
+        /* Let the writer move the memory */
+        __atomic_sub_fetch(&cur->busy, 1, __ATOMIC_SEQ_CST);
+        st_evsignal(&cb->ev_space);
+
+        seq = st_evprepare(&cb->ev_data);
+        if (__atomic_load_n(&cb->growing, __ATOMIC_SEQ_CST)){
+            st_evwait(&cb->ev_data, seq);
+        }
+    }
+}
+
+
+
+
+
+/**
+ * @brief Leave the memory of an elastic ring (see cb_ringenter)
+ * @param in Input slot of the reader
+ */
+static void cb_ringleave(struct inslot_c *in){
+    struct c_buf *cb = in->src->buf;
+
+    if (cb->maxsize == 0) return;
+
+    __atomic_sub_fetch(&cb->cursors[in->cursor].busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cb->growing, __ATOMIC_SEQ_CST)){
+        st_evsignal(&cb->ev_space);
+    }
+}
+
+
+
+
+
+/**
+ * @brief Writes a message to a ring
+ *
+ * The size and the data are published at once when they 
+ * can be contiguous in the ring
+ *
+ * @param cb Pointer to a circular buffer in message mode
+ * @param nreaders Number of readers
+ * @param buf A buffer containing the message
+ * @param nbyte Size of the message
+ * @return the size of the message or -1 in case of error
+ */
+static ssize_t cb_msgwrite(struct c_buf *cb, unsigned int nreaders,
+                           const void *buf, size_t nbyte){
+    msgsize_t size = nbyte;
+    char *mem;
+
+    if (nbyte > MAX_MSGSIZE){
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    mem = cb_ringreserve(cb, nreaders, SIZE_MSGHEAD + nbyte);
+    if (mem != NULL){
+        memcpy(mem, &size, SIZE_MSGHEAD);
+        memcpy(mem + SIZE_MSGHEAD, buf, nbyte);
+        cb_ringcommit(cb, SIZE_MSGHEAD + nbyte);
+        return nbyte;
+    }
+
+    /* Too large or wrapping: the size goes first */
+    cb_ringwrite(cb, nreaders, &size, SIZE_MSGHEAD);
+    cb_ringwrite(cb, nreaders, buf, nbyte);
+
+    return nbyte;
+}
+
+
+
+
+
+/**
+ * @brief Reads data from a ring
+ *
+ * Waits until nbyte bytes have been read. The reader only
+ * publishes its own cursor: the space is given back to the 
+ * writer once every reader went past it
+ *
+ * @param in Input slot of the reader
+ * @param buf Buffer where to transfer the read data
+ * @param nbyte Number of bytes to read
+ * @return the number of bytes read, less than nbyte only at the
+ *         end of the data, or -1 if the writer died (errno is 
+ *         EOWNERDEAD)
+ */
+static ssize_t cb_ringread(struct inslot_c *in, void *buf, size_t nbyte){
+    ssize_t avail;
+    size_t size, nread;
+
+    nread = 0;
+    while (nread < nbyte){
+        if ((avail = cb_ringdata(in, 1)) == -1) return -1;
+        if (avail == 0) break;    /* End of the data */
+        size = MIN((size_t) avail, nbyte - nread);
+        cb_ringenter(in);
+        cb_copyout(in->src->buf, in->data_read, (char*) buf + nread, size);
+        cb_ringleave(in);
+
+        /* Give the space back */
+        in->data_read += size;
+        nread += size;
+        cb_ringrelease(in);
+    }
+
+    return nread;
+}
+
+
+
+
+
+/**
+ * @brief Read as much data as possible (up to nbyte) from the cache
+ * @param in Input slot 
+ * @param buf Buffer where to write the data
+ * @param nbyte Max size of the read in bytes 
+ * return the number of bytes transferred
+ */
+size_t cb_cacheread(struct inslot_c* in, void* buf, size_t nbyte){
+    size_t size2read, linear_size;
+   
+    /* Size that will be read from the cache */
+    size2read = MIN(in->size_cdata, nbyte);
+    if (size2read == 0) return 0;
+    
+    /* First contiguous read */
+    linear_size = MIN(SIZE_CACHE - in->of_cdata, size2read);
+    memcpy(buf, &in->cache[in->of_cdata], linear_size);
+
+    /* Update cache */
+    in->of_cdata = (in->of_cdata + linear_size) % SIZE_CACHE;
+
+    if (linear_size < size2read){
+        /* Second read on contiguous memory */
+        buf = (char*) buf + linear_size;
+        memcpy(buf, &in->cache[in->of_cdata], size2read-linear_size);
+        in->of_cdata = (in->of_cdata + size2read-linear_size) % SIZE_CACHE;
+    }
+
+    in->size_cdata -= size2read;
+   
+    return size2read;
+}
+
+
+
+/**
+ * @brief 
+ * @param cb Circular buffer where to read from
+ * @param data_av Data available (for read) on the circular buffer
+ * @param in Input slot 
+ * @param buf Buffer where to transfer the read data
+ * @param nbyte Number of bytes to read
+ * @return
+ */
+ /* XXX 
+    1) what about taking data_av out of the parameter and check it
+    directly inside this function ? 
+    2) the return type is quite messy, is there any better way ?
+ */
+struct cb_transf cb_read(struct c_buf *cb, size_t data_av, 
+ struct inslot_c *in, void *buf, size_t nbyte){
+
+/* BIG TODO: naming !!!!! */
+
+    size_t linear_size; /* Size of the next contiguos read */
+    size_t of_ckend;    /* End of the current chunk */
+    size_t of_read;
+    cksize_t cksize;    /* Size of the current chunk */
+    
+    struct cb_transf tr = {0,0,0};
+    of_read = CB_OF(cb, in->data_read);
+
+    while (tr.data_size < nbyte && tr.real_size < data_av){
+
+        /* Calculate end of the current chunk */
+        cksize   = cb_getcksize(cb,in->of_ck);
+        of_ckend = CB_OF(cb, in->of_ck + cksize + SIZE_CKHEAD);
+
+        /* If we are at the beginning of the chunk, consider the header as read */
+        if (of_read == in->of_ck){
+            of_read = CB_OF(cb, in->of_ck + SIZE_CKHEAD);
+            tr.real_size += SIZE_CKHEAD;
+        }
+
+        /*** First read on contiguous memory ***/
+
+        /* Check if the rest of the ck reach the end of the cb */
+        if (cb->mirror){
+            /* The rest of the ck is contiguous */
+            linear_size = CB_OF(cb, of_ckend - of_read);
+        } else if (of_read <= of_ckend){
+            /* Can read all the remaining ck */
+            linear_size = of_ckend - of_read;
+        } else {
+            /* Read first contiguous part of the ck */
+            linear_size = cb->sizebuf - of_read;
+        }
+
+        /* Limited by the space available on the buffer */
+        linear_size = MIN(linear_size,nbyte-tr.data_size);
+
+
+        memcpy(&((char*)buf)[tr.data_size], 
+               &cb->buf[of_read], linear_size);
+    
+
+        /* Update size read data and offset unread data */
+        tr.data_size += linear_size;
+        tr.real_size += linear_size;
+        of_read = CB_OF(cb, of_read + linear_size);
+
+        if (!cb->mirror && of_read == 0 && tr.data_size < nbyte){
+            /*** Second read on contiguous memory ***/
+
+            linear_size = MIN(of_ckend,nbyte-tr.data_size);
+            memcpy(&((char*)buf)[tr.data_size], 
+                   &cb->buf[0], linear_size);
+            tr.data_size += linear_size;
+            tr.real_size += linear_size;
+            of_read = CB_OF(cb, of_read + linear_size);
+        }
+  
+        /* If we read all the chunk point to the next one */ 
+        if (of_read == of_ckend){
+            in->of_ck = of_ckend;
+            tr.cks_passed += 1;
+        }
+    }
+
+    in->data_read += tr.real_size;
+
+    return tr;
+}
+
+
+/* Increment cnt chunks from of_startck to of_endck excluded */
+/**
+ * @brief
+ * @param
+ * @param
+ * @param
+ * @return
+ */
+int isc_incrementcounts(struct inslot_c* isc, size_t of_startck, unsigned int ncks){
+
+    int freed;
+    ckcount_t cnt;
+    cksize_t  sizeck;
+    struct c_buf *cb;
+    unsigned int i;
+    bool waiting;
+
+
+    freed = 0;
+    cb = isc->src->buf;
+
+    PTH_ERRCK_NC(st_lock(&cb->lock_ckcount, &cb->failed))
+
+    for (i = 0; i < ncks; i++){
+        /* Increment count of current chunk */
+        cnt  = cb_getckcount(cb,of_startck) + 1;
+        CB_WRITEFIELD(cb,of_startck,&cnt,sizeof(ckcount_t))
+
+        if (cnt >= isc->src->nreaders) freed++;
+       
+        /* Go to the nex chunk */ 
+        sizeck = cb_getcksize(cb,of_startck);
+        of_startck = CB_OF(cb, of_startck+SIZE_CKHEAD+sizeck);
+    }
+
+    /* For the writer polling (see cb_releasable) */
+    if (freed > 0){
+        __atomic_store_n(&cb->freeseq, cb->freeseq + 1, __ATOMIC_RELEASE);
+    }
+
+    /* Only a writer sleeping needs to be woken up */
+    waiting = cb->wwaiting;
+
+    PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_ckcount))
+
+    if (freed > 0 && waiting){
+        PTH_ERRCK_NC(st_condbroadcast(&cb->cond_free));
+    }
+    return freed;
+}
+
+
+
+
+
+/**
+ * @brief Publish the chunks read but not yet counted by a reader
+ * @param in Input slot
+ * @return 0 in case of success, -1 otherwise
+ */
+int isc_publish(struct inslot_c *in){
+    unsigned int ncks = in->cks_unpub;
+
+    if (ncks == 0) return 0;
+
+    in->cks_unpub = 0;
+    in->size_unpub = 0;
+
+    return isc_incrementcounts(in, in->of_unpub, ncks) == -1 ? -1 : 0;
+}
+
+
+
+
+
+/**
+ * @brief Release what an input slot holds in its buffer, shall be 
+ *        called when the reader terminates
+ * @param in Input slot
+ * @return 0 in case of success, -1 otherwise
+ */
+int cb_finis(struct inslot_c *in){
+    if (in->viewing){
+        cb_ringleave(in);
+        in->viewing = false;
+    }
+
+    return isc_publish(in);
+}
+
+
+
+
+
+/**
+ * @brief Account chunks completely read by a reader
+ *
+ * The chunks are counted (see isc_incrementcounts) in batches: when
+ * the reader holds pubchunks chunks or pubbytes bytes, or at once if
+ * the writer is waiting for space. 
+ *
+ * @param in Input slot
+ * @param of_startck Offset of the first chunk read
+ * @param ncks Number of chunks read, following each other
+ * @param nbyte Size of the chunks read
+ * @return 0 in case of success, -1 otherwise
+ */
+static int isc_consumed(struct inslot_c *in, size_t of_startck, 
+                        unsigned int ncks, size_t nbyte){
+    struct c_buf *cb = in->src->buf;
+
+    if (ncks == 0) return 0;
+
+    if (in->cks_unpub == 0) in->of_unpub = of_startck;
+    in->cks_unpub  += ncks;
+    in->size_unpub += nbyte;
+
+    if (in->cks_unpub >= cb->pubchunks || in->size_unpub >= cb->pubbytes ||
+        __atomic_load_n(&cb->wwaiting, __ATOMIC_SEQ_CST)){
+        return isc_publish(in);
+    }
+
+    return 0;
+}
+
+/* TODO rename */
+/* TODO add conditional blocking */
+/**
+ * @brief
+ * @param
+ * @param
+ * @param
+ * @return
+ */
+ssize_t isc_getavailable(struct inslot_c *in){
+    struct c_buf *cb = in->src->buf;
+    size_t data_available;
+    unsigned int round = 0;
+
+    /* Before waiting, give back the space read (the writer may need it) */
+    if (__atomic_load_n(&cb->ref_datawritten, __ATOMIC_ACQUIRE) <= 
+        in->data_read){
+        if (isc_publish(in) == -1) return -1;
+    }
+
+    /* Poll before sleeping, following the wait policy */
+    while (__atomic_load_n(&cb->ref_datawritten, __ATOMIC_ACQUIRE) <= 
+           in->data_read && st_backoff(&cb->wait, &round));
+
+    /* Wait for new data if necessary */
+    PTH_ERRCK_NC(st_lock(&cb->lock_refs, &cb->failed))
+        while (in->data_read >= cb->ref_datawritten && cb->failed == 0 &&
+               cb->done == 0){
+            PTH_ERRCK(st_condwait(&cb->cond_acquire, &cb->lock_refs,
+                                  &cb->failed), 
+                      pthread_mutex_unlock(&cb->lock_refs);)
+        }
+
+        data_available = cb->ref_datawritten - in->data_read;
+    PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_refs))
+
+    /* The writer died: no more data will come */
+    if (data_available == 0 && cb->failed){
+        errno = EOWNERDEAD;
+        return -1;
+    }
+
+    return data_available;
+}
+
+
+
+
+/**
+ * @brief
+ * @param
+ * @param
+ * @param
+ * @return
+ */
+ssize_t st_cbread(struct inslot_c* in, void* buf, size_t nbyte){
+
+    struct cb_transf tr; /* Transfer infos */
+    ssize_t data_av;     /* Unread data available on the buffer */
     struct c_buf *cb;    /* Shortcut to the circular buffer */
     size_t of_startck;   /* First ck of each read (used for cb_icc) */ 
     size_t size_read;    /* Total size that was read */
     unsigned int cks_passed; /* Chunks completed */
+    size_t size_passed;  /* Total size of the transfers */
+
+    /* Single reader or broadcast: lock-free ring */
+    cb = in->src->buf;
+    if (CB_ISRING(cb, in->src->nreaders)){
+        return cb_ringread(in, buf, nbyte);
+    }
+
+    /* Read from cache */
+    size_read = cb_cacheread(in,buf,nbyte);
+    if (size_read >= nbyte) return size_read; 
+
+    /* Read from buffer */
+    while (1){
+
+        /* Get size of data ready to be read */
+        if ((data_av = isc_getavailable(in)) == -1) return -1;
+        if (data_av == 0) return size_read;    /* End of the data */
+
+        /* Transfer data to user's buffer */
+        of_startck = in->of_ck; 
+        tr = cb_read(cb, data_av, in, 
+             &((char*)buf)[size_read], nbyte-size_read);
+
+        /* Update */
+        data_av -= tr.real_size;
+        size_read += tr.data_size;
+        if (size_read >= nbyte) break;
+
+        /* Mark chunks and signals free chunks */
+        isc_consumed(in, of_startck, tr.cks_passed, tr.real_size);
+    }
+
+    /* 3 - Transfer remaining data to the cache */
+    cks_passed = tr.cks_passed;
+    size_passed = tr.real_size;
+    if (data_av > 0){
+        /* The cache is empty: fill it from the start */
+        in->of_cdata = 0;
+        tr = cb_read(cb, data_av, in, in->cache, SIZE_CACHE);
+        cks_passed += tr.cks_passed;
+        size_passed += tr.real_size;
+        in->size_cdata = tr.data_size;
+    }
+    
+    /* Mark chunks and signals free chunks */
+    isc_consumed(in, of_startck, cks_passed, size_passed);
+
+    return size_read; 
+}
+
+
+/**
+ * @brief Get the readable data of a circular buffer which is 
+ *        contiguous in memory, without waiting
+ *
+ * The view is the unread part of the cache if any, otherwise the
+ * unread part of the current chunk or (for a ring) the unread data
+ * up to the end of the buffer.
+ *
+ * @param in Input slot
+ * @param ptr Where to store the address of the data
+ * @return the size of the view, 0 if there is nothing to read
+ */
+static size_t cb_view(struct inslot_c *in, const void **ptr){
+    struct c_buf *cb = in->src->buf;
+    size_t of_read, of_ckend, size;
+
+    /* Ring: up to the head */
+    if (CB_ISRING(cb, in->src->nreaders)){
+        size = __atomic_load_n(&cb->head, __ATOMIC_ACQUIRE) - in->data_read;
+        of_read = CB_OF(cb, in->data_read);
+        *ptr = &cb->buf[of_read];
+        return cb->mirror ? size : MIN(size, cb->sizebuf - of_read);
+    }
+
+    /* Data left in the cache */
+    if (in->size_cdata > 0){
+        *ptr = &in->cache[in->of_cdata];
+        return MIN(in->size_cdata, SIZE_CACHE - in->of_cdata);
+    }
+
+    /* The chunks are readable once completely written */
+    st_lock(&cb->lock_refs, &cb->failed);
+    size = cb->ref_datawritten - in->data_read;
+    pthread_mutex_unlock(&cb->lock_refs);
+    if (size == 0) return 0;
+
+    /* Rest of the current chunk */
+    of_read  = CB_OF(cb, in->data_read);
+    of_ckend = CB_OF(cb, in->of_ck + SIZE_CKHEAD + cb_getcksize(cb, in->of_ck));
+    if (of_read == in->of_ck) of_read = CB_OF(cb, of_read + SIZE_CKHEAD);
+    size = CB_OF(cb, of_ckend + cb->sizebuf - of_read);
+
+    *ptr = &cb->buf[of_read];
+    return cb->mirror ? size : MIN(size, cb->sizebuf - of_read);
+}
+
+
+
+
+
+/**
+ * @brief Get a view of the next readable data of a circular 
+ *        buffer, waiting for data if necessary
+ * @param in Input slot
+ * @param ptr Where to store the address of the data
+ * @param len Where to store the size of the data, 0 at the end
+ *        of the data
+ * @return 0 in case of success, -1 otherwise
+ */
+int cb_peek(struct inslot_c *in, const void **ptr, size_t *len){
+    struct c_buf *cb = in->src->buf;
+    ssize_t avail;
+
+    /* Ring: stay inside the memory until the view is consumed */
+    if (CB_ISRING(cb, in->src->nreaders)){
+        if (in->viewing == false){
+            cb_ringenter(in);
+            in->viewing = true;
+        }
+        while ((*len = cb_view(in, ptr)) == 0){
+            cb_ringleave(in);
+            avail = cb_ringdata(in, 1);
+            cb_ringenter(in);
+            if (avail <= 0) return avail;    /* End of the data */
+        }
+        return 0;
+    }
+
+    while ((*len = cb_view(in, ptr)) == 0){
+        if ((avail = isc_getavailable(in)) <= 0) return avail;
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Consume data of the view given by cb_peek, the space
+ *        is given back to the writer
+ * @param in Input slot
+ * @param nbyte Number of bytes consumed, at most the size of the view
+ * @return 0 in case of success, -1 otherwise
+ */
+int cb_consume(struct inslot_c *in, size_t nbyte){
+    struct c_buf *cb = in->src->buf;
+    size_t of_ck, of_ckend, size;
+    const void *ptr;
+
+    /* Ring: move the cursor, the view is over */
+    if (CB_ISRING(cb, in->src->nreaders)){
+        if (in->viewing == false) cb_ringenter(in);
+        in->viewing = false;
+        size = cb_view(in, &ptr);
+        cb_ringleave(in);
+
+        if (size < nbyte){
+            errno = EINVAL;
+            return -1;
+        }
+        in->data_read += nbyte;
+        cb_ringrelease(in);
+        return 0;
+    }
+
+    if (nbyte == 0) return 0;
+    if (cb_view(in, &ptr) < nbyte){
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Cache */
+    if (in->size_cdata > 0){
+        in->of_cdata = (in->of_cdata + nbyte) % SIZE_CACHE;
+        in->size_cdata -= nbyte;
+        return 0;
+    }
+
+    /* Chunk: the header is consumed with the first data */
+    of_ck = in->of_ck;
+    if (CB_OF(cb, in->data_read) == of_ck) in->data_read += SIZE_CKHEAD;
+    in->data_read += nbyte;
+
+    /* Mark the chunk once completely read */
+    of_ckend = CB_OF(cb, of_ck + SIZE_CKHEAD + cb_getcksize(cb, of_ck));
+    if (CB_OF(cb, in->data_read) == of_ckend){
+        in->of_ck = of_ckend;
+        if (isc_consumed(in, of_ck, 1, SIZE_CKHEAD + 
+                         cb_getcksize(cb, of_ck)) == -1) return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Wait for the next message of a circular buffer
+ *        in message mode
+ * @param in Input slot
+ * @return the size of the message or -1 if there is none left,
+ *         errno is then ENODATA (EOWNERDEAD if the writer died)
+ */
+ssize_t cb_msgsize(struct inslot_c *in){
+    ssize_t avail;
+    msgsize_t size;
+
+    /* The writer is done: messages are published whole */
+    if ((avail = cb_ringdata(in, SIZE_MSGHEAD)) == -1) return -1;
+    if ((size_t) avail < SIZE_MSGHEAD){
+        errno = ENODATA;
+        return -1;
+    }
+    cb_ringenter(in);
+    cb_copyout(in->src->buf, in->data_read, &size, SIZE_MSGHEAD);
+    cb_ringleave(in);
+
+    return size;
+}
+
+
+
+
+
+/**
+ * @brief Read the next message of a circular buffer in message mode
+ * @param in Input slot
+ * @param buf Buffer where to transfer the message
+ * @param nbyte Size of buf
+ * @return the size of the message or -1 if it doesn't fit 
+ *         into buf (errno is EMSGSIZE and the message is not read)
+ *         or if there is none left (errno is ENODATA)
+ */
+ssize_t cb_readmsg(struct inslot_c *in, void *buf, size_t nbyte){
+    ssize_t size;
+
+    if ((size = cb_msgsize(in)) == -1) return -1;
+    if ((size_t) size > nbyte){
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    in->data_read += SIZE_MSGHEAD;
+    if (size == 0) cb_ringrelease(in);
+    else cb_ringread(in, buf, size);
+
+    return size;
+}
+
+
+
+
+
+/**
+ * @brief Read a batch of messages of a circular buffer in message mode
+ *
+ * Waits for the first message only: the following messages are read
+ * if already written and if they fit in their iovec
+ *
+ * @param in Input slot
+ * @param iov Buffers where to transfer the messages, one per message. 
+ *        The length of each buffer used is set to the size of its message
+ * @param iovcnt Number of buffers
+ * @return the number of messages read or -1 if the first one doesn't
+ *         fit into the first buffer (errno is EMSGSIZE) or if there
+ *         is none left (errno is ENODATA)
+ */
+ssize_t cb_readmsgv(struct inslot_c *in, struct iovec *iov, int iovcnt){
+    struct c_buf *cb = in->src->buf;
+    size_t avail;
+    msgsize_t size;
+    ssize_t read;
+    int i;
+
+    for (i = 0; i < iovcnt; i++){
+
+        /* Stop at the first message not already there */
+        if (i > 0){
+            avail = __atomic_load_n(&cb->head, __ATOMIC_ACQUIRE) - 
+                    in->data_read;
+            if (avail < SIZE_MSGHEAD) break;
+            cb_ringenter(in);
+            cb_copyout(cb, in->data_read, &size, SIZE_MSGHEAD);
+            cb_ringleave(in);
+            if (avail < SIZE_MSGHEAD + size || 
+                size > iov[i].iov_len) break;
+        }
+
+        read = cb_readmsg(in, iov[i].iov_base, iov[i].iov_len);
+        if (read == -1) return -1;
+        iov[i].iov_len = read;
+    }
+
+    return i;
+}
+
+
+
+
+
+/**
+ * @brief Publish the data written into a circular buffer and 
+ *        not published yet (see BOPT_MINCHUNK)
+ * @param cb Circular buffer
+ * @return 0 in case of success, -1 otherwise
+ */
+int cb_flush(struct c_buf *cb){
+    cb_ringflush(cb);
+    return cb_closechunk(cb);
+}
+
+
+
+
+
+/**
+ * @brief Wake up the reader and the writer sleeping on the chunks
+ *        of a circular buffer
+ *
+ * Taking the mutexes recovers them if a process died holding
+ * them (see st_lock): the sleepers then give up.
+ *
+ * @param cb Circular buffer
+ * @return 0 in case of success, -1 otherwise
+ */
+int cb_wake(struct c_buf *cb){
+    PTH_ERRCK_NC(st_lock(&cb->lock_refs, &cb->failed))
+    PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_refs))
+    PTH_ERRCK_NC(st_condbroadcast(&cb->cond_acquire))
+
+    PTH_ERRCK_NC(st_lock(&cb->lock_ckcount, &cb->failed))
+    PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_ckcount))
+    PTH_ERRCK_NC(st_condbroadcast(&cb->cond_free))
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Mark a circular buffer whose writer died: its readers
+ *        get EOWNERDEAD once they read the data left
+ * @param cb Circular buffer
+ * @return 0 in case of success, -1 otherwise
+ */
+int cb_fail(struct c_buf *cb){
+    __atomic_store_n(&cb->failed, 1, __ATOMIC_SEQ_CST);
+    st_evsignal(&cb->ev_data);
+
+    return cb_wake(cb);
+}
+
+
+
+
+
+/**
+ * @brief Update the status of a circular buffer. A rewinded
+ *        (BUF_READY) buffer is emptied: it shall not have 
+ *        any active reader
+ * @param cb Circular buffer
+ * @param status New status
+ * @return 0 in case of success, -1 otherwise
+ */
+int st_bufstatcb(struct c_buf* cb, int status){
+    unsigned int i;
+    char *mem;
+
+    /* The writer is done: publish what is left, the readers 
+       see the end of the data once they read it */
+    if (status == BUF_INACTIVE){
+        if (cb_flush(cb) == -1) return -1;
+        __atomic_store_n(&cb->done, 1, __ATOMIC_SEQ_CST);
+        st_evsignal(&cb->ev_data);
+
+        /* Also recovers a mutex the writer died holding */
+        return cb_wake(cb);
+    }
+    if (status != BUF_READY) return 0;
+    cb->done = 0;
+
+    /* Recover the mutexes of a process which died unnoticed */
+    if (cb->memflags & BM_SHARED){
+        if (cb_wake(cb) == -1) return -1;
+        cb->failed = 0;
+    }
+
+    /* An elastic ring goes back to its initial size */
+    if (cb->shrink && cb->sizebuf != cb->initsize &&
+        (mem = cb_alloc(cb->initsize, cb->mirror, cb->memflags)) != NULL){
+        cb_free(cb->buf, cb->sizebuf, cb->mirror, cb->memflags);
+        cb->buf = mem;
+        cb->sizebuf = cb->initsize;
+    }
+
+    PTH_ERRCK_NC(st_lock(&cb->lock_refs, &cb->failed))
+    cb->ref_datawritten = 0;
+    cb->ref_datatransf  = 0;
+    cb->ckopen = false;
+    cb->ckfill = 0;
+    cb->head = 0;
+    cb->pending = 0;
+    cb->minpos = 0;
+    cb->spacepos = 0;
+    cb->blocked = 0;
+    cb->nb_attached = 0;
+    for (i = 0; i < cb->nb_cursors; i++){
+        cb->cursors[i].pos = 0;
+        cb->cursors[i].busy = 0;
+    }
+    PTH_ERRCK_NC(pthread_mutex_unlock(&cb->lock_refs))
+
+    return 0;
+}
+
+
+/**
+ * @brief Set the options of a circular buffer to their default
+ *        value, except the ones about its memory
+ * @param b Circular buffer
+ */
+static void cb_defaults(struct c_buf *b){
+    b->broadcast = false;
+    b->message = false;
+    b->maxsize = 0;
+    b->shrink = false;
+    b->growwait = CB_DEFGROWWAIT;
+    b->minchunk = 0;
+    b->maxchunk = MAX_CKDATASIZE;
+    b->wait.policy = WAIT_BLOCK;
+    b->wait.spins = WAIT_DEFSPINS;
+    b->pubchunks = CB_DEFPUBCHUNKS;
+    b->pubbytes = b->sizebuf / 16;
+}
+
+
+/**
+ * @brief Initialize the mutexes and conditions of a circular buffer
+ * @param b Circular buffer
+ * @param pshared true if the buffer is shared between processes
+ * @return 0 in case of success, an error number otherwise
+ */
+static int cb_initsync(struct c_buf *b, bool pshared){
+    int err;
+
+    if ((err = st_mutexinit(&b->lock_refs, pshared)) != 0) 
+        return err;
+    if ((err = st_mutexinit(&b->lock_ckcount, pshared)) != 0) 
+        goto error_1;
+    if ((err = st_condinit(&b->cond_free, pshared)) != 0)
+        goto error_2;
+    if ((err = st_condinit(&b->cond_acquire, pshared)) != 0) 
+        goto error_3;
+
+    return 0;
+
+error_3:
+    pthread_cond_destroy(&b->cond_free);
+error_2:
+    pthread_mutex_destroy(&b->lock_ckcount);
+error_1:
+    pthread_mutex_destroy(&b->lock_refs);
+    return err;
+}
+
+
+struct c_buf* cb_make(size_t sizebuf){
+    int err;
+    struct c_buf* b;
+
+    /* The offsets in the buffer are kept on 32 bits */
+    if (sizebuf > UINT_MAX){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((b = malloc(sizeof(struct c_buf))) == NULL) return NULL;
+    if ((b->buf = bm_alloc(sizebuf, 0)) == NULL){
+        free(b); return NULL;
+    }
+
+    if ((err = cb_initsync(b, false)) != 0) goto error_1;
+
+    b->sizebuf = sizebuf;
+    b->ref_datatransf  = 0;
+    b->ref_datawritten = 0;
+    b->mirror = false;
+    b->memflags = 0;
+    b->initsize = sizebuf;
+    b->peaksize = sizebuf;
+    cb_defaults(b);
+    b->blocked = 0;
+    b->nb_grown = 0;
+    b->growing = 0;
+    b->cursors = NULL;
+    b->nb_cursors = 0;
+    b->nb_attached = 0;
+    b->ckopen = false;
+    b->ckfill = 0;
+    b->freeseq = 0;
+    b->wwaiting = false;
+    b->failed = 0;
+    b->done = 0;
+    b->head = 0;
+    b->pending = 0;
+    b->minpos = 0;
+    b->spacepos = 0;
+    memset(&b->ev_data, 0, sizeof(struct st_event));
+    memset(&b->ev_space, 0, sizeof(struct st_event));
+
+    return b;
+
+error_1:
+    bm_free(b->buf, sizebuf, 0);
+    free(b);
+    errno = err;
+    return NULL;
+}
+
+
+/**
+ * @brief Free the cursors of a circular buffer
+ * @param cb Circular buffer
+ */
+static void cb_freecursors(struct c_buf *cb){
+    if (cb->memflags & BM_SHARED){
+        bm_free(cb->cursors, cb->nb_cursors * sizeof(struct cb_cursor),
+                BM_SHARED);
+    } else {
+        free(cb->cursors);
+    }
+}
+
+
+int cb_destroy(struct c_buf* b){
+    cb_free(b->buf, b->sizebuf, b->mirror, b->memflags);
+    cb_freecursors(b);
+
+    PTH_ERRCK_NC(pthread_mutex_destroy(&b->lock_refs))
+    PTH_ERRCK_NC(pthread_mutex_destroy(&b->lock_ckcount))
+    PTH_ERRCK_NC(pthread_cond_destroy(&b->cond_free))
+    PTH_ERRCK_NC(pthread_cond_destroy(&b->cond_acquire))
+
+    if (b->memflags & BM_SHARED) bm_free(b, sizeof(struct c_buf), BM_SHARED);
+    else free(b);
+    
+    return 0;
+}
+
+
+/**
+ * @brief Initialize an input slot reading from a circular buffer
+ * @param is Input slot to initialize
+ * @param b Source buffer
+ */
+void cb_initis(struct inslot_c* is, struct out_buf* b){
+    struct c_buf *cb = b->buf;
+
+    memset(is, 0, sizeof(struct inslot_c));
+    is->src = b;
+
+    /* Take the next free cursor (used only by rings) */
+    if (cb != NULL && cb->nb_cursors > 0){
+        is->cursor = __atomic_fetch_add(&cb->nb_attached, 1, 
+                     __ATOMIC_RELAXED) % cb->nb_cursors;
+    }
+}
+
+
+
+
+
+/**
+ * @brief Reallocate the memory of a circular buffer
+ *
+ * The content of the buffer is lost: shall be called while the 
+ * buffer is not used.
+ *
+ * @param cb Circular buffer
+ * @param mirror true to mirror the memory of the buffer
+ * @param flags Memory options (BMEM_*)
+ * @return 0 in case of success, -1 otherwise, in this case 
+ *         errno is set
+ */
+static int cb_remap(struct c_buf *cb, bool mirror, int flags){
+    size_t sizebuf;
+    char *mem;
+
+    if (cb->mirror == mirror && cb->memflags == flags) return 0;
+
+    sizebuf = mirror ? bm_mirrorsize(cb->sizebuf, flags) : cb->sizebuf;
+    if (sizebuf > UINT_MAX){
+        errno = EINVAL;
+        return -1;
+    }
+    if ((mem = cb_alloc(sizebuf, mirror, flags)) == NULL) return -1;
+
+    cb_free(cb->buf, cb->sizebuf, cb->mirror, cb->memflags);
+
+    cb->buf = mem;
+    cb->sizebuf = sizebuf;
+    cb->initsize = sizebuf;
+    cb->peaksize = sizebuf;
+    cb->mirror = mirror;
+    cb->memflags = flags;
+
+    return st_bufstatcb(cb, BUF_READY);
+}
+
+
+
+
+
+/**
+ * @brief Change the memory of a circular buffer between a plain
+ *        and a mirrored one (see bm_mirror)
+ *
+ * The content of the buffer is lost: shall be called while the 
+ * buffer is not used. A mirrored buffer is enlarged to the next
+ * power of two (at least a page).
+ *
+ * @param cb Circular buffer
+ * @param mirror true to mirror the memory of the buffer
+ * @return 0 in case of success, -1 otherwise, in this case 
+ *         errno is set
+ */
+int cb_setmirror(struct c_buf *cb, bool mirror){
+    return cb_remap(cb, mirror, cb->memflags);
+}
+
+
+
+
+
+/**
+ * @brief Change the memory options of a circular buffer
+ *
+ * The content of the buffer is lost: shall be called while the 
+ * buffer is not used. With BMEM_HUGETLB a mirrored buffer is
+ * enlarged to at least a huge page.
+ *
+ * @param cb Circular buffer
+ * @param flags Memory options (BMEM_*)
+ * @return 0 in case of success, -1 otherwise, in this case 
+ *         errno is set
+ */
+int cb_setmem(struct c_buf *cb, int flags){
+    return cb_remap(cb, cb->mirror, flags | (cb->memflags & BM_SHARED));
+}
+
+
+
+
+
+/**
+ * @brief Move a circular buffer into memory shared with the
+ *        processes forked afterwards (see BOPT_SHARED)
+ *
+ * The structure of the buffer, its memory and the cursors of its
+ * readers are mapped shared, its mutexes and events work across 
+ * processes. The content of the buffer is lost: shall be called 
+ * while the buffer is not used. An elastic buffer can't be shared,
+ * its memory is replaced when it grows.
+ *
+ * @param cb Circular buffer, destroyed in case of success
+ * @return the shared buffer or NULL in case of error, in this 
+ *         case errno is set
+ */
+struct c_buf* cb_share(struct c_buf *cb){
+    struct c_buf *sh;
+    size_t sizecur;
+    int err;
+
+    if (cb->memflags & BM_SHARED) return cb;
+    if (cb->maxsize > 0){
+        errno = EINVAL;
+        return NULL;
+    }
+
+    sh = bm_alloc(sizeof(struct c_buf), BM_SHARED);
+    if (sh == NULL) return NULL;
+    memcpy(sh, cb, sizeof(struct c_buf));
+    sh->memflags |= BM_SHARED;
+
+    sh->buf = cb_alloc(sh->sizebuf, sh->mirror, sh->memflags);
+    if (sh->buf == NULL) goto error_1;
+
+    /* Fresh mappings are zeroed */
+    sizecur = sh->nb_cursors * sizeof(struct cb_cursor);
+    sh->cursors = NULL;
+    if (sizecur > 0 && 
+        (sh->cursors = bm_alloc(sizecur, BM_SHARED)) == NULL) goto error_2;
+
+    if ((err = cb_initsync(sh, true)) != 0){
+        errno = err;
+        goto error_3;
+    }
+    memset(&sh->ev_data, 0, sizeof(struct st_event));
+    memset(&sh->ev_space, 0, sizeof(struct st_event));
+    sh->ev_data.pshared = 1;
+    sh->ev_space.pshared = 1;
+
+    cb_destroy(cb);
+    st_bufstatcb(sh, BUF_READY);
+
+    return sh;
+
+error_3:
+    bm_free(sh->cursors, sizecur, BM_SHARED);
+error_2:
+    cb_free(sh->buf, sh->sizebuf, sh->mirror, sh->memflags);
+error_1:
+    err = errno;
+    bm_free(sh, sizeof(struct c_buf), BM_SHARED);
+    errno = err;
+    return NULL;
+}
+
+
+
+
+
+/**
+ * @brief Allocate the cursors of the readers of a circular buffer
+ *
+ * Shall be called every time the number of readers increases,
+ * while the buffer is not used
+ *
+ * @param cb Circular buffer
+ * @param nreaders Number of readers of the buffer
+ * @return 0 in case of success, -1 otherwise, in this case 
+ *         errno is set
+ */
+int cb_setreaders(struct c_buf *cb, unsigned int nreaders){
+    struct cb_cursor *cursors;
+    int err;
+
+    if (nreaders <= cb->nb_cursors) return 0;
+
+    /* Shared mappings are aligned on a page */
+    if (cb->memflags & BM_SHARED){
+        cursors = bm_alloc(nreaders * sizeof(struct cb_cursor), BM_SHARED);
+        if (cursors == NULL) return -1;
+    } else {
+        err = posix_memalign((void**) &cursors, sizeof(struct cb_cursor),
+                             nreaders * sizeof(struct cb_cursor));
+        if (err != 0){
+            errno = err;
+            return -1;
+        }
+    }
+
+    memset(cursors, 0, nreaders * sizeof(struct cb_cursor));
+    cb_freecursors(cb);
+    cb->cursors = cursors;
+    cb->nb_cursors = nreaders;
+
+    return 0;
+}
+
+
+
+
+/*************************************************************/
+/*                     Linear buffer                         */
+/*************************************************************/
+
+
+/**
+ * @brief Move the writer of a segmented linear buffer to 
+ *        its next segment, allocated if necessary
+ *
+ * The new segment is linked before its data is published:
+ * the readers find it once they see the data.
+ *
+ * @param lb Segmented linear buffer
+ * @return 0 in case of success, -1 otherwise
+ */
+static int lb_nextseg(struct l_buf *lb){
+    struct lb_seg *seg;
+
+    seg = lb->wseg == NULL ? lb->first : lb->wseg->next;
+    if (seg == NULL){
+        seg = bm_alloc(sizeof(struct lb_seg) + lb->sizeseg, lb->memflags);
+        if (seg == NULL) return -1;
+        seg->next = NULL;
+
+        if (lb->wseg == NULL){
+            __atomic_store_n(&lb->first, seg, __ATOMIC_RELEASE);
+        } else {
+            __atomic_store_n(&lb->wseg->next, seg, __ATOMIC_RELEASE);
+        }
+        lb->nb_segs++;
+    }
+
+    if (lb->wseg != NULL) lb->of_wseg += lb->sizeseg;
+    lb->wseg = seg;
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Free the segments of a linear buffer
+ * @param lb Linear buffer not used
+ */
+static void lb_freesegs(struct l_buf *lb){
+    struct lb_seg *seg, *next;
+
+    for (seg = lb->first; seg != NULL; seg = next){
+        next = seg->next;
+        bm_free(seg, sizeof(struct lb_seg) + lb->sizeseg, lb->memflags);
+    }
+
+    lb->first = NULL;
+    lb->wseg = NULL;
+    lb->of_wseg = 0;
+    lb->nb_segs = 0;
+}
+
+
+
+
+
+/**
+ * @brief Get the unread data of a segmented linear buffer 
+ *        which is contiguous in memory
+ * @param lb Segmented linear buffer
+ * @param in Input slot, there shall be some data to read
+ * @param avail Size of the unread data
+ * @param len Where to store the size of the contiguous data
+ * @return the address of the data
+ */
+static char* lb_segdata(struct l_buf *lb, struct inslot_l *in, 
+                        size_t avail, size_t *len){
+    size_t of;
+
+    if (in->seg == NULL){
+        in->seg = __atomic_load_n(&lb->first, __ATOMIC_ACQUIRE);
+        in->of_seg = 0;
+    }
+
+    /* Follow the segments already read */
+    while (in->of_start - in->of_seg >= lb->sizeseg){
+        in->seg = __atomic_load_n(&in->seg->next, __ATOMIC_ACQUIRE);
+        in->of_seg += lb->sizeseg;
+    }
+
+    of = in->of_start - in->of_seg;
+    *len = MIN(avail, lb->sizeseg - of);
+
+    return &in->seg->data[of];
+}
+
+
+
+
+
+/**
+ * @brief Reserve space at the end of the data of a linear buffer
+ * @param lb Linear buffer
+ * @param nbyte Number of bytes to reserve
+ * @param mem Pointer where to store the reserved space, NULL if
+ *        the buffer is too small (or the space would span over
+ *        two segments)
+ * @return 0 in case of success, -1 otherwise
+ */
+static int lb_reserve(struct l_buf *lb, size_t nbyte, void **mem){
+    size_t of;
+
+    *mem = NULL;
+    if (lb->sizeseg > 0){
+        if (lb->wseg == NULL || lb->of_empty - lb->of_wseg == lb->sizeseg){
+            if (lb_nextseg(lb) == -1) return -1;
+        }
+
+        of = lb->of_empty - lb->of_wseg;
+        if (lb->sizeseg - of >= nbyte) *mem = &lb->wseg->data[of];
+        return 0;
+    }
+
+    if (lb->sizebuf - lb->of_empty >= nbyte) *mem = &lb->buf[lb->of_empty];
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Wake up the readers sleeping on a linear buffer, if any
+ *
+ * The state awaited must have been stored before: a reader which 
+ * is about to sleep holds the mutex while checking it, taking the
+ * mutex waits for the reader to be really asleep.
+ *
+ * @param lb Linear buffer
+ * @return 0 in case of success, -1 otherwise
+ */
+static int lb_signal(struct l_buf *lb){
+    if (__atomic_load_n(&lb->waiters, __ATOMIC_SEQ_CST) == 0) return 0;
+
+    PTH_ERRCK_NC(st_lock(&lb->mutex, &lb->failed))
+    PTH_ERRCK_NC(pthread_mutex_unlock(&lb->mutex))
+    PTH_ERRCK_NC(st_condbroadcast(&lb->cond))
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Publish data written at the end of a linear buffer
+ * @param lb Linear buffer
+ * @param nbyte Number of bytes written
+ * @return 0 in case of success, -1 otherwise
+ */
+static int lb_commit(struct l_buf *lb, size_t nbyte){
+
+    size_t size;
+
+    /* The readers load it without the mutex */
+    __atomic_store_n(&lb->of_empty, lb->of_empty + nbyte, __ATOMIC_SEQ_CST);
+    if (lb_signal(lb) == -1) return -1;
+
+    /* Mapped file: write back the data window by window */
+    if (lb->fd != -1){
+        size = (lb->of_empty - lb->of_written) / BM_DROPSIZE * BM_DROPSIZE;
+        if (size > 0){
+            bm_writeback(lb->buf, lb->fd, lb->of_written, size);
+            lb->of_written += size;
+        }
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Writes data to a segmented linear buffer, the
+ *        segments are allocated as needed
+ * @param lb Segmented linear buffer
+ * @param buf A buffer containing the data to write
+ * @param nbyte Number of bytes to write
+ * @return the number of bytes written or -1 in case of 
+ *         error (if nothing could be written)
+ */
+static ssize_t lb_segwrite(struct l_buf *lb, const void* buf, size_t nbyte){
+    size_t of, size, written;
+
+    written = 0;
+    while (written < nbyte){
+        if (lb->wseg == NULL || 
+            lb->of_empty + written - lb->of_wseg == lb->sizeseg){
+            if (lb_nextseg(lb) == -1) break;
+        }
+
+        of = lb->of_empty + written - lb->of_wseg;
+        size = MIN(nbyte - written, lb->sizeseg - of);
+        memcpy(&lb->wseg->data[of], (const char*) buf + written, size);
+        written += size;
+    }
+
+    /* Publish everything at once */
+    if (written == 0 && nbyte > 0) return -1;
+    if (lb_commit(lb, written) == -1) return -1;
+
+    return written;
+}
+
+
+
+
+
+/**
+ * @brief Writes data to a linear buffer
+ * @param lb Linear buffer
+ * @param buf A buffer containing the data to write
+ * @param nbyte Number of bytes to write
+ * @return the number of bytes written, less than nbyte if the 
+ *         buffer is full, or -1 in case of error (errno is ENOSPC
+ *         if the buffer was already full)
+ */
+ssize_t lb_write(struct l_buf *lb, const void* buf, size_t nbyte){
+
+    size_t space_available;
+    size_t write_size;
+
+    if (lb->sizeseg > 0) return lb_segwrite(lb, buf, nbyte);
+
+    /* 
+     Calculate max write capability 
+     Note that the writer has full read-access to 
+     of_size because it's the only potential writer 
+    */
+    space_available = lb->sizebuf-lb->of_empty;
+    write_size = (space_available < nbyte)? 
+                  space_available : nbyte;
+
+    if (write_size == 0){
+        if (nbyte == 0) return 0;
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memcpy(&lb->buf[lb->of_empty], buf, write_size);
+    if (lb_commit(lb, write_size) == -1) return -1;
+    
+    return write_size; 
+}
+
+/**
+ * @brief
+ * @param
+ * @param
+ * @param
+ * @return
+ */
+int st_bufstatlb(struct l_buf* lb, int status){
+
+    /* The content of a file opened read-only never changes */
+    if (lb->sealed) return 0;
+
+    /* A rewinded buffer is empty, the segments are reused */
+    if (status == BUF_READY){
+        /* Recover the mutex of a process which died unnoticed */
+        if (lb->memflags & BM_SHARED){
+            PTH_ERRCK_NC(st_lock(&lb->mutex, &lb->failed))
+            PTH_ERRCK_NC(pthread_mutex_unlock(&lb->mutex))
+            lb->failed = 0;
+        }
+        __atomic_store_n(&lb->of_empty, 0, __ATOMIC_SEQ_CST);
+        lb->wseg = NULL;
+        lb->of_wseg = 0;
+        lb->of_written = 0;
+    }
+
+    /* A retained file holds exactly the data once written */
+    if (lb->retain && status != BUF_READY &&
+        ftruncate(lb->fd, status == BUF_ACTIVE ? lb->sizebuf : 
+                                                 lb->of_empty) == -1){
+        return -1;
+    }
+
+    /* Published after the data: a reader seeing it sees all the data */
+    __atomic_store_n(&lb->status, status, __ATOMIC_SEQ_CST);
+
+    /* Awake every waiting reader  */
+    return lb_signal(lb);
+}
+
+
+
+
+/**
+ * @brief Tell if the data awaited by a reader of a linear buffer
+ *        is there, or will never be
+ * @param lb Linear buffer
+ * @param of_end Offset up to where the data is awaited
+ * @return true if the reader can go on
+ */
+static inline bool lb_ready(struct l_buf *lb, size_t of_end){
+    return __atomic_load_n(&lb->of_empty, __ATOMIC_SEQ_CST) >= of_end ||
+           __atomic_load_n(&lb->status, __ATOMIC_SEQ_CST) == BUF_INACTIVE;
+}
+
+
+
+
+
+/**
+ * @brief Wait until a linear buffer holds some data or its writer 
+ *        terminates
+ *
+ * The buffer is polled first, for as long as its wait policy 
+ * allows. The mutex is only taken to sleep.
+ *
+ * @param lb Linear buffer
+ * @param of_end Offset up to where the data is awaited
+ * @return 0 in case of success, -1 otherwise
+ */
+static int lb_wait(struct l_buf *lb, size_t of_end){
+    unsigned int round = 0;
+
+    while (!lb_ready(lb, of_end) && lb->failed == 0){
+        if (st_backoff(&lb->wait, &round)) continue;
+
+        /* Registered before the last check, see lb_signal */
+        PTH_ERRCK_NC(st_lock(&lb->mutex, &lb->failed))
+        __atomic_add_fetch(&lb->waiters, 1, __ATOMIC_SEQ_CST);
+        while (!lb_ready(lb, of_end) && lb->failed == 0){
+            PTH_ERRCK(st_condwait(&lb->cond, &lb->mutex, &lb->failed),
+                      __atomic_sub_fetch(&lb->waiters, 1, __ATOMIC_SEQ_CST);
+                      pthread_mutex_unlock(&lb->mutex);)
+        }
+        __atomic_sub_fetch(&lb->waiters, 1, __ATOMIC_SEQ_CST);
+        PTH_ERRCK_NC(pthread_mutex_unlock(&lb->mutex))
+    }
+
+    /* A process died holding the mutex, the data may never come */
+    if (!lb_ready(lb, of_end)){
+        errno = EOWNERDEAD;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Drop from the memory the data of a mapped file read 
+ *        by a reader, window by window
+ * @param lb Linear buffer
+ * @param in Input slot reading lb
+ */
+static void lb_drop(struct l_buf *lb, struct inslot_l *in){
+    size_t size;
+
+    if (lb->fd == -1) return;
+
+    size = (in->of_start - in->of_dropped) / BM_DROPSIZE * BM_DROPSIZE;
+    if (size == 0) return;
+
+    bm_dropbehind(lb->buf, lb->fd, in->of_dropped, size);
+    in->of_dropped += size;
+}
+
+
+
+
+
+/**
+ * @brief
+ * @param
+ * @param
+ * @param
+ * @return
+ */
+ssize_t st_readlb(struct inslot_l* in, void* buf, size_t nbyte){
+
+    /* Source buffer */
+    struct l_buf* lb = in->src->buf;
+    size_t max_read, size, read;
+    char *data;
+    
+    /* 
+     Read the minimum between the requested size and
+     the max size of the remaining buffer
+    */
+    if (lb->sizeseg == 0){
+        max_read = lb->sizebuf - in->of_start;
+        nbyte = (nbyte < max_read)? nbyte : max_read;
+    }
+
+    /* Ignore reads of zero bytes */
+    if (nbyte == 0) return 0;
+
+    /* No lock when the data is already there */
+    if (lb_wait(lb, in->of_start + nbyte) == -1) return -1;
+
+    /* The writer is done: read what is left */
+    if (__atomic_load_n(&lb->status, __ATOMIC_ACQUIRE) == BUF_INACTIVE){
+       nbyte = MIN(nbyte, __atomic_load_n(&lb->of_empty, __ATOMIC_ACQUIRE)
+                          - in->of_start);
+    }
+
+    /* Perform read */
+    if (lb->sizeseg == 0){
+        memcpy(buf, &lb->buf[in->of_start], nbyte);
+        in->of_start += nbyte;
+        lb_drop(lb, in);
+        return nbyte;
+    }
+
+    /* Segment by segment */
+    for (read = 0; read < nbyte; read += size){
+        data = lb_segdata(lb, in, nbyte - read, &size);
+        memcpy((char*) buf + read, data, size);
+        in->of_start += size;
+    }
+
+    return nbyte; 
+}
+
+
+
+
+/**
+ * @brief Get a view of the next readable data of a linear 
+ *        buffer, waiting for data if necessary
+ * @param in Input slot
+ * @param ptr Where to store the address of the data
+ * @param len Where to store the size of the data, 0 if the
+ *        writer is done and everything was read
+ * @return 0 in case of success, -1 otherwise
+ */
+int lb_peek(struct inslot_l* in, const void **ptr, size_t *len){
+    struct l_buf* lb = in->src->buf;
+
+    if (lb_wait(lb, in->of_start + 1) == -1) return -1;
+    *len = __atomic_load_n(&lb->of_empty, __ATOMIC_ACQUIRE) - in->of_start;
+
+    if (lb->sizeseg == 0) *ptr = &lb->buf[in->of_start];
+    else if (*len > 0) *ptr = lb_segdata(lb, in, *len, len);
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Consume data of the view given by lb_peek
+ * @param in Input slot
+ * @param nbyte Number of bytes consumed, at most the size of the view
+ * @return 0 in case of success, -1 otherwise
+ */
+int lb_consume(struct inslot_l* in, size_t nbyte){
+    struct l_buf* lb = in->src->buf;
+    size_t available;
+
+    available = __atomic_load_n(&lb->of_empty, __ATOMIC_ACQUIRE) - in->of_start;
+
+    if (available < nbyte){
+        errno = EINVAL;
+        return -1;
+    }
+    in->of_start += nbyte;
+    lb_drop(lb, in);
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Make a linear buffer out of its memory
+ * @param mem Memory of the buffer, kept by the caller in case of error
+ * @param sizebuf Size of the memory
+ * @param fd File mapped at mem, -1 if none
+ * @return a linear buffer or NULL in case of error, in this case
+ *         errno is set
+ */
+static struct l_buf* lb_new(char *mem, size_t sizebuf, int fd){
+    int err;
+    struct l_buf* b;
+
+    b = malloc(sizeof(struct l_buf));
+    if (b == NULL) return NULL;
+
+    b->buf = mem;
+    b->sizebuf = sizebuf;
+    b->memflags = 0;
+    b->of_empty = 0;
+    b->fd = fd;
+    b->retain = false;
+    b->sealed = false;
+    b->of_written = 0;
+    b->sizeseg = 0;
+    b->first = NULL;
+    b->wseg = NULL;
+    b->of_wseg = 0;
+    b->nb_segs = 0;
+    b->status = BUF_READY;
+    b->waiters = 0;
+    b->failed = 0;
+    b->wait.policy = WAIT_BLOCK;
+    b->wait.spins = WAIT_DEFSPINS;
+
+    if ((err = pthread_mutex_init(&b->mutex, NULL)) != 0 ||
+        (err = pthread_cond_init(&b->cond, NULL))   != 0 ){
+        free(b);
+        errno = err;
+        return NULL;
+    }
+
+    return b;
+}
+
+
+/**
+ * @brief Make a linear buffer
+ * @param sizebuf Size of the buffer
+ * @return a linear buffer or NULL in case of error, in this case
+ *         errno is set
+ */
+struct l_buf* lb_make(size_t sizebuf){
+    int err;
+    char *mem;
+    struct l_buf* b;
+
+    if ((mem = bm_alloc(sizebuf, 0)) == NULL) return NULL;
 
-    /* Read from cache */
-    size_read = cb_cacheread(in,buf,nbyte);
-    if (size_read >= nbyte) return size_read; 
+    if ((b = lb_new(mem, sizebuf, -1)) == NULL){
+        err = errno;
+        bm_free(mem, sizebuf, 0);
+        errno = err;
+    }
 
-    /* Read from buffer */
-    cb = in->src->buf;
-    while (1){
+    return b;
+}
 
-        /* Get size of data ready to be read */
-        data_av = isc_getavailable(in);
 
-        /* Transfer data to user's buffer */
-        of_startck = in->of_ck; 
-        tr = cb_read(cb, data_av, in, 
-             &((char*)buf)[size_read], nbyte-size_read);
+/**
+ * @brief Make a linear buffer mapping an anonymous file (MAP_BUF)
+ * @param sizebuf Size of the buffer
+ * @return a linear buffer or NULL in case of error, in this case
+ *         errno is set
+ */
+struct l_buf* lb_makefile(size_t sizebuf){
+    int fd, err;
+    char *mem;
+    struct l_buf* b;
 
-        /* Update */
-        data_av -= tr.real_size;
-        size_read += tr.data_size;
-        if (size_read >= nbyte) break;
+    if ((fd = bm_tmpfile()) == -1) return NULL;
 
-        /* Mark chunks and signals free chunks */
-        isc_incrementcounts(in, of_startck, tr.cks_passed);
-    }
+    if (ftruncate(fd, sizebuf) == -1) goto error_1;
+    if ((mem = bm_mapfile(fd, sizebuf, true)) == NULL) goto error_1;
+    if ((b = lb_new(mem, sizebuf, fd)) == NULL) goto error_2;
 
-    /* 3 - Transfer remaining data to the cache */
-    cks_passed = tr.cks_passed;
-    if (data_av > 0){
-        tr = cb_read(cb, data_av, in, &in->cache[in->of_cdata], SIZE_CACHE);
-        cks_passed += tr.cks_passed;
-        in->size_cdata = tr.data_size;
-        size_read += tr.data_size;
+    return b;
+
+error_2:
+    err = errno;
+    bm_unmapfile(mem, sizebuf);
+    errno = err;
+error_1:
+    err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+}
+
+/**
+ * @brief
+ * @param
+ * @param
+ * @param
+ * @return
+ */
+int lb_destroy(struct l_buf* b){
+    PTH_ERRCK_NC(pthread_mutex_destroy(&b->mutex))
+    PTH_ERRCK_NC(pthread_cond_destroy(&b->cond))
+
+    if (b->fd != -1){
+        bm_unmapfile(b->buf, b->sizebuf);
+        close(b->fd);
+    } else {
+        lb_freesegs(b);
+        if (b->buf != NULL) bm_free(b->buf, b->sizebuf, b->memflags);
     }
-    
-    /* Mark chunks and signals free chunks */
-    isc_incrementcounts(in, of_startck, cks_passed);
 
-    return size_read; 
+    if (b->memflags & BM_SHARED) bm_free(b, sizeof(struct l_buf), BM_SHARED);
+    else free(b);
+    return 0;
 }
 
 
-struct c_buf* cb_make(size_t sizebuf){
+
+
+
+/**
+ * @brief Move a linear buffer into memory shared with the
+ *        processes forked afterwards (see BOPT_SHARED)
+ *
+ * The structure of the buffer and its memory are mapped shared 
+ * (the mapping of a MAP_BUF already is), its mutex and condition
+ * work across processes. The content of the buffer is lost: shall
+ * be called while the buffer is not used. A segmented buffer can't
+ * be shared, its segments are allocated by the writer.
+ *
+ * @param lb Linear buffer, destroyed in case of success
+ * @return the shared buffer or NULL in case of error, in this 
+ *         case errno is set
+ */
+struct l_buf* lb_share(struct l_buf *lb){
+    struct l_buf *sh;
     int err;
-    struct c_buf* b;
 
-    if ((b = malloc(sizeof(struct c_buf))) == NULL) return NULL;
-    if ((b->buf = malloc(sizebuf)) == NULL){
-        free(b); return NULL;
+    if (lb->memflags & BM_SHARED) return lb;
+    if (lb->sizeseg > 0){
+        errno = EINVAL;
+        return NULL;
     }
 
-    if ((err = pthread_mutex_init(&b->lock_refs,NULL)) != 0) 
-        goto error_1;
-    if ((err = pthread_mutex_init(&b->lock_ckcount,NULL)) != 0) 
+    sh = bm_alloc(sizeof(struct l_buf), BM_SHARED);
+    if (sh == NULL) return NULL;
+    memcpy(sh, lb, sizeof(struct l_buf));
+    sh->memflags |= BM_SHARED;
+
+    if (sh->fd == -1 && 
+        (sh->buf = bm_alloc(sh->sizebuf, sh->memflags)) == NULL) goto error_1;
+
+    if ((err = st_mutexinit(&sh->mutex, true)) != 0){
+        errno = err;
         goto error_2;
-    if ((err = pthread_cond_init(&b->cond_free,NULL)) != 0)
-        goto error_3;
-    if ((err = pthread_cond_init(&b->cond_acquire,NULL)) != 0) 
-        goto error_4;
+    }
+    if ((err = st_condinit(&sh->cond, true)) != 0){
+        pthread_mutex_destroy(&sh->mutex);
+        errno = err;
+        goto error_2;
+    }
+    sh->waiters = 0;
 
-    b->sizebuf = sizebuf;
-    b->ref_datatransf  = 0;
-    b->ref_datawritten = 0;
+    /* The mapped file goes with the buffer */
+    if (lb->fd != -1){
+        lb->fd = -1;
+        lb->buf = NULL;
+    }
+    lb_destroy(lb);
+    st_bufstatlb(sh, BUF_READY);
 
-    return b;
+    return sh;
 
-error_4:
-    pthread_cond_destroy(&b->cond_free);
-error_3:
-    pthread_mutex_destroy(&b->lock_ckcount);
 error_2:
-    pthread_mutex_destroy(&b->lock_refs);
+    if (sh->fd == -1) bm_free(sh->buf, sh->sizebuf, sh->memflags);
 error_1:
-    free(b);
+    err = errno;
+    bm_free(sh, sizeof(struct l_buf), BM_SHARED);
     errno = err;
     return NULL;
 }
 
-int cb_destroy(struct c_buf* b){
-    free(b->buf);
 
-    PTH_ERRCK_NC(pthread_mutex_destroy(&b->lock_refs))
-    PTH_ERRCK_NC(pthread_mutex_destroy(&b->lock_ckcount))
-    /* TODO properly destroy cb */
-    
-    return 0;
-}
 
 
-struct inslot_c* cb_makeis(struct out_buf* b){
-    struct inslot_c* is = calloc(1,sizeof(struct inslot_c));
-    if (is == NULL) return NULL;
 
-    is->src = b;
-    is->data_read = 0;
-    return is;
+/**
+ * @brief Make a linear buffer complete for its readers: 
+ *        nothing will be written
+ * @param lb Linear buffer, holding sizebuf bytes of data
+ */
+static void lb_seal(struct l_buf *lb){
+    __atomic_store_n(&lb->of_empty, lb->sizebuf, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&lb->status, BUF_INACTIVE, __ATOMIC_SEQ_CST);
+    lb->sealed = true;
 }
 
 
 
 
-/*************************************************************/
-/*                     Linear buffer                         */
-/*************************************************************/
+
+/**
+ * @brief Map another file as the memory of a MAP_BUF
+ *
+ * The content of the buffer is lost: shall be called while the 
+ * buffer is not used. A file mapped for writing is left as it is,
+ * it is resized to the buffer at the start of every run and to
+ * the data at the end. A file mapped read-only gives its size to
+ * the buffer and is always complete for the readers.
+ *
+ * @param lb Linear buffer mapping a file
+ * @param fd File to map, owned by the buffer in case of success
+ * @param writable true to map the file for writing
+ * @return 0 in case of success, -1 otherwise, in this case 
+ *         errno is set
+ */
+static int lb_setfile(struct l_buf *lb, int fd, bool writable){
+    struct stat st;
+    size_t sizebuf;
+    bool sealed;
+    char *mem;
+    int err;
+
+    sizebuf = lb->sizebuf;
+    if (!writable){
+        if (fstat(fd, &st) == -1) return -1;
+        sizebuf = st.st_size;
+    }
+    if ((mem = bm_mapfile(fd, sizebuf, writable)) == NULL) return -1;
+
+    /* Rewinded first: on failure the buffer keeps its old file */
+    sealed = lb->sealed;
+    lb->sealed = false;
+    if (st_bufstatlb(lb, BUF_READY) == -1){
+        err = errno;
+        if (sealed) lb_seal(lb);
+        bm_unmapfile(mem, sizebuf);
+        errno = err;
+        return -1;
+    }
+
+    bm_unmapfile(lb->buf, lb->sizebuf);
+    close(lb->fd);
+
+    lb->buf = mem;
+    lb->sizebuf = sizebuf;
+    lb->fd = fd;
+    lb->retain = writable;
+    if (!writable) lb_seal(lb);
+
+    return 0;
+}
+
+
+
 
 
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Make a linear buffer segmented or contiguous again
+ *
+ * The content of the buffer is lost: shall be called while the 
+ * buffer is not used.
+ *
+ * @param lb Linear buffer
+ * @param sizeseg Size of the segments, 0 for a contiguous buffer
+ *        of sizebuf bytes
+ * @return 0 in case of success, -1 otherwise, in this case 
+ *         errno is set
  */
-ssize_t lb_write(struct l_buf *lb, const void* buf, size_t nbyte){
+int lb_setsegment(struct l_buf* lb, size_t sizeseg){
+
+    /* The contiguous memory only exists when it is used */
+    if (sizeseg == 0 && lb->buf == NULL){
+        lb->buf = bm_alloc(lb->sizebuf, lb->memflags);
+        if (lb->buf == NULL) return -1;
+    } else if (sizeseg > 0 && lb->buf != NULL){
+        bm_free(lb->buf, lb->sizebuf, lb->memflags);
+        lb->buf = NULL;
+    }
 
-    size_t space_available;
-    size_t write_size;
+    /* Segments of another size are useless */
+    if (sizeseg != lb->sizeseg) lb_freesegs(lb);
 
-    /* 
-     Calculate max write capability 
-     Note that the writer has full read-access to 
-     of_size because it's the only potential writer 
-    */
-    space_available = lb->sizebuf-lb->of_empty;
-    write_size = (space_available < nbyte)? 
-                  space_available : nbyte;
+    lb->sizeseg = sizeseg;
+    return st_bufstatlb(lb, BUF_READY);
+}
 
-    if (write_size == 0) return nbyte;
 
-    memcpy(&lb->buf[lb->of_empty], buf, write_size);
-    
-    /* Update offset */
-    PTH_ERRCK_NC(pthread_mutex_lock(&lb->mutex))
 
-    lb->of_empty += write_size; /* Update */
 
-    PTH_ERRCK_NC(pthread_mutex_unlock(&lb->mutex))
 
-    /* Signal new available data */
-    PTH_ERRCK_NC(pthread_cond_broadcast(&lb->cond))
-    
-    return nbyte; 
+/**
+ * @brief Change the memory options of a linear buffer
+ *
+ * The content of the buffer is lost: shall be called while the 
+ * buffer is not used. The segments are allocated again when 
+ * written.
+ *
+ * @param lb Linear buffer
+ * @param flags Memory options (BMEM_*)
+ * @return 0 in case of success, -1 otherwise, in this case 
+ *         errno is set
+ */
+int lb_setmem(struct l_buf* lb, int flags){
+    char *mem;
+
+    if (lb->memflags == flags) return 0;
+
+    if (lb->buf != NULL){
+        if ((mem = bm_alloc(lb->sizebuf, flags)) == NULL) return -1;
+        bm_free(lb->buf, lb->sizebuf, lb->memflags);
+        lb->buf = mem;
+    }
+
+    lb_freesegs(lb);
+    lb->memflags = flags;
+
+    return st_bufstatlb(lb, BUF_READY);
+}
+
+/**
+ * @brief Initialize an input slot reading from a linear buffer
+ * @param is Input slot to initialize
+ * @param b Source buffer
+ */
+void lb_initis(struct inslot_l* is, struct out_buf* b){
+    is->src = b;
+    is->of_start = 0;
+    is->seg = NULL;
+    is->of_seg = 0;
+    is->of_dropped = 0;
 }
 
+
 /**
  * @brief
  * @param
@@ -662,176 +2807,234 @@ ssize_t lb_write(struct l_buf *lb, const void* buf, size_t nbyte){
  * @param
  * @return
  */
-int st_bufstatlb(struct l_buf* lb, int status){
-    /* Update offset */
-    int err;
-    if ((err = pthread_mutex_lock(&lb->mutex)) != 0) {
-        errno = err;
+ssize_t st_read(node n, unsigned int slot, void* buf, size_t nbyte){
+
+    struct out_buf* ob;
+
+    if (n->nb_inslots <= slot){
+        errno = EINVAL;
         return -1;
     }
 
-    lb->status = status; /* Update */
+    if (n->inslots[slot] == NULL ) return 0;
 
-    PTH_ERRCK_NC(pthread_mutex_unlock(&lb->mutex))
+    /* Get out buffer */
+    ob = ((struct inslot*) n->inslots[slot])->src;
+    if (ob == NULL) return 0;
 
-    /* Awake every waiting reader  */
-    PTH_ERRCK_NC(pthread_cond_broadcast(&lb->cond)) 
-    
-    return 0; 
+    switch (ob->type){
+        case LIN_BUF:
+        case MAP_BUF: 
+            return st_readlb(n->inslots[slot], buf, nbyte);
+        case CIR_BUF: 
+            return st_cbread(n->inslots[slot], buf, nbyte);
+        default: 
+            errno = EINVAL;
+            return -1;
+    }
 }
 
 
 
 
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Get a read-only view of the next readable data of
+ *        an input slot, directly inside the source buffer
+ *
+ * Waits for data like st_read. The view is the next contiguous
+ * data: the rest of the current chunk of a circular buffer or
+ * everything written and unread otherwise. It stays valid until
+ * consumed by st_readconsume, which shall follow every peek.
+ *
+ * @param n a running node
+ * @param slot index of the input slot
+ * @param ptr where to store the address of the data
+ * @param len where to store the size of the data, 0 if there is
+ *        nothing more to read
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
  */
-ssize_t st_readlb(struct inslot_l* in, void* buf, size_t nbyte){
-
-    /* Source buffer */
-    struct l_buf* lb = in->src->buf;
-    
-    /* 
-     Read the minimum between the requested size and
-     the max size of the remaining buffer
-    */
-    size_t max_read = lb->sizebuf - in->of_start;
-    nbyte = (nbyte < max_read)? nbyte : max_read;
+int st_readpeek(node n, unsigned int slot, const void **ptr, size_t *len){
+    struct out_buf* ob;
 
-    /* Ignore reads of zero bytes */
-    if (nbyte == 0) return 0;
+    if (n->nb_inslots <= slot){
+        errno = EINVAL;
+        return -1;
+    }
 
-    /* Lock access */
-    PTH_ERRCK_NC(pthread_mutex_lock(&lb->mutex))
-    
-    /* Wait condition */
-    while (lb->of_empty - in->of_start < nbyte &&
-           lb->status != BUF_INACTIVE          ){
+    *ptr = NULL;
+    *len = 0;
+    if (n->inslots[slot] == NULL) return 0;
 
+    /* Get out buffer */
+    ob = ((struct inslot*) n->inslots[slot])->src;
+    if (ob == NULL || ob->buf == NULL) return 0;
 
-        PTH_ERRCK(pthread_cond_wait(&lb->cond, &lb->mutex),
-                  pthread_mutex_unlock(&lb->mutex);
-                  perror("Error:");)
+    switch (ob->type){
+        case LIN_BUF:
+        case MAP_BUF: 
+            return lb_peek(n->inslots[slot], ptr, len);
+        case CIR_BUF: 
+            return cb_peek(n->inslots[slot], ptr, len);
+        default: 
+            errno = EINVAL;
+            return -1;
     }
+}
+
+
+
+
 
-    if (lb->status == BUF_INACTIVE){
-       nbyte = lb->of_empty - in->of_start;
+/**
+ * @brief Consume the first nbyte bytes of the view given
+ *        by st_readpeek, the space is given back to the writer
+ * @param n a running node
+ * @param slot index of the input slot
+ * @param nbyte number of bytes consumed, at most the size of the view
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+int st_readconsume(node n, unsigned int slot, size_t nbyte){
+    struct out_buf* ob;
+
+    if (n->nb_inslots <= slot){
+        errno = EINVAL;
+        return -1;
     }
 
-    /* Unlock access */
-    PTH_ERRCK_NC(pthread_mutex_unlock(&lb->mutex))
+    if (n->inslots[slot] == NULL) return 0;
 
-    /* Perform read */
-    memcpy(buf, &lb->buf[in->of_start], nbyte);
-    in->of_start += nbyte;
+    /* Get out buffer */
+    ob = ((struct inslot*) n->inslots[slot])->src;
+    if (ob == NULL || ob->buf == NULL) return 0;
 
-    return nbyte; 
+    switch (ob->type){
+        case LIN_BUF:
+        case MAP_BUF: 
+            return lb_consume(n->inslots[slot], nbyte);
+        case CIR_BUF: 
+            return cb_consume(n->inslots[slot], nbyte);
+        default: 
+            errno = EINVAL;
+            return -1;
+    }
 }
 
 
+
+
+
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Get the circular buffer in message mode read by an input slot
+ * @param n a running node
+ * @param slot index of the input slot
+ * @param in where to store the input slot (NULL if there is no source)
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
  */
-struct l_buf* lb_make(size_t sizebuf){
-    int err;
-    struct l_buf* b;
-
-    b = malloc(sizeof(struct l_buf));
-    if (b == NULL) return NULL;
+static int st_msgslot(node n, unsigned int slot, struct inslot_c **in){
+    struct out_buf* ob;
 
-    b->buf = malloc(sizebuf);
-    if (b->buf == NULL) {
-        free(b);
-        return NULL;
+    if (n->nb_inslots <= slot){
+        errno = EINVAL;
+        return -1;
     }
 
-    b->sizebuf = sizebuf;
-    b->of_empty = 0;
-    b->status = BUF_READY;
-
-    if ((err = pthread_mutex_init(&b->mutex, NULL)) != 0 ||
-        (err = pthread_cond_init(&b->cond, NULL))   != 0 ){
-        free(b->buf);
-        free(b);
-        errno = err;
-        return NULL;
+    *in = NULL;
+    if (n->inslots[slot] == NULL) return 0;
+
+    /* Get out buffer */
+    ob = ((struct inslot*) n->inslots[slot])->src;
+    if (ob == NULL || ob->buf == NULL) return 0;
+
+    if (ob->type != CIR_BUF || ((struct c_buf*) ob->buf)->message == false){
+        errno = EINVAL;
+        return -1;
     }
 
-    return b;
+    *in = n->inslots[slot];
+    return 0;
 }
 
+
+
+
+
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Read the next message of an input slot
+ *
+ * The source shall be a circular buffer in message mode (see
+ * BOPT_MESSAGE): each st_write of the writer is a message.
+ *
+ * @param n a running node
+ * @param slot index of the input slot
+ * @param buf buffer where to transfer the message
+ * @param nbyte size of buf
+ * @return the size of the message or -1 in case of error, in this
+ *         case errno is set. If the message doesn't fit into buf 
+ *         errno is EMSGSIZE and the message is left unread (see 
+ *         st_msgsize). Once the writer is done and every message
+ *         was read, errno is ENODATA
  */
-int lb_destroy(struct l_buf* b){
-    PTH_ERRCK_NC(pthread_mutex_destroy(&b->mutex))
-    PTH_ERRCK_NC(pthread_cond_destroy(&b->cond))
+ssize_t st_readmsg(node n, unsigned int slot, void *buf, size_t nbyte){
+    struct inslot_c *in;
 
-    free(b->buf);
-    free(b);
-    return 0;
+    if (st_msgslot(n, slot, &in) == -1) return -1;
+    if (in == NULL) return 0;
+
+    return cb_readmsg(in, buf, nbyte);
 }
 
+
+
+
+
 /**
- * @brief
- * @param
- * @param
- * @param
- * @return
+ * @brief Read a batch of messages of an input slot
+ *
+ * Like st_readmsg, one message per buffer. Waits for the first message
+ * only, the following ones are read if they are already available.
+ * The length of each buffer filled is set to the size of its message.
+ *
+ * @param n a running node
+ * @param slot index of the input slot
+ * @param iov buffers where to transfer the messages
+ * @param iovcnt number of buffers
+ * @return the number of messages read or -1 in case of error, in 
+ *         this case errno is set (EMSGSIZE if the first message 
+ *         doesn't fit into the first buffer, ENODATA if the writer
+ *         is done and every message was read)
  */
-struct inslot_l* lb_makeis(struct out_buf* b){
-    struct inslot_l* is = malloc(sizeof(struct inslot_l));
-    if (is == NULL) return NULL;
+ssize_t st_readmsgv(node n, unsigned int slot, struct iovec *iov, int iovcnt){
+    struct inslot_c *in;
 
-    is->src = b;
-    is->of_start = 0;
-    return is;
+    if (st_msgslot(n, slot, &in) == -1) return -1;
+    if (in == NULL) return 0;
+
+    return cb_readmsgv(in, iov, iovcnt);
 }
 
 
-/**
- * @brief
- * @param
- * @param
- * @param
- * @return
- */
-ssize_t st_read(node n, unsigned int slot, void* buf, size_t nbyte){
 
-    struct out_buf* ob;
 
-    if (n->nb_inslots <= slot){
-        errno = EINVAL;
-        return -1;
-    }
 
-    if (n->inslots[slot] == NULL ) return 0;
+/**
+ * @brief Get the size of the next message of an input slot, 
+ *        waiting for it if necessary
+ * @param n a running node
+ * @param slot index of the input slot
+ * @return the size of the message or -1 in case of error, in
+ *         this case errno is set (ENODATA if the writer is done 
+ *         and every message was read)
+ */
+ssize_t st_msgsize(node n, unsigned int slot){
+    struct inslot_c *in;
 
-    /* Get out buffer */
-    ob = ((struct inslot*) n->inslots[slot])->src;
-    if (ob == NULL) return 0;
+    if (st_msgslot(n, slot, &in) == -1) return -1;
+    if (in == NULL) return 0;
 
-    switch (ob->type){
-        case LIN_BUF: 
-            return st_readlb(n->inslots[slot], buf, nbyte);
-        case CIR_BUF: 
-            return st_cbread(n->inslots[slot], buf, nbyte);
-        default: 
-            errno = EINVAL;
-            return -1;
-    }
+    return cb_msgsize(in);
 }
 
 /**
@@ -862,9 +3065,19 @@ ssize_t st_write(node n, unsigned int slot,
 
     
     switch (n->outslots[slot].type){
-        case LIN_BUF: 
+        case LIN_BUF:
+        case MAP_BUF: 
             return lb_write(ob->buf, buf, nbyte);
         case CIR_BUF: 
+            /* Messages: framed on a ring */
+            if (((struct c_buf*) ob->buf)->message){
+                return cb_msgwrite(ob->buf, ob->nreaders, buf, nbyte);
+            }
+
+            /* Single reader or broadcast: lock-free ring */
+            if (CB_ISRING((struct c_buf*) ob->buf, ob->nreaders)){
+                return cb_ringwrite(ob->buf, ob->nreaders, buf, nbyte);
+            }
             return cb_write(ob->buf, ob->nreaders, buf, nbyte);
         default: 
             errno = EINVAL;
@@ -873,6 +3086,142 @@ ssize_t st_write(node n, unsigned int slot,
 }
 
 
+/**
+ * @brief Reserve space into an output buffer
+ *
+ * Returns a pointer where the node can build up to size bytes of
+ * data, which are published by st_writecommit. When possible the
+ * pointer goes directly into the buffer, otherwise (e.g. the space
+ * would wrap around a circular buffer which is not mirrored) into a
+ * staging area copied by st_writecommit. Like st_write, the call can
+ * block waiting for free space, and fails if the buffer does (e.g.
+ * no memory for a new segment, or a reader died). There can be a 
+ * single reservation per slot at a time.
+ *
+ * @param n a running node
+ * @param slot index of the output buffer
+ * @param size number of bytes to reserve
+ * @return a pointer to size writable bytes or NULL in case of 
+ *         error, in this case errno is set
+ */
+void* st_writereserve(node n, unsigned int slot, size_t size){
+    struct out_buf *ob; /* Target output buffer */
+    struct c_buf *cb;
+    void *mem, *stage;
+
+    if (n->nb_outslots <= slot) {
+        errno = EINVAL;
+        return NULL;
+    }
+    ob = &n->outslots[slot];
+
+    /* A failed reservation leaves nothing to commit */
+    ob->reserving = false;
+    ob->reserved = 0;
+    ob->staged = false;
+
+    mem = NULL;
+    if (ob->buf != NULL){
+        switch (ob->type){
+            case LIN_BUF:
+            case MAP_BUF: 
+                if (lb_reserve(ob->buf, size, &mem) == -1) return NULL;
+                break;
+            case CIR_BUF: 
+                cb = ob->buf;
+                if (cb->message){
+                    /* Room for the size of the message */
+                    mem = cb_ringreserve(cb, ob->nreaders, 
+                                         SIZE_MSGHEAD + size);
+                    if (mem != NULL) mem = (char*) mem + SIZE_MSGHEAD;
+                } else if (CB_ISRING(cb, ob->nreaders)){
+                    mem = cb_ringreserve(cb, ob->nreaders, size);
+                } else if (cb_reserve(cb, ob->nreaders, size, &mem) == -1){
+                    return NULL;
+                }
+                break;
+            default: 
+                errno = EINVAL;
+                return NULL;
+        }
+    }
+
+    /* Stage the data if it can't go directly into the buffer */
+    if (mem == NULL && (ob->stage == NULL || ob->sizestage < size)){
+        stage = realloc(ob->stage, size > 0 ? size : 1);
+        if (stage == NULL) return NULL;
+        ob->stage = stage;
+        ob->sizestage = size;
+    }
+
+    ob->reserved = size;
+    ob->staged = (mem == NULL);
+    ob->reserving = true;
+
+    return ob->staged ? ob->stage : mem;
+}
+
+
+
+
+
+/**
+ * @brief Publish the data written into the space reserved
+ *        by st_writereserve, readers are notified
+ * @param n a running node
+ * @param slot index of the output buffer
+ * @param used number of bytes written, at most the size reserved
+ * @return the number of bytes written into the buffer (as st_write)
+ *         or -1 in case of error, in this case errno is set (EINVAL
+ *         if nothing is reserved)
+ */
+ssize_t st_writecommit(node n, unsigned int slot, size_t used){
+    struct out_buf *ob; /* Target output buffer */
+    struct c_buf *cb;
+    msgsize_t size;
+    bool staged;
+
+    if (n->nb_outslots <= slot || !n->outslots[slot].reserving ||
+        n->outslots[slot].reserved < used) {
+        errno = EINVAL;
+        return -1;
+    }
+    ob = &n->outslots[slot];
+    staged = ob->staged;
+    ob->reserving = false;
+    ob->reserved = 0;
+    ob->staged = false;
+
+    if (staged) return st_write(n, slot, ob->stage, used);
+
+    switch (ob->type){
+        case LIN_BUF:
+        case MAP_BUF: 
+            if (lb_commit(ob->buf, used) == -1) return -1;
+            return used;
+        case CIR_BUF: 
+            cb = ob->buf;
+            if (cb->message){
+                size = used;
+                memcpy(&cb->buf[CB_OF(cb, cb->head + cb->pending)], 
+                       &size, SIZE_MSGHEAD);
+                cb_ringcommit(cb, SIZE_MSGHEAD + used);
+            } else if (CB_ISRING(cb, ob->nreaders)){
+                cb_ringcommit(cb, used);
+            } else if (cb_commit(cb, used) == -1){
+                return -1;
+            }
+            return used;
+        default: 
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+
+
+
+
 /**
  * @brief
  * @param
@@ -888,11 +3237,48 @@ int st_bufstat(node n, unsigned int slot, int status){
         return -1;
     }
 
+    /* A reservation never outlives a run */
+    n->outslots[slot].reserving = false;
+
     switch (n->outslots[slot].type){
-        case LIN_BUF: 
+        case LIN_BUF:
+        case MAP_BUF: 
             return st_bufstatlb(n->outslots[slot].buf, status);
         case CIR_BUF: 
-            return 0; 
+            return st_bufstatcb(n->outslots[slot].buf, status);
+        default: 
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+
+
+
+
+/**
+ * @brief Publish to the readers the data written into an output
+ *        buffer and not published yet (see BOPT_MINCHUNK)
+ * @param n a running node
+ * @param slot index of the output buffer
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+int st_flush(node n, unsigned int slot){
+
+    if (n->nb_outslots <= slot){
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (n->outslots[slot].buf == NULL) return 0;
+
+    switch (n->outslots[slot].type){
+        case LIN_BUF:
+        case MAP_BUF: 
+            return 0;
+        case CIR_BUF: 
+            return cb_flush(n->outslots[slot].buf);
         default: 
             errno = EINVAL;
             return -1;
@@ -911,6 +3297,7 @@ void* st_makeb(unsigned char buftype, size_t bufsize){
     switch (buftype){
         case CIR_BUF: return cb_make(bufsize);
         case LIN_BUF: return lb_make(bufsize);
+        case MAP_BUF: return lb_makefile(bufsize);
         default: errno = EINVAL;
                  return NULL;
     }
@@ -926,9 +3313,425 @@ void* st_makeb(unsigned char buftype, size_t bufsize){
  */
 int st_destroyb(struct out_buf *buf){
     switch (buf->type){
-        case LIN_BUF: return lb_destroy(buf->buf);
+        case LIN_BUF:
+        case MAP_BUF: return lb_destroy(buf->buf);
         case CIR_BUF: return cb_destroy(buf->buf);
         default: errno = EINVAL;
                  return -1;  
     }
 }
+
+
+
+
+
+/**
+ * @brief Keep the memory of an output buffer for a new buffer
+ *        of the same type and size
+ *
+ * The buffer is rewinded and its options are set back to their 
+ * default value, except the ones about its memory (BOPT_MIRROR, 
+ * BOPT_MEMORY) which are kept with the memory. Segmented and
+ * enlarged buffers are not reused.
+ *
+ * @param buf an output buffer
+ * @param buftype type of the new buffer
+ * @param bufsize size of the new buffer
+ * @return 1 if the buffer is reused, 0 if it shall be replaced or
+ *         -1 in case of error, in this case errno is set
+ */
+int st_reuseb(struct out_buf *buf, unsigned char buftype, size_t bufsize){
+    struct c_buf *cb;
+    struct l_buf *lb;
+    size_t sizebuf;
+
+    if (buf->buf == NULL || buf->type != buftype) return 0;
+
+    switch (buftype){
+        case LIN_BUF:
+            lb = buf->buf;
+            if (lb->sizeseg > 0 || lb->sizebuf != bufsize) return 0;
+            lb->wait.policy = WAIT_BLOCK;
+            lb->wait.spins = WAIT_DEFSPINS;
+            if (st_bufstatlb(lb, BUF_READY) == -1) return -1;
+            return 1;
+        case CIR_BUF:
+            cb = buf->buf;
+            sizebuf = cb->mirror ? 
+                      bm_mirrorsize(bufsize, cb->memflags) : bufsize;
+            if (cb->sizebuf != sizebuf || cb->initsize != sizebuf) return 0;
+            cb_defaults(cb);
+            if (st_bufstatcb(cb, BUF_READY) == -1) return -1;
+            return 1;
+        default: 
+            return 0;
+    }
+}
+
+
+
+
+/**
+ * @brief Prefer a NUMA node for the memory of a buffer
+ * @param buf an output buffer
+ * @param numa id of the NUMA node
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+int st_bufplace(struct out_buf *buf, int numa){
+    switch (buf->type){
+        case MAP_BUF:
+            /* The page cache is shared by the file */
+            return 0;
+        case LIN_BUF:
+            /* Segments are placed by the first touch of the writer */
+            if (((struct l_buf*) buf->buf)->buf == NULL) return 0;
+            return bm_place(((struct l_buf*) buf->buf)->buf,
+                            ((struct l_buf*) buf->buf)->sizebuf, numa);
+        case CIR_BUF: 
+            return bm_place(((struct c_buf*) buf->buf)->buf,
+                            ((struct c_buf*) buf->buf)->sizebuf, numa);
+        default: errno = EINVAL;
+                 return -1;  
+    }
+}
+
+
+
+
+/**
+ * @brief Prepare a buffer for its actual number of readers
+ * @param buf an output buffer
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+int st_bufreaders(struct out_buf *buf){
+    if (buf->buf == NULL) return 0;
+
+    switch (buf->type){
+        case LIN_BUF:
+        case MAP_BUF: return 0;
+        case CIR_BUF: return cb_setreaders(buf->buf, buf->nreaders);
+        default: errno = EINVAL;
+                 return -1;  
+    }
+}
+
+
+
+
+
+/**
+ * @brief Tell if a buffer can be used by a forked process
+ * @param buf an output buffer
+ * @return true if the buffer is shared (see BOPT_SHARED) or 
+ *         if there is no buffer
+ */
+bool st_bufshared(struct out_buf *buf){
+    if (buf->buf == NULL) return true;
+
+    switch (buf->type){
+        case LIN_BUF:
+        case MAP_BUF: 
+            return (((struct l_buf*) buf->buf)->memflags & BM_SHARED) != 0;
+        case CIR_BUF: 
+            return (((struct c_buf*) buf->buf)->memflags & BM_SHARED) != 0;
+        default: 
+            return false;  
+    }
+}
+
+
+
+
+/**
+ * @brief Set an option of an output buffer
+ *
+ * The options shall be set while the node is not running, 
+ * they are lost when the buffer is replaced (see st_setbuffer).
+ * Available options:
+ * - BOPT_BROADCAST (CIR_BUF): if value is not 0 the readers 
+ *   share a ring where each one advances its own cursor, instead
+ *   of counting the reads of each chunk. Best with many readers.
+ * - BOPT_MIRROR (CIR_BUF): if value is not 0 the memory of the buffer
+ *   is mapped twice back-to-back so that no chunk wraps. The size of
+ *   the buffer is rounded up to a power of two (at least a page).
+ * - BOPT_MESSAGE (CIR_BUF): if value is not 0 every write is a message,
+ *   the readers shall use st_readmsg/st_readmsgv. The readers share a
+ *   ring like with BOPT_BROADCAST.
+ * - BOPT_MINCHUNK (CIR_BUF): the writes are coalesced and published to
+ *   the readers once value bytes are pending, when the writer has to 
+ *   wait for space, at the end of the writer or at st_flush. Default 0:
+ *   every write is published.
+ * - BOPT_MAXCHUNK (CIR_BUF): max size of the data of a chunk, up to
+ *   MAX_CKDATASIZE (the default).
+ * - BOPT_PUBCHUNKS, BOPT_PUBBYTES (CIR_BUF): the readers of chunks give
+ *   back the space read to the writer by batches of value chunks or 
+ *   value bytes (whichever comes first), and at once when the writer 
+ *   waits for space. Default CB_DEFPUBCHUNKS chunks and a sixteenth of
+ *   the buffer, 1 publishes every chunk.
+ * - BOPT_ELASTIC (CIR_BUF): the buffer is a ring which grows, up to 
+ *   value bytes, when its writer waited for space BOPT_GROWWAIT 
+ *   microseconds (default 1000) in total since the last growth. 
+ *   The ring doubles at every growth, a mirrored one only while it 
+ *   stays below value. value is at least the size of the buffer and
+ *   at most UINT_MAX. 0 (default) disables the growth. 
+ * - BOPT_SHRINK (CIR_BUF): an elastic ring goes back to its initial size
+ *   when rewinded (st_bufsize gives the size it reached).
+ * - BOPT_SEGMENT (LIN_BUF): the buffer is a list of segments of value
+ *   bytes allocated as the data is written, without limit of size. 
+ *   0 (default) gives back a contiguous buffer of the size given to 
+ *   st_setbuffer, whose writes are short once full.
+ * - BOPT_WAIT: how the readers wait for data and the writer (CIR_BUF)
+ *   for space. WAIT_BLOCK (default) sleeps at once, WAIT_SPIN polls the
+ *   buffer before sleeping, WAIT_SPINYIELD polls then yields the CPU 
+ *   before sleeping and WAIT_POLL never sleeps. Polling lowers the
+ *   latency of the buffer at the cost of the CPU time of its nodes.
+ * - BOPT_SPINS: number of rounds of polling of BOPT_WAIT, default 
+ *   WAIT_DEFSPINS.
+ * - BOPT_SHARED: if value is not 0 the buffer is moved to memory 
+ *   shared with the processes forked afterwards: the nodes run in
+ *   their own process (PROC_EXEC) use it without copy. The content
+ *   of the buffer is lost, a shared buffer stays shared. Elastic
+ *   and segmented buffers can't be shared.
+ * - BOPT_MEMORY: memory options of the buffer, a combination of
+ *   BMEM_HUGE (transparent huge pages), BMEM_HUGETLB (huge pages 
+ *   reserved by the system, transparent ones if none is left), 
+ *   BMEM_PREFAULT (pages committed at once instead of at their 
+ *   first write) and BMEM_LOCK (pages locked in memory, bounded by
+ *   RLIMIT_MEMLOCK). The content of the buffer is lost. Default 0.
+ *
+ * @param n a node
+ * @param slot index of the output buffer
+ * @param opt option to set
+ * @param value new value of the option
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+int st_bufopt(node n, unsigned int slot, int opt, size_t value){
+    struct out_buf *ob;
+    void *buf;
+
+    if (n->nb_outslots <= slot || n->outslots[slot].buf == NULL){
+        errno = ENOENT;
+        return -1;
+    }
+    ob = &n->outslots[slot];
+
+    switch (opt){
+        case BOPT_BROADCAST:
+            if (ob->type != CIR_BUF) break;
+            ((struct c_buf*) ob->buf)->broadcast = value != 0;
+            return 0;
+        case BOPT_MIRROR:
+            if (ob->type != CIR_BUF) break;
+            return cb_setmirror(ob->buf, value != 0);
+        case BOPT_MESSAGE:
+            if (ob->type != CIR_BUF) break;
+            ((struct c_buf*) ob->buf)->message = value != 0;
+            return 0;
+        case BOPT_MINCHUNK:
+            if (ob->type != CIR_BUF) break;
+            ((struct c_buf*) ob->buf)->minchunk = value;
+            return 0;
+        case BOPT_MAXCHUNK:
+            if (ob->type != CIR_BUF || value == 0 || 
+                value > MAX_CKDATASIZE) break;
+            ((struct c_buf*) ob->buf)->maxchunk = value;
+            return 0;
+        case BOPT_PUBCHUNKS:
+            if (ob->type != CIR_BUF || value > UINT_MAX) break;
+            ((struct c_buf*) ob->buf)->pubchunks = value;
+            return 0;
+        case BOPT_PUBBYTES:
+            if (ob->type != CIR_BUF) break;
+            ((struct c_buf*) ob->buf)->pubbytes = value;
+            return 0;
+        case BOPT_ELASTIC:
+            if (ob->type != CIR_BUF || value > UINT_MAX || (value != 0 &&
+                (value < ((struct c_buf*) ob->buf)->sizebuf ||
+                 st_bufshared(ob)))) break;
+            ((struct c_buf*) ob->buf)->maxsize = value;
+            return 0;
+        case BOPT_GROWWAIT:
+            if (ob->type != CIR_BUF) break;
+            ((struct c_buf*) ob->buf)->growwait = (uint64_t) value * 1000;
+            return 0;
+        case BOPT_SHRINK:
+            if (ob->type != CIR_BUF) break;
+            ((struct c_buf*) ob->buf)->shrink = value != 0;
+            return 0;
+        case BOPT_SEGMENT:
+            if (ob->type != LIN_BUF || (value > 0 && st_bufshared(ob))) break;
+            return lb_setsegment(ob->buf, value);
+        case BOPT_MEMORY:
+            if (ob->type == MAP_BUF) break;
+            if (value & ~(size_t) (BMEM_HUGE | BMEM_HUGETLB | 
+                                   BMEM_PREFAULT | BMEM_LOCK)) break;
+            if (ob->type == CIR_BUF) return cb_setmem(ob->buf, value);
+            return lb_setmem(ob->buf, value | 
+                   (((struct l_buf*) ob->buf)->memflags & BM_SHARED));
+        case BOPT_SHARED:
+            /* Shared buffers stay shared */
+            if (value == 0){
+                if (st_bufshared(ob)) break;
+                return 0;
+            }
+            buf = ob->type == CIR_BUF ? (void*) cb_share(ob->buf) : 
+                                        (void*) lb_share(ob->buf);
+            if (buf == NULL) return -1;
+            ob->buf = buf;
+            return 0;
+        case BOPT_WAIT:
+            if (value > WAIT_POLL) break;
+            if (ob->type == CIR_BUF){
+                ((struct c_buf*) ob->buf)->wait.policy = value;
+            } else {
+                ((struct l_buf*) ob->buf)->wait.policy = value;
+            }
+            return 0;
+        case BOPT_SPINS:
+            if (value > UINT_MAX) break;
+            if (ob->type == CIR_BUF){
+                ((struct c_buf*) ob->buf)->wait.spins = value;
+            } else {
+                ((struct l_buf*) ob->buf)->wait.spins = value;
+            }
+            return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+
+
+
+
+/**
+ * @brief Get the largest size reached by an output buffer
+ *
+ * Only elastic and segmented buffers (see BOPT_ELASTIC, BOPT_SEGMENT)
+ * change of size: the size they reached over all the runs can be used
+ * to size them statically.
+ *
+ * @param n a node
+ * @param slot index of the output buffer
+ * @return the size in bytes or -1 in case of error, in this case
+ *         errno is set
+ */
+ssize_t st_bufsize(node n, unsigned int slot){
+    struct out_buf *ob;
+    struct l_buf *lb;
+
+    if (n->nb_outslots <= slot || n->outslots[slot].buf == NULL){
+        errno = ENOENT;
+        return -1;
+    }
+    ob = &n->outslots[slot];
+
+    switch (ob->type){
+        case LIN_BUF:
+        case MAP_BUF: 
+            lb = ob->buf;
+            if (lb->sizeseg > 0) return lb->nb_segs * lb->sizeseg;
+            return lb->sizebuf;
+        case CIR_BUF: return ((struct c_buf*) ob->buf)->peaksize;
+        default: errno = EINVAL;
+                 return -1;  
+    }
+}
+
+
+
+
+
+/**
+ * @brief Keep the file mapped by a MAP_BUF output buffer
+ *
+ * The buffer maps the file at path, created or truncated, instead
+ * of an anonymous file. At the end of every run the file holds
+ * exactly the data written, it stays once the straph is destroyed
+ * and can be given to the readers of another straph with 
+ * st_bufopen. The content of the buffer is lost.
+ *
+ * @param n a node
+ * @param slot index of the output buffer, of type MAP_BUF
+ * @param path path of the file
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set. An existing file is left untouched unless
+ *         only its truncation failed, a file created is removed.
+ */
+int st_bufretain(node n, unsigned int slot, const char *path){
+    int fd, err;
+    bool created;
+
+    if (n->nb_outslots <= slot || n->outslots[slot].buf == NULL){
+        errno = ENOENT;
+        return -1;
+    }
+    if (n->outslots[slot].type != MAP_BUF){
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Truncated only once mapped: kept as it is on failure */
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    created = (fd != -1);
+    if (fd == -1 && errno == EEXIST) fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    if (lb_setfile(n->outslots[slot].buf, fd, true) == -1){
+        err = errno;
+        close(fd);
+        if (created) unlink(path);
+        errno = err;
+        return -1;
+    }
+
+    /* Owned by the buffer from now on */
+    return ftruncate(fd, 0);
+}
+
+
+
+
+
+/**
+ * @brief Give an existing file to the readers of a MAP_BUF output
+ *        buffer
+ *
+ * The file (e.g. kept by st_bufretain) is mapped read-only: the
+ * buffer takes its size and the readers read it entirely without 
+ * waiting, the writes of the node fail. The content of the buffer
+ * is lost.
+ *
+ * @param n a node
+ * @param slot index of the output buffer, of type MAP_BUF
+ * @param path path of the file
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+int st_bufopen(node n, unsigned int slot, const char *path){
+    int fd, err;
+
+    if (n->nb_outslots <= slot || n->outslots[slot].buf == NULL){
+        errno = ENOENT;
+        return -1;
+    }
+    if (n->outslots[slot].type != MAP_BUF){
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return -1;
+
+    if (lb_setfile(n->outslots[slot].buf, fd, false) == -1){
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,555 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "mem.h"
+#include "straph.h"
+
+
+/* NUMA topology, read once from sysfs */
+static pthread_once_t bm_once = PTHREAD_ONCE_INIT;
+static int bm_nodes = 0;                    /* Highest NUMA node + 1 */
+static cpu_set_t bm_cpus[BM_MAXNODES];      /* CPUs of each NUMA node */
+
+
+
+
+
+/**
+ * @brief Parse a cpu list (e.g. "0-3,8,10-11")
+ * @param list a cpu list as found in sysfs
+ * @param set set where to add the listed cpus
+ * @return the number of cpus added
+ */
+static int bm_parselist(const char *list, cpu_set_t *set){
+    long first, last;
+    char *end;
+    int nb = 0;
+
+    while (*list != '\0' && *list != '\n'){
+        first = strtol(list, &end, 10);
+        if (end == list) break;
+        last = first;
+        if (*end == '-'){
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) break;
+        }
+
+        for (; first <= last && first < CPU_SETSIZE; first++){
+            CPU_SET(first, set);
+            nb++;
+        }
+
+        list = end;
+        if (*list == ',') list++;
+    }
+
+    return nb;
+}
+
+
+
+
+
+/**
+ * @brief Read the cpus of each NUMA node
+ *
+ * Nodes without cpus (or a system without NUMA support) 
+ * are treated as absent
+ */
+static void bm_topology(void){
+    char path[64], line[4096];
+    FILE *f;
+    int i;
+
+    for (i = 0; i < BM_MAXNODES; i++){
+        CPU_ZERO(&bm_cpus[i]);
+
+        snprintf(path, sizeof path, 
+            "/sys/devices/system/node/node%d/cpulist", i);
+        if ((f = fopen(path, "r")) == NULL) continue;
+
+        if (fgets(line, sizeof line, f) != NULL &&
+            bm_parselist(line, &bm_cpus[i]) > 0){
+            bm_nodes = i + 1;
+        }
+        fclose(f);
+    }
+}
+
+
+
+
+
+/**
+ * @brief Get the number of NUMA nodes
+ * @return the highest id of a NUMA node having cpus plus one,
+ *         0 if the topology is unknown
+ */
+int bm_nbnodes(void){
+    pthread_once(&bm_once, bm_topology);
+    return bm_nodes;
+}
+
+
+
+
+
+/**
+ * @brief Get the cpus of a NUMA node
+ * @param numa id of the NUMA node
+ * @return a set of sizeof(cpu_set_t) bytes or NULL if the
+ *         node doesn't exist or has no cpus
+ */
+const cpu_set_t* bm_nodecpus(int numa){
+    if (numa < 0 || numa >= bm_nbnodes()) return NULL;
+    if (CPU_COUNT(&bm_cpus[numa]) == 0) return NULL;
+    return &bm_cpus[numa];
+}
+
+
+
+
+
+/**
+ * @brief Find the NUMA node of a set of cpus
+ * @param setsize size of set in bytes
+ * @param set a set of cpus
+ * @return the NUMA node containing all the cpus of the
+ *         set or -1 if the cpus span several nodes (or
+ *         the topology is unknown)
+ */
+int bm_setnode(size_t setsize, const cpu_set_t *set){
+    int i, cpu, found;
+
+    found = -1;
+    for (i = 0; i < bm_nbnodes(); i++){
+
+        /* Look for a cpu of the set on this node */
+        for (cpu = 0; cpu < CPU_SETSIZE && 
+             (size_t) cpu < 8*setsize; cpu++){
+            if (CPU_ISSET_S(cpu, setsize, set) && 
+                CPU_ISSET(cpu, &bm_cpus[i])) break;
+        }
+        if (cpu == CPU_SETSIZE || (size_t) cpu == 8*setsize) continue;
+
+        if (found != -1) return -1;
+        found = i;
+    }
+
+    return found;
+}
+
+
+
+
+
+/**
+ * @brief Size of the mapping of a buffer
+ * @param size size of the buffer in bytes
+ * @param flags memory options of the buffer (BMEM_*)
+ * @return the size rounded to the pages used
+ */
+static size_t bm_maplen(size_t size, int flags){
+    if (flags & BMEM_HUGETLB){
+        return (size + BM_HUGESIZE - 1) / BM_HUGESIZE * BM_HUGESIZE;
+    }
+    return size;
+}
+
+
+
+
+
+/**
+ * @brief Apply the memory options which don't depend on 
+ *        the kind of mapping
+ * @param mem a mapping
+ * @param len size of the mapping
+ * @param flags memory options (BMEM_*)
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+static int bm_setup(void *mem, size_t len, int flags){
+    size_t page = sysconf(_SC_PAGESIZE), i;
+
+    /* Best effort: transparent huge pages may be disabled */
+    if (flags & BMEM_HUGE) madvise(mem, len, MADV_HUGEPAGE);
+
+    /* Commit every page now rather than at the first pass */
+    if (flags & BMEM_PREFAULT){
+        for (i = 0; i < len; i += page) ((volatile char*) mem)[i] = 0;
+    }
+
+    if ((flags & BMEM_LOCK) && mlock(mem, len) == -1) return -1;
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Allocate the memory of a buffer
+ *
+ * Explicit huge pages (BMEM_HUGETLB) come from the pool reserved
+ * by the system: when it is empty the buffer gets transparent huge
+ * pages instead. With BM_SHARED the memory is mapped shared: the
+ * processes forked afterwards see it at the same address.
+ *
+ * @param size size of the buffer in bytes
+ * @param flags memory options (BMEM_*, BM_SHARED), 0 for none
+ * @return a pointer to the memory or NULL in case of error,
+ *         in this case errno is set
+ */
+void* bm_alloc(size_t size, int flags){
+    void *mem;
+    size_t len;
+    int err, map;
+
+    if (size < BM_MAPSIZE && flags == 0) return malloc(size);
+
+    map = (flags & BM_SHARED ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS;
+    len = bm_maplen(size, flags);
+    mem = MAP_FAILED;
+    if (flags & BMEM_HUGETLB){
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+                   map | MAP_HUGETLB, -1, 0);
+    }
+
+    /* Pages are committed at first touch */
+    if (mem == MAP_FAILED){
+        if (flags & BMEM_HUGETLB) flags |= BMEM_HUGE;
+        mem = mmap(NULL, len, PROT_READ | PROT_WRITE, map, -1, 0);
+        if (mem == MAP_FAILED) return NULL;
+    }
+
+    if (bm_setup(mem, len, flags) == -1){
+        err = errno;
+        munmap(mem, len);
+        errno = err;
+        return NULL;
+    }
+
+    return mem;
+}
+
+
+
+
+
+/**
+ * @brief Free the memory of a buffer
+ * @param mem memory returned by bm_alloc
+ * @param size size given to bm_alloc
+ * @param flags memory options given to bm_alloc
+ */
+void bm_free(void *mem, size_t size, int flags){
+    if (mem == NULL) return;
+
+    if (size < BM_MAPSIZE && flags == 0) free(mem);
+    else munmap(mem, bm_maplen(size, flags));
+}
+
+
+
+
+
+/**
+ * @brief Create an anonymous file to back a buffer
+ *
+ * The file lives in $TMPDIR (/tmp by default) and has no name:
+ * it disappears once closed.
+ *
+ * @return a file descriptor or -1 in case of error, in this case 
+ *         errno is set
+ */
+int bm_tmpfile(void){
+    char path[4096];
+    const char *dir;
+    int fd;
+
+    if ((dir = getenv("TMPDIR")) == NULL || *dir == '\0') dir = "/tmp";
+
+    fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd != -1) return fd;
+
+    /* File systems without O_TMPFILE */
+    if (snprintf(path, sizeof path, "%s/straph.XXXXXX", dir) >= 
+        (int) sizeof path){
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if ((fd = mkostemp(path, O_CLOEXEC)) == -1) return -1;
+    unlink(path);
+
+    return fd;
+}
+
+
+
+
+
+/**
+ * @brief Map a file as the memory of a buffer
+ *
+ * The file is left as it is: the caller resizes a writable file
+ * to cover what is written (the blocks are only allocated when
+ * written). The mapping is read sequentially, the kernel reads 
+ * ahead aggressively.
+ *
+ * @param fd file descriptor, opened for writing if writable
+ * @param size size of the buffer in bytes
+ * @param writable true to map the file for writing
+ * @return a pointer to the memory or NULL in case of error,
+ *         in this case errno is set
+ */
+void* bm_mapfile(int fd, size_t size, bool writable){
+    void *mem;
+
+    /* An empty file still gets an address */
+    mem = mmap(NULL, MAX(size, 1), 
+               writable ? PROT_READ | PROT_WRITE : PROT_READ, 
+               MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (mem == MAP_FAILED) return NULL;
+
+    madvise(mem, MAX(size, 1), MADV_SEQUENTIAL);
+
+    return mem;
+}
+
+
+
+
+
+/**
+ * @brief Unmap the memory given by bm_mapfile
+ * @param mem memory returned by bm_mapfile
+ * @param size size given to bm_mapfile
+ */
+void bm_unmapfile(void *mem, size_t size){
+    if (mem == NULL) return;
+
+    munmap(mem, MAX(size, 1));
+}
+
+
+
+
+
+/**
+ * @brief Start writing back to the file a range written by the 
+ *        writer of a mapped buffer, and unmap it from the writer
+ *
+ * The data stays in the page cache until it is written, then
+ * it can be reclaimed. The range is rounded to the pages it
+ * fully covers.
+ *
+ * @param mem memory returned by bm_mapfile
+ * @param fd file mapped
+ * @param of offset of the range
+ * @param len size of the range
+ */
+void bm_writeback(void *mem, int fd, size_t of, size_t len){
+    size_t page = sysconf(_SC_PAGESIZE), end;
+
+    end = (of + len) / page * page;
+    of = (of + page - 1) / page * page;
+    if (end <= of) return;
+
+    sync_file_range(fd, of, end - of, SYNC_FILE_RANGE_WRITE);
+    madvise((char*) mem + of, end - of, MADV_DONTNEED);
+}
+
+
+
+
+
+/**
+ * @brief Drop from the memory a range already read from a mapped
+ *        buffer
+ *
+ * The pages are unmapped and the clean ones leave the page cache:
+ * another reader behind reads them again from the file. The range 
+ * is rounded to the pages it fully covers.
+ *
+ * @param mem memory returned by bm_mapfile
+ * @param fd file mapped
+ * @param of offset of the range
+ * @param len size of the range
+ */
+void bm_dropbehind(void *mem, int fd, size_t of, size_t len){
+    size_t page = sysconf(_SC_PAGESIZE), end;
+
+    end = (of + len) / page * page;
+    of = (of + page - 1) / page * page;
+    if (end <= of) return;
+
+    madvise((char*) mem + of, end - of, MADV_DONTNEED);
+    posix_fadvise(fd, of, end - of, POSIX_FADV_DONTNEED);
+}
+
+
+
+
+
+/**
+ * @brief Prefer a NUMA node for the memory of a buffer
+ *
+ * The pages not touched yet are allocated on the given node,
+ * pages already present are moved there when possible. Small
+ * buffers (sharing their pages with other data) are left 
+ * where they are.
+ *
+ * @param mem memory returned by bm_alloc
+ * @param size size given to bm_alloc
+ * @param numa id of the NUMA node
+ * @return 0 in case of success or -1 otherwise, in this case
+ *         errno is set
+ */
+int bm_place(void *mem, size_t size, int numa){
+    unsigned long mask[(BM_MAXNODES+63)/64];
+
+    if (size < BM_MAPSIZE) return 0;
+    if (bm_nodecpus(numa) == NULL){
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Nothing to choose */
+    if (bm_nbnodes() < 2) return 0;
+
+    memset(mask, 0, sizeof mask);
+    mask[numa / 64] |= 1UL << (numa % 64);
+
+    if (syscall(SYS_mbind, mem, size, MPOL_PREFERRED, mask, 
+                BM_MAXNODES+1, MPOL_MF_MOVE) == -1) return -1;
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Size of a mirrored buffer
+ * @param size minimal size of the buffer in bytes
+ * @param flags memory options of the buffer (BMEM_*)
+ * @return the smallest power of two, at least a page (a huge 
+ *         one with BMEM_HUGETLB), greater or equal to size
+ */
+size_t bm_mirrorsize(size_t size, int flags){
+    size_t mirror = sysconf(_SC_PAGESIZE);
+
+    if (flags & BMEM_HUGETLB) mirror = BM_HUGESIZE;
+
+    while (mirror < size) mirror <<= 1;
+
+    return mirror;
+}
+
+
+
+
+
+/**
+ * @brief Map a new memory file twice back-to-back
+ * @param size size of the file
+ * @param mfdflags flags given to memfd_create besides MFD_CLOEXEC
+ * @return a pointer to the memory or NULL in case of error,
+ *         in this case errno is set
+ */
+static char* bm_mapmirror(size_t size, unsigned int mfdflags){
+    char *mem;
+    int fd, err;
+
+    if ((fd = memfd_create("straph", MFD_CLOEXEC | mfdflags)) == -1) 
+        return NULL;
+    if (ftruncate(fd, size) == -1) goto error_1;
+
+    /* Reserve the address space of both copies */
+    mem = mmap(NULL, 2*size, PROT_NONE, 
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) goto error_1;
+
+    if (mmap(mem, size, PROT_READ | PROT_WRITE, 
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(mem + size, size, PROT_READ | PROT_WRITE, 
+             MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED){
+        err = errno;
+        munmap(mem, 2*size);
+        errno = err;
+        goto error_1;
+    }
+
+    /* The mappings keep the memory */
+    close(fd);
+    return mem;
+
+error_1:
+    err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+}
+
+
+
+
+
+/**
+ * @brief Allocate the memory of a mirrored buffer
+ *
+ * The memory is mapped twice back-to-back: the byte at 
+ * mem[i+size] is the byte at mem[i]. Any range of at most 
+ * size bytes starting in the buffer is then contiguous.
+ *
+ * @param size size of the buffer, as returned by bm_mirrorsize
+ * @param flags memory options (BMEM_*), 0 for none
+ * @return a pointer to the memory or NULL in case of error,
+ *         in this case errno is set
+ */
+void* bm_mirror(size_t size, int flags){
+    char *mem = NULL;
+    int err;
+
+    /* Same fallback as bm_alloc for explicit huge pages */
+    if (flags & BMEM_HUGETLB) mem = bm_mapmirror(size, MFD_HUGETLB);
+    if (mem == NULL){
+        if (flags & BMEM_HUGETLB) flags |= BMEM_HUGE;
+        if ((mem = bm_mapmirror(size, 0)) == NULL) return NULL;
+    }
+
+    if (bm_setup(mem, 2*size, flags) == -1){
+        err = errno;
+        munmap(mem, 2*size);
+        errno = err;
+        return NULL;
+    }
+
+    return mem;
+}
+
+
+
+
+
+/**
+ * @brief Free the memory of a mirrored buffer
+ * @param mem memory returned by bm_mirror
+ * @param size size given to bm_mirror
+ */
+void bm_unmirror(void *mem, size_t size){
+    if (mem == NULL) return;
+
+    munmap(mem, 2*size);
+}
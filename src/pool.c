@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "pool.h"
+#include "straph.h"
+#include "green.h"
+
+
+/* Worker running on the current thread (if any) */
+static __thread struct pl_worker* pl_self = NULL;
+
+/* Initial capacity of a queue */
+#define PQ_MINSIZE 16
+
+
+
+
+
+/*************************************************************/
+/*                     Priority queues                       */
+/*************************************************************/
+
+
+/**
+ * @brief Tell if a task must run before another one
+ *
+ * Tasks are ordered by the priority of their node, then by
+ * the length of the critical path starting at their node. Ties
+ * are broken by the order of submission.
+ *
+ * @param pq a queue
+ * @param a a task
+ * @param b another task
+ * @return true if a must run before b
+ */
+static inline bool pq_before(struct pl_queue *pq, 
+    struct pl_task *a, struct pl_task *b){
+
+    if (a->nd->priority != b->nd->priority) 
+        return a->nd->priority > b->nd->priority;
+    if (a->nd->rank != b->nd->rank) 
+        return a->nd->rank > b->nd->rank;
+
+    return (pq->lifo) ? a->seq > b->seq : a->seq < b->seq;
+}
+
+
+/**
+ * @brief Push a task into a queue
+ * @param pq a queue
+ * @param nd task to push
+ * @return 0 in case of success, -1 otherwise
+ */
+static int pq_push(struct pl_queue *pq, node nd){
+    unsigned int i, newsize;
+    struct pl_task *tasks, t;
+
+    PTH_ERRCK_NC(pthread_spin_lock(&pq->lock))
+
+    if (pq->nb == pq->size){
+        newsize = (pq->size == 0) ? PQ_MINSIZE : 2*pq->size;
+        tasks = realloc(pq->tasks, newsize * sizeof(struct pl_task));
+        if (tasks == NULL){
+            pthread_spin_unlock(&pq->lock);
+            return -1;
+        }
+        pq->tasks = tasks;
+        pq->size  = newsize;
+    }
+
+    /* Sift up */
+    t.nd  = nd;
+    t.seq = pq->seq++;
+    for (i = pq->nb; i > 0 && pq_before(pq, &t, &pq->tasks[(i-1)/2]); 
+         i = (i-1)/2){
+        pq->tasks[i] = pq->tasks[(i-1)/2];
+    }
+    pq->tasks[i] = t;
+    __atomic_store_n(&pq->nb, pq->nb+1, __ATOMIC_RELAXED);
+
+    PTH_ERRCK_NC(pthread_spin_unlock(&pq->lock))
+
+    return 0;
+}
+
+
+/**
+ * @brief Find the oldest task among the most urgent ones
+ *
+ * The tasks having the priority and the critical path of the
+ * root are as urgent as it, the oldest one is taken by thieves:
+ * the owner keeps the most recent ones, which are the hottest.
+ *
+ * @param pq a non empty queue, locked
+ * @return the index of the task in the heap
+ */
+static unsigned int pq_oldest(struct pl_queue *pq){
+    unsigned int i, best;
+    node root = pq->tasks[0].nd;
+
+    best = 0;
+    for (i = 1; i < pq->nb; i++){
+        if (pq->tasks[i].nd->priority == root->priority &&
+            pq->tasks[i].nd->rank == root->rank &&
+            pq->tasks[i].seq < pq->tasks[best].seq) best = i;
+    }
+
+    return best;
+}
+
+
+/**
+ * @brief Pop a task of a queue
+ * @param pq a queue
+ * @param steal true to take the oldest of the most urgent tasks,
+ *        false to take the most urgent one (see pq_before)
+ * @return a task or NULL if the queue is empty
+ */
+static node pq_pop(struct pl_queue *pq, bool steal){
+    unsigned int i, ch, nb;
+    struct pl_task last;
+    node nd;
+
+    /* Don't take the lock if there is nothing to pop */
+    if (__atomic_load_n(&pq->nb, __ATOMIC_RELAXED) == 0) return NULL;
+
+    pthread_spin_lock(&pq->lock);
+    if (pq->nb == 0){
+        pthread_spin_unlock(&pq->lock);
+        return NULL;
+    }
+
+    i = (steal && pq->lifo) ? pq_oldest(pq) : 0;
+    nd = pq->tasks[i].nd;
+    nb = pq->nb - 1;
+    last = pq->tasks[nb];
+
+    /* Sift up the last task into the hole, which is the root
+       unless stealing */
+    for (; i > 0 && pq_before(pq, &last, &pq->tasks[(i-1)/2]); 
+         i = (i-1)/2){
+        pq->tasks[i] = pq->tasks[(i-1)/2];
+    }
+
+    /* Or sift it down */
+    for (; (ch = 2*i+1) < nb; i = ch){
+        if (ch+1 < nb && pq_before(pq, &pq->tasks[ch+1], &pq->tasks[ch])) 
+            ch++;
+        if (!pq_before(pq, &pq->tasks[ch], &last)) break;
+        pq->tasks[i] = pq->tasks[ch];
+    }
+    pq->tasks[i] = last;
+    __atomic_store_n(&pq->nb, nb, __ATOMIC_RELAXED);
+
+    pthread_spin_unlock(&pq->lock);
+
+    return nd;
+}
+
+
+
+
+
+/*************************************************************/
+/*                          Workers                          */
+/*************************************************************/
+
+
+/**
+ * @brief Find the next task for a worker
+ *
+ * Looks in order into the worker's own queue, the shared
+ * queue of the pool and the queues of the other workers.
+ * The most urgent task of the first non empty queue is taken,
+ * the oldest of them when stealing from another worker (as 
+ * the deques did before the priorities).
+ *
+ * @param w the current worker
+ * @return a task or NULL if none was found
+ */
+static node pl_findtask(struct pl_worker *w){
+    unsigned int i;
+    node nd;
+    pool pl = w->pl;
+
+    /* Own tasks first: they are the hottest */
+    if ((nd = pq_pop(&w->pq, false)) != NULL) return nd;
+
+    /* Tasks submitted from outside the pool */
+    if ((nd = pq_pop(&pl->shared, false)) != NULL) return nd;
+
+    /* Steal from the others, starting from the next worker */
+    for (i = 1; i < pl->nb_workers; i++){
+        nd = pq_pop(&pl->workers[(w->idx + i) % pl->nb_workers].pq, true);
+        if (nd != NULL) return nd;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Wake up an idle worker if there is any
+ * @param pl the pool
+ */
+static void pl_wakeone(pool pl){
+    if (__atomic_load_n(&pl->nb_idle, __ATOMIC_SEQ_CST) == 0) return;
+
+    pthread_mutex_lock(&pl->lock);
+    pthread_cond_signal(&pl->cond_task);
+    pthread_mutex_unlock(&pl->lock);
+}
+
+
+/**
+ * @brief Move a worker onto the cpus of a node
+ *
+ * The worker keeps its cpus while it runs nodes having the
+ * same affinity, and goes back home for nodes without one.
+ *
+ * @param w the current worker
+ * @param nd the node to run
+ */
+static void pl_pin(struct pl_worker *w, node nd){
+    size_t setsize;
+    const cpu_set_t *set;
+    cpu_set_t cpus;
+
+    if ((set = st_ncpus(nd, &setsize)) == NULL){
+        cpus = w->home;
+    } else {
+        CPU_ZERO(&cpus);
+        memcpy(&cpus, set, MIN(setsize, sizeof(cpu_set_t)));
+    }
+
+    if (CPU_EQUAL(&cpus, &w->cpus)) return;
+
+    /* The affinity is a hint: keep running where we are on error */
+    if (pthread_setaffinity_np(pthread_self(), 
+            sizeof(cpu_set_t), &cpus) == 0) w->cpus = cpus;
+}
+
+
+/**
+ * @brief main loop of a worker of the pool
+ *
+ * Executes the tasks of the pool until the pool is
+ * asked to stop and no task is left
+ *
+ * @param p a void pointer pointing to the worker
+ * @return always NULL
+ */
+static void* pl_worker(void *p){
+    node nd;
+    struct pl_worker *w = p;
+    pool pl = w->pl;
+
+    pl_self = w;
+
+    if (pthread_getaffinity_np(pthread_self(), 
+            sizeof(cpu_set_t), &w->home) != 0){
+        CPU_ZERO(&w->home);
+    }
+    w->cpus = w->home;
+
+    while (1){
+
+        if ((nd = pl_findtask(w)) != NULL){
+            __atomic_sub_fetch(&pl->nb_tasks, 1, __ATOMIC_SEQ_CST);
+
+            /* Leave some work to the others */
+            if (__atomic_load_n(&pl->nb_tasks, __ATOMIC_SEQ_CST) > 0){
+                pl_wakeone(pl);
+            }
+
+            pl_pin(w, nd);
+
+            /* Run node (the wrapper publishes its completion) */
+            if (nd->exec_mode != GREEN_EXEC){
+                st_threadwrapper(nd);
+                continue;
+            }
+
+            /* Green node: carry it until it returns or yields */
+            switch (gr_resume(nd)){
+                case  1: st_nfinish(nd, nd->coro->ret);
+                         break;
+                case -1: st_nfinish(nd, NULL);
+                         break;
+            }
+            continue;
+        }
+
+        /* Nothing to do: sleep until new tasks arrive */
+        pthread_mutex_lock(&pl->lock);
+        __atomic_add_fetch(&pl->nb_idle, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pl->nb_tasks, __ATOMIC_SEQ_CST) == 0 &&
+               pl->stop == false){
+            pthread_cond_wait(&pl->cond_task, &pl->lock);
+        }
+        __atomic_sub_fetch(&pl->nb_idle, 1, __ATOMIC_SEQ_CST);
+
+        /* Stopped and no task left */
+        if (pl->stop && pl->nb_tasks == 0){
+            pthread_mutex_unlock(&pl->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pl->lock);
+    }
+
+    return NULL;
+}
+
+
+
+
+
+/*************************************************************/
+/*                           Pool                            */
+/*************************************************************/
+
+
+/**
+ * @brief Creates a new pool of workers
+ *
+ * Creates a pool of nb_workers persistent threads. A pool can be
+ * attached to one or more straphs using st_setpool, the nodes of
+ * these straphs will then be executed by the workers of the pool.
+ * After used a pool must be freed using st_destroypool.
+ *
+ * @param nb_workers number of workers of the pool. If zero, one
+ *        worker per online processor is created
+ * @return a pool or NULL in case of error, in this case errno
+ *         is set appropriately
+ *
+ * @see st_setpool
+ * @see st_destroypool
+ */
+pool st_makepool(unsigned int nb_workers){
+    int err;
+    long ncpus;
+    unsigned int i;
+    pool pl;
+
+    if (nb_workers == 0){
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nb_workers = (ncpus > 0) ? ncpus : 1;
+    }
+
+    pl = calloc(1, sizeof (struct s_pool));
+    if (pl == NULL) return NULL;
+
+    pl->workers = calloc(nb_workers, sizeof(struct pl_worker));
+    if (pl->workers == NULL) goto error_1;
+
+    if ((err = pthread_mutex_init(&pl->lock, NULL)) != 0)
+        goto error_2;
+    if ((err = pthread_cond_init(&pl->cond_task, NULL)) != 0)
+        goto error_3;
+    if ((err = pthread_cond_init(&pl->cond_done, NULL)) != 0)
+        goto error_4;
+    if ((err = pthread_spin_init(&pl->shared.lock,
+                    PTHREAD_PROCESS_PRIVATE)) != 0)
+        goto error_5;
+
+    for (i = 0; i < nb_workers; i++){
+        pl->workers[i].pl  = pl;
+        pl->workers[i].idx = i;
+        pl->workers[i].pq.lifo = true;
+        if ((err = pthread_spin_init(&pl->workers[i].pq.lock,
+                        PTHREAD_PROCESS_PRIVATE)) != 0){
+            while (i-- > 0) pthread_spin_destroy(&pl->workers[i].pq.lock);
+            goto error_6;
+        }
+    }
+
+    /* Launch workers */
+    for (pl->nb_workers = 0; pl->nb_workers < nb_workers;
+         pl->nb_workers++){
+
+        err = pthread_create(&pl->workers[pl->nb_workers].id,
+                  NULL, pl_worker, &pl->workers[pl->nb_workers]);
+        if (err != 0){
+            /* Only the launched workers are joined */
+            for (i = pl->nb_workers; i < nb_workers; i++){
+                pthread_spin_destroy(&pl->workers[i].pq.lock);
+            }
+            st_destroypool(pl);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    return pl;
+
+error_6:
+    pthread_spin_destroy(&pl->shared.lock);
+error_5:
+    pthread_cond_destroy(&pl->cond_done);
+error_4:
+    pthread_cond_destroy(&pl->cond_task);
+error_3:
+    pthread_mutex_destroy(&pl->lock);
+error_2:
+    free(pl->workers);
+    errno = err;
+error_1:
+    free(pl);
+    return NULL;
+}
+
+
+
+
+
+/**
+ * @brief Terminates and frees a pool
+ *
+ * Waits for the termination of every queued task, stops the
+ * workers and frees the pool. The pool must not be used by
+ * any straph after this call.
+ *
+ * @param pl the pool to destroy
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int st_destroypool(pool pl){
+    unsigned int i;
+
+    /* Ask the workers to stop */
+    PTH_ERRCK_NC(pthread_mutex_lock(&pl->lock))
+    pl->stop = true;
+    PTH_ERRCK_NC(pthread_cond_broadcast(&pl->cond_task))
+    PTH_ERRCK_NC(pthread_mutex_unlock(&pl->lock))
+
+    for (i = 0; i < pl->nb_workers; i++){
+        PTH_ERRCK_NC(pthread_join(pl->workers[i].id, NULL))
+        PTH_ERRCK_NC(pthread_spin_destroy(&pl->workers[i].pq.lock))
+        free(pl->workers[i].pq.tasks);
+    }
+
+    PTH_ERRCK_NC(pthread_spin_destroy(&pl->shared.lock))
+    free(pl->shared.tasks);
+
+    PTH_ERRCK_NC(pthread_cond_destroy(&pl->cond_done))
+    PTH_ERRCK_NC(pthread_cond_destroy(&pl->cond_task))
+    PTH_ERRCK_NC(pthread_mutex_destroy(&pl->lock))
+
+    free(pl->workers);
+    free(pl);
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Queue a node for execution
+ *
+ * When called from a worker of the pool the node is pushed on
+ * the worker's queue, otherwise it is pushed on the shared queue.
+ * Queued nodes are run by order of priority, then by length of
+ * their critical path. For equal keys, the worker's queues run
+ * the most recent node first and the shared queue the oldest one.
+ *
+ * @param pl pool which will run the node
+ * @param nd an active node
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int pl_submit(pool pl, node nd){
+    struct pl_queue *pq;
+
+    /* Count the task first: workers never sleep while it's queued */
+    __atomic_add_fetch(&pl->nb_tasks, 1, __ATOMIC_SEQ_CST);
+
+    /* Launched by a worker: keep it local */
+    if (pl_self != NULL && pl_self->pl == pl) pq = &pl_self->pq;
+    else pq = &pl->shared;
+
+    if (pq_push(pq, nd) == -1){
+        __atomic_sub_fetch(&pl->nb_tasks, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+
+    pl_wakeone(pl);
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Wait for the termination of a node run by a pool
+ *
+ * @param pl pool running the node
+ * @param nd node to wait
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int pl_wait(pool pl, node nd){
+
+    PTH_ERRCK_NC(pthread_mutex_lock(&pl->lock))
+
+    while (nd->done == false){
+        PTH_ERRCK(pthread_cond_wait(&pl->cond_done, &pl->lock),
+                  pthread_mutex_unlock(&pl->lock);)
+    }
+
+    PTH_ERRCK_NC(pthread_mutex_unlock(&pl->lock))
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Publish the termination of a node run by a pool
+ *
+ * This is the last access of the worker to the node: the node
+ * may be joined and destroyed as soon as this function returns
+ *
+ * @param pl pool running the node
+ * @param nd terminated node
+ * @param ret value returned by the node's routine
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int pl_done(pool pl, node nd, void *ret){
+
+    PTH_ERRCK_NC(pthread_mutex_lock(&pl->lock))
+
+    nd->ret  = ret;
+    nd->done = true;
+
+    PTH_ERRCK(pthread_cond_broadcast(&pl->cond_done),
+              pthread_mutex_unlock(&pl->lock);)
+    PTH_ERRCK_NC(pthread_mutex_unlock(&pl->lock))
+
+    return 0;
+}
@@ -2,12 +2,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
 #include "straph.h"
 #include "io.h"
+#include "green.h"
+#include "mem.h"
 
 /* TODO set better naming conventions */
 /* TODO improve code readablility  */
 
+static void st_dropplan(straph st);
+static void st_ndropplan(node nd);
+static void st_runnext(straph st, node nd, void *ret);
+static int st_spawn(node nd, bool detached);
+static void st_complete(straph st);
+static int st_launch(straph st, node nd);
+static void st_release(straph st, bool locked);
+static void st_doom(straph st, node nd, int err);
+static void st_parstart(straph st, node nd);
+static void st_runfail(straph st, node nd, int err);
+
 
 
 /**
@@ -22,9 +41,31 @@
  * @see st_destroy
  */
 straph st_create(void){
+    int err;
     straph st = calloc(1, sizeof (struct s_straph));
     if (st == NULL) return NULL;
 
+    st->efd = -1;
+
+    if ((err = pthread_mutex_init(&st->lock, NULL)) != 0){
+        free(st);
+        errno = err;
+        return NULL;
+    }
+    if ((err = pthread_cond_init(&st->cond, NULL)) != 0){
+        pthread_mutex_destroy(&st->lock);
+        free(st);
+        errno = err;
+        return NULL;
+    }
+    if ((err = pthread_mutex_init(&st->adm_lock, NULL)) != 0){
+        pthread_cond_destroy(&st->cond);
+        pthread_mutex_destroy(&st->lock);
+        free(st);
+        errno = err;
+        return NULL;
+    }
+
     return st;
 }
 
@@ -44,21 +85,16 @@ straph st_create(void){
  *         errno is set appropriately
  */ 
 node st_makenode(void* (*entry)(node)){
-    int err;
     node nd;
 
     nd = calloc(1, sizeof (struct s_node));
     if (nd == NULL) return NULL;
     
     /* Initialize node */
-    if ((err = pthread_spin_init(&nd->launch_lock,
-                    PTHREAD_PROCESS_PRIVATE)) != 0){
-        free(nd);
-        errno = err;
-        return NULL;
-    }
     nd->entry = entry;
     nd->status = INACTIVE;
+    nd->nb_pending = 1;
+    nd->numa = -1;
 
     return nd;
 }
@@ -92,6 +128,9 @@ int st_addnode(straph st, node nd){
     /* Add n to the list */
     st->entries[st->nb_entries++] = nd;
 
+    /* The topology changed */
+    st_dropplan(st);
+
     return 0;
 }
 
@@ -114,8 +153,12 @@ int st_addnode(straph st, node nd){
  *        of buffers will be set as NO_BUF
  * @param buftype type of the buffer, possible values are:
  *        LIN_BUF - linear buffer, provides a read/write capability
- *                  limited to bufsize. The writes who exceed the
- *                  size of the buffer are ignored. For most of the 
+ *                  limited to bufsize. A write exceeding the space
+ *                  left is short (only the bytes that fit are 
+ *                  written), a write into a full buffer fails with
+ *                  ENOSPC. Made of segments (see BOPT_SEGMENT) the
+ *                  buffer has no limit of size, its memory is 
+ *                  allocated as the data is written. For most of the
  *                  cases this is the recommended type when passing
  *                  data from node executed sequentially, or when the
  *                  size of the passed data is known and not too big.
@@ -127,13 +170,20 @@ int st_addnode(straph st, node nd){
  *                  only to the last portion of data written by the
  *                  writer before terminating. The size of this 
  *                  portion is undefined and depends on the size of
- *                  the buffer and the size of each write. 
+ *                  the buffer and the size of each write. Its size
+ *                  is at most UINT_MAX bytes (EINVAL otherwise).
  *                  TODO implement this last part
+ *        MAP_BUF - linear buffer whose memory is a mapped file, 
+ *                  for data larger than the memory. The file is
+ *                  anonymous unless kept with st_bufretain, the
+ *                  data read is dropped from the memory.
  *        NO_BUF  - no buffer will be set, every buffer previously 
  *                  set at bufindex will be eliminated 
  * @param bufsize size of the buffer. A size of zero has the same
  *        effect as NO_BUF. When NO_BUF is given as buftype this
- *        parameter is ignored.
+ *        parameter is ignored. A buffer set again with the same
+ *        type and size keeps its memory, its options are reset
+ *        except the memory ones (BOPT_MIRROR, BOPT_MEMORY).
  * @return 0 in case of success, -1 otherwise. This function sets
  *         errno.
  */
@@ -165,6 +215,16 @@ int st_setbuffer(node nd, unsigned int bufindex,
         nd->outslots = bufs;
         nd->nb_outslots = bufindex+1;
     }
+    nd->outslots[bufindex].owner = nd;
+
+    /* The buffers are placed at the compilation */
+    st_ndropplan(nd);
+
+    /* Same type and size: keep the memory of the old buffer */
+    switch (st_reuseb(&nd->outslots[bufindex], buftype, bufsize)){
+        case -1: return -1;
+        case 1: return st_bufreaders(&nd->outslots[bufindex]);
+    }
 
     /* Create new buffer */
     if (buftype != NO_BUF && bufsize > 0){
@@ -186,46 +246,33 @@ int st_setbuffer(node nd, unsigned int bufindex,
     nd->outslots[bufindex].type = buftype;
     nd->outslots[bufindex].buf  = newbuf;
 
-    return 0;
+    return st_bufreaders(&nd->outslots[bufindex]);
 }
 
 
 
 
 
-/* TODO function to link nodes without IO */
 /**
- * @brief Creates an execution-edge between two nodes
+ * @brief Attach a pool of workers to a straph
  *
- * Links two nodes creating an execution-edge. 
- * Execution-edges are directed edges between two nodes
- * and define the order of the execution of each node.
- * Nodes are executed following the topological order
- * defined by the execution-edges.
+ * Once a pool is attached, the nodes of the straph having
+ * the execution mode POOL_EXEC are run as tasks by the workers
+ * of the pool instead of having a dedicated thread created at
+ * every launch. The same pool can be shared by several straphs.
+ * The pool is not destroyed with the straph. Results are 
+ * undefined if the pool is changed while the straph is running.
  *
- * @param a node source of the execution-edge
- * @param b node destination of the execution-edge
- * @param mode mode of execution. Available options are:
- *        SEQ_MODE: wait for the termination of node a before
- *                  launching node b
- *        PAR_MODE: don't wait for node a to terminate, execute
- *                  node b in parallel
+ * @param st a straph
+ * @param pl a pool or NULL to run every node in its own thread
  * @return 0 in case of success or -1 otherwise, in this
  *         case errno is set
+ *
+ * @see st_makepool
+ * @see st_setexec
  */
-int st_nlink(node a, node b, unsigned char mode){
-    void *new_neigh;
-
-    /* Add neighbour to 'a' and set the mode */
-    new_neigh = realloc(a->neigh, (a->nb_neigh+1)*
-        sizeof(struct neighbour));
-    if (new_neigh == NULL) return -1;
-
-    a->neigh = new_neigh;
-    a->neigh[a->nb_neigh].n = b;
-    a->neigh[a->nb_neigh++].run_mode = mode;
-    b->nb_parents++;
-
+int st_setpool(straph st, pool pl){
+    st->pl = pl;
     return 0;
 }
 
@@ -234,57 +281,94 @@ int st_nlink(node a, node b, unsigned char mode){
 
 
 /**
- * @brief Add an io-edge between two nodes
- * 
- * Adds an io-edge between two nodes. Io-edges represent
- * data flows between nodes. 
+ * @brief Set the execution mode of a node
  *
- * @param a writer: node source of the io-edge
- * @param outslot number of the outslot of a
- * @param b reader: node destination of the io-edge 
- * @param inslot number of the receiving inslot of b
+ * Nodes are executed by default by the pool of their straph,
+ * when one is set. Nodes which may block for a long time 
+ * (e.g. waiting on the data of a node running in parallel)
+ * should rather be given a dedicated thread, to avoid holding
+ * a worker of the pool, or be run as green nodes.
+ *
+ * @param nd an inactive node
+ * @param mode mode of execution. Available options are:
+ *        POOL_EXEC:   run the node as a task of the straph's
+ *                     pool (or in a new thread if the straph
+ *                     has no pool)
+ *        THREAD_EXEC: always run the node in a new thread
+ *        GREEN_EXEC:  run the node as a coroutine carried by the
+ *                     workers of the straph's pool (or in a new 
+ *                     thread if the straph has no pool). When the
+ *                     node waits for data or space on a buffer,
+ *                     the worker is released and runs other nodes.
+ *                     Thousands of mostly idle nodes can then share
+ *                     a few threads. Each green node gets its own
+ *                     stack of GR_STACKSIZE bytes by default (see
+ *                     st_setstacksize). Green nodes can't use
+ *                     shared buffers.
+ *        PROC_EXEC:   run the node in a forked process, watched
+ *                     by a new thread. A crash of the node doesn't
+ *                     take the straph down: its output buffers are
+ *                     deactivated as if it returned, the nodes left
+ *                     reading its circular buffers get EOWNERDEAD
+ *                     once they read what it wrote, the data of its
+ *                     linear buffers just ends. All the buffers
+ *                     of the node shall be shared (see BOPT_SHARED), 
+ *                     the data still moves without copy. The value
+ *                     returned by the node is NULL if its routine 
+ *                     returned NULL, (void*) 1 otherwise (or if the
+ *                     process died).
  * @return 0 in case of success or -1 otherwise, in this
  *         case errno is set
  */
-int st_addflow(node a, unsigned int outslot,
-               node b, unsigned int inslot ){
-
-    /* Check index buffer */
-    if (outslot >= a->nb_outslots){
+int st_setexec(node nd, unsigned char mode){
+    if (mode != POOL_EXEC && mode != THREAD_EXEC && mode != GREEN_EXEC &&
+        mode != PROC_EXEC){
         errno = EINVAL;
         return -1;
     }
 
-    /* 
-     TODO: 
-        - increment the count on the buffer
-    */
+    nd->exec_mode = mode;
+    return 0;
+}
 
-    if (b->nb_inslots <= inslot){
-        /* Add a new input slot to 'b' */
 
-        /* Realloc if inslot is beyond the capacity */
-        void *tmp = realloc(b->inslots, (inslot+1)*sizeof(void*));
-        if (tmp == NULL){a->nb_neigh--; return -1;}
 
-        /* Set to NULL all new slots */
-        memset((void**) tmp + b->nb_inslots, 0,
-                (inslot+1 - b->nb_inslots)*sizeof(void*));
 
-        b->inslots = tmp;
-        b->nb_inslots = inslot+1;
 
-    } else if (b->inslots[inslot] != NULL){
-        /*
-          Decrement the count of the previous buffer
-          if the slot was already used
-        */
-        ((struct out_buf*) b->inslots[inslot])->nreaders--;
+/**
+ * @brief Set the size of the stack of a green node
+ *
+ * The stack is allocated at the first execution of the node as
+ * a green node and kept until the node is destroyed. Its pages
+ * are only committed when touched, an overflow faults on the 
+ * guard page below it.
+ *
+ * @param nd an inactive node
+ * @param size size of the stack in bytes (rounded up to a whole
+ *        number of pages), at least PTHREAD_STACK_MIN or 0 for
+ *        the default (GR_STACKSIZE)
+ * @return 0 in case of success or -1 otherwise, in this case 
+ *         errno is set (EBUSY if the node was launched)
+ *
+ * @see st_setexec
+ */
+int st_setstacksize(node nd, size_t size){
+    if (size != 0 && size < (size_t) PTHREAD_STACK_MIN){
+        errno = EINVAL;
+        return -1;
+    }
+    if (__atomic_load_n(&nd->status, __ATOMIC_ACQUIRE) != INACTIVE){
+        errno = EBUSY;
+        return -1;
     }
 
-    b->inslots[inslot] = &a->outslots[outslot];
-    a->outslots[outslot].nreaders++;
+    /* Allocated again at the next execution */
+    if (nd->coro != NULL && nd->sizestack != size){
+        gr_destroy(nd->coro);
+        nd->coro = NULL;
+    }
 
+    nd->sizestack = size;
     return 0;
 }
 
@@ -293,33 +377,38 @@ int st_addflow(node a, unsigned int outslot,
 
 
 /**
- * @brief launch each node of a straph
+ * @brief Set the cpus on which a node may run
  *
- * Activate the nodes of a straph following their
- * topological order 
+ * Restricts the execution of a node to a set of cpus, whatever
+ * its execution mode: nodes run by a pool move the worker carrying
+ * them onto the given cpus for the time of their execution. The
+ * set is also used by the placement policy of the straph to find
+ * the NUMA node of the node, which is done at compilation.
  *
- * @param st straph to launch
+ * @param nd an inactive node
+ * @param setsize size of set in bytes
+ * @param set set of cpus (see CPU_SET(3)) or NULL to let
+ *        the node run on any cpu
  * @return 0 in case of success or -1 otherwise, in this
  *         case errno is set
+ *
+ * @see st_setplacement
  */
-int st_start(straph st){
+int st_setaffinity(node nd, size_t setsize, const cpu_set_t *set){
+    cpu_set_t *cpuset = NULL;
 
-    unsigned int i;
-    struct linked_fifo lf;
-    lf_init(&lf);
-
-    /* Init fifo with straph's entries */
-    for (i = 0; i < st->nb_entries; i++){
-        if (lf_push(&lf, st->entries[i]) == -1){
-            lf_drop(&lf);
+    if (set != NULL){
+        if (setsize == 0 || CPU_COUNT_S(setsize, set) == 0){
+            errno = EINVAL;
             return -1;
         }
+        if ((cpuset = malloc(setsize)) == NULL) return -1;
+        memcpy(cpuset, set, setsize);
     }
 
-    if (st_starter(&lf) == -1){
-        lf_drop(&lf);
-        return -1;
-    }
+    free(nd->cpuset);
+    nd->cpuset  = cpuset;
+    nd->setsize = (set != NULL) ? setsize : 0;
 
     return 0;
 }
@@ -329,50 +418,42 @@ int st_start(straph st){
 
 
 /**
- * @brief Launches all the nodes of an initialized fifo and
- *        their children
- * 
- * Launches all the nodes inside the linked list given as argument.
- * Then launches all the children nodes reachable trough execution edges 
- * with run_mode == PAR_MODE
+ * @brief Set the placement policy of the buffers of a straph
  *
- * @param lf a pointer to a struct linked_fifo initialized with
- *        the nodes to launch
+ * The policy decides on which NUMA node the memory of each 
+ * output buffer lives. It is applied when the straph is compiled,
+ * so this function discards the current plan. Buffers smaller
+ * than BM_MAPSIZE are not moved.
+ *
+ * @param st an inactive straph
+ * @param policy the placement policy. Available options are:
+ *        PLACE_NONE:   the memory stays where it is first touched
+ *                      (default)
+ *        PLACE_WRITER: on the NUMA node of the node writing into
+ *                      the buffer
+ *        PLACE_READER: on the NUMA node where most of the readers 
+ *                      of the buffer are (or of the writer if no
+ *                      reader is pinned)
+ *        PLACE_AUTO:   every node without affinity is pinned to the
+ *                      NUMA node of the first node it reads from (or
+ *                      the first of its parents). The remaining nodes
+ *                      are spread over the NUMA nodes, this way the
+ *                      stages of a same flow stay on the same NUMA
+ *                      node. Buffers are placed as for PLACE_WRITER
  * @return 0 in case of success or -1 otherwise, in this
  *         case errno is set
+ *
+ * @see st_setaffinity
  */
-int st_starter(struct linked_fifo *lf){
-
-    node nd;
-    unsigned int i;
-
-    while (1){
-        /* Pop next node */
-        if ((nd = lf_pop(lf)) == NULL){
-            if (errno == ENOENT) break;
-            return -1;
-        }
+int st_setplacement(straph st, unsigned char policy){
+    if (policy > PLACE_AUTO){
+        errno = EINVAL;
+        return -1;
+    }
 
-        /* Launch node */ 
-        switch (st_nstart(nd)){
-            case  0: continue ; /* Not launched */
-            case -1: return -1; /* Error        */
-        }
+    st->placement = policy;
+    st_dropplan(st);
 
-        /* Collect node's neighbours */
-        for (i = 0; i < nd->nb_neigh; i++){
-            /* 
-             If the running mode is parallel,
-             add the node to the list 
-            */
-            if (nd->neigh[i].run_mode != PAR_MODE) continue;
-           
-            if (lf_push(lf, nd->neigh[i].n) == -1){
-                return -1;
-            }
-        } 
-    }
-    
     return 0;
 }
 
@@ -381,59 +462,64 @@ int st_starter(struct linked_fifo *lf){
 
 
 /**
- * @brief send a start request to an inactive node
+ * @brief Set the priority of a node
  *
- * Try to launch an inactive node by sending a start request. 
- * If the number of start requests is equal or greater than
- * the number of its parents, the node will be launched.
+ * When more nodes are ready than there are workers in the pool,
+ * the nodes having the highest priority are run first. Nodes 
+ * having the same priority (0 by default) are run by decreasing
+ * length of their critical path: the estimated cost of the longest
+ * chain of execution-edges starting at the node. This way the long
+ * chains, which set the duration of a run, start as early as 
+ * possible. Nodes having a dedicated thread are not affected.
  *
- * @param nd node to which send a start request
- * @return -1 in case of error, otherwise 1 if the
- *          node has been launched or 0 if the node
- *          is not ready (not enough start requests)
- *          to be launched
+ * @param nd an inactive node
+ * @param priority priority of the node
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set (EBUSY if the node was launched: it
+ *         may be queued by its priority)
+ *
+ * @see st_setcost
  */
-int st_nstart(node nd){
-
-    int err, ret;
-    /* Lock the node */
-    if ((err = pthread_spin_lock(&nd->launch_lock)) != 0) {
-        errno = err;
+int st_setpriority(node nd, int priority){
+    if (__atomic_load_n(&nd->status, __ATOMIC_ACQUIRE) != INACTIVE){
+        errno = EBUSY;
         return -1;
     }
 
-    /* Can launch only inactives nodes */
-    if (nd->status != INACTIVE ) {
-        errno = EINVAL;
-        pthread_spin_unlock(&nd->launch_lock);
-        return -1;
-    }
-        
-    /* Add start request */
-    nd->nb_startrequests += 1; 
-    if (nd->nb_startrequests < nd->nb_parents){
-        /* The node needs to wait for other parents */
-        ret = 0;
+    nd->priority = priority;
+    return 0;
+}
 
-    } else {
-        /* The node is ready to be launched */
 
-        /* Bring node up */
-        if (st_nup(nd) == -1){
-            pthread_spin_unlock(&nd->launch_lock);
-            return -1;
-        }
 
-        ret = 1;
-    }
 
-    /* Leave */
-    if ((err = pthread_spin_unlock(&nd->launch_lock)) != 0) {
-        errno = err;
+
+/**
+ * @brief Give an estimation of the cost of a node
+ *
+ * The cost of every node is measured at each execution, this 
+ * function can be used to give a hint when no measure is 
+ * available yet or when the measures are not representative 
+ * (e.g. green nodes, whose measure includes the time spent 
+ * waiting on buffers). The cost is used to find the critical
+ * paths of the straph when it is started.
+ *
+ * @param nd an inactive node
+ * @param cost estimated duration of an execution of the node in
+ *        nanoseconds, 0 to use the measured one
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set (EBUSY if the node was launched)
+ *
+ * @see st_setpriority
+ */
+int st_setcost(node nd, uint64_t cost){
+    if (__atomic_load_n(&nd->status, __ATOMIC_ACQUIRE) != INACTIVE){
+        errno = EBUSY;
         return -1;
     }
 
-    return ret;
+    nd->cost = cost;
+    return 0;
 }
 
 
@@ -441,41 +527,28 @@ int st_nstart(node nd){
 
 
 /**
- * @brief wrap the execution of every node's routine
- * 
- * This function contitues the entry point of every 
- * new thread created by a node. It wraps the execution
- * of a node's routine making the thread perform some
- * additional action: bring node down, launch seq. children
- * 
- * @param n a void pointer pointing to the node
- * @return the value returned by the node's routine
+ * @brief Limit the number of nodes of a straph running at once
+ *
+ * Once max nodes are running, the nodes ready to be launched are
+ * queued and admitted in order as the running ones terminate. 
+ * Every node counts, whatever its execution mode, a green node
+ * waiting on a buffer keeps its place. Nodes exchanging data in
+ * PAR_MODE must all fit in the limit, otherwise a writer can wait
+ * forever for a reader which is not admitted.
+ *
+ * @param st an inactive straph
+ * @param max max number of nodes running, 0 for no limit
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ *
+ * @see st_getstats
  */
-void* st_threadwrapper(void *n){
-    void *ret;
-    unsigned int i;
-    struct linked_fifo lf;
+int st_setmaxparallel(straph st, unsigned int max){
+    PTH_ERRCK_NC(pthread_mutex_lock(&st->adm_lock))
+    st->max_parallel = max;
+    PTH_ERRCK_NC(pthread_mutex_unlock(&st->adm_lock))
 
-    node nd = (node) n;
-
-    /* Execute node's routine  */
-    ret = nd->entry(n);
-
-    /* Bring node down */
-    st_ndown(nd);
-
-    /* Re-run starter from the neighbours having SEQ_MODE*/
-    lf_init(&lf);
-    for (i = 0; i < nd->nb_neigh; i++){
-        if (nd->neigh[i].run_mode != SEQ_MODE) continue;
-        if (lf_push(&lf, nd->neigh[i].n) == -1){
-            lf_drop(&lf);
-            return ret;
-        }
-    } 
-    if (st_starter(&lf) == -1) lf_drop(&lf);
-
-    return ret;
+    return 0;
 }
 
 
@@ -483,59 +556,62 @@ void* st_threadwrapper(void *n){
 
 
 /**
- * @brief bring up a node to the status active
+ * @brief Get the admission counters of a straph
  *
- * Active and create the thread of an inactive node
+ * The counters are updated only when the number of running
+ * nodes is limited (see st_setmaxparallel). They can be read
+ * at any time, e.g. while the straph is running.
  *
- * @param nd an inactive node to launch
+ * @param st a straph
+ * @param stats where to store the counters
  * @return 0 in case of success or -1 otherwise, in this
  *         case errno is set
  */
-int st_nup(node nd){
-    int err;
-    unsigned int i;
+int st_getstats(straph st, struct st_stats *stats){
+    PTH_ERRCK_NC(pthread_mutex_lock(&st->adm_lock))
+    *stats = st->stats;
+    PTH_ERRCK_NC(pthread_mutex_unlock(&st->adm_lock))
 
-    /* Create input slots */
-    for (i = 0; i < nd->nb_inslots; i++){
-        void* islot;
-
-        if (nd->inslots[i] == NULL) continue;
-
-        switch (((struct out_buf*)nd->inslots[i])->type){
-            case LIN_BUF:
-                islot = cb_makeis((struct out_buf*) nd->inslots[i]);
-                break;
-            case CIR_BUF:
-                islot = lb_makeis((struct out_buf*) nd->inslots[i]);
-                break;
-            default: 
-                errno = EINVAL;
-                return -1;
-        }
+    return 0;
+}
 
-        if (islot == NULL) return -1;
 
-        ((struct inslot_l*) islot)->src = nd->inslots[i];
-        nd->inslots[i] = islot;
-    }
 
 
-    /* Activate out buffers */
-    for (i = 0; i < nd->nb_outslots; i++){
-        st_bufstat(nd, i, BUF_ACTIVE);
-    }
 
-    /* Update status */
-    nd->status = ACTIVE;
+/**
+ * @brief Ask for a place to run a node
+ * @param st a straph limiting the number of running nodes
+ * @param nd an active node ready to be launched
+ * @return true if the node can be launched, false if it has been
+ *         queued (it will be launched by st_release)
+ */
+static bool st_admit(straph st, node nd){
+    bool admitted;
 
-    /* Launch thread */
-    err = pthread_create(&nd->id, NULL, st_threadwrapper, nd);
-    if (err != 0){
-        errno = err;
-        return -1;
+    pthread_mutex_lock(&st->adm_lock);
+
+    admitted = (st->nb_admitted < st->max_parallel);
+    if (admitted){
+        st->nb_admitted++;
+        st->stats.nb_admitted++;
+        st->stats.nb_running = st->nb_admitted;
+    } else {
+        nd->next = NULL;
+        nd->queued = st_clock();
+        if (st->adm_last != NULL) st->adm_last->next = nd;
+        else st->adm_first = nd;
+        st->adm_last = nd;
+
+        st->stats.nb_delayed++;
+        if (++st->stats.nb_queued > st->stats.max_queued){
+            st->stats.max_queued = st->stats.nb_queued;
+        }
     }
 
-    return 0;
+    pthread_mutex_unlock(&st->adm_lock);
+
+    return admitted;
 }
 
 
@@ -543,41 +619,70 @@ int st_nup(node nd){
 
 
 /**
- * @brief bring down a node to the status terminated
+ * @brief Give back the place of a terminated node
  *
- * This function shall be called on a node after it's 
- * routine has terminated to change it's status to 
- * TERMINATED and free the data structures not longer
- * needed.
+ * The place goes to the least recent node waiting for
+ * admission, if there is any, which then requests its parallel
+ * children. A node failing to launch is brought down (its
+ * children were not requested) and its place goes to the next one.
  *
- * @param nd the node to bring down
+ * @param st a straph limiting the number of running nodes
+ * @param locked true if the caller holds st->lock (iterating)
  */
-void st_ndown(node nd){
+static void st_release(straph st, bool locked){
+    node nd;
+    int err;
 
-    unsigned int i;
+    do {
+        pthread_mutex_lock(&st->adm_lock);
 
-    /* Update status */
-    nd->status = TERMINATED;
+        nd = st->adm_first;
+        if (nd != NULL){
+            st->adm_first = nd->next;
+            if (st->adm_first == NULL) st->adm_last = NULL;
 
-    /* Free input slots */
-    for (i = 0; i < nd->nb_inslots; i++){
+            st->stats.nb_queued--;
+            st->stats.nb_admitted++;
+            st->stats.wait_time += st_clock() - nd->queued;
+        } else {
+            st->nb_admitted--;
+            st->stats.nb_running = st->nb_admitted;
+        }
 
-        struct inslot_c *inslot;
-        struct out_buf *src;
+        pthread_mutex_unlock(&st->adm_lock);
 
-        inslot = nd->inslots[i];
-        if (inslot == NULL) continue;
+        /* The place goes to nd, launched only now: its children too */
+        if (nd == NULL) return;
+        if (st_launch(st, nd) == 0){
+            if (st->run_iters == 0) st_parstart(st, nd);
+            return;
+        }
 
-        src = inslot->src;         
-        free(inslot);
+        err = errno;
+        st_ndown(nd);
+        if (st->run_iters == 0){
+            st_doom(st, nd, err);
+        } else {
+            if (!locked) pthread_mutex_lock(&st->lock);
+            st_runfail(st, nd, err);
+            if (!locked) pthread_mutex_unlock(&st->lock);
+        }
+    } while (true);
+}
 
-        nd->inslots[i] = src;   /* Restore src */
-    }
 
-    /* Deactivate out buffers */
-    for (i = 0; i < nd->nb_outslots; i++){
-        st_bufstat(nd,i, BUF_INACTIVE);
-    }
+
+
+
+/**
+ * @brief Get a monotonic time
+ * @return the time in nanoseconds
+ */
+uint64_t st_clock(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 
@@ -585,66 +690,1774 @@ void st_ndown(node nd){
 
 
 /**
- * @brief join all the threads of a straph
+ * @brief Record the duration of an execution of a node
  *
- * This function will wait the termination of all 
- * node's threads and join them. The value retrieved 
- * by each thread is stored inside the respective node.
- * After joined the straph is rewinded and every node's
- * status is brought back from TERMINATED to INACTIVE 
+ * The measured cost is a moving average, weighting the last
+ * execution by 1/4
  *
- * @param st running straph to join
- * @return 0 in case of success or -1 otherwise, in this
- *         case errno is set
- * TODO wait execution before join
+ * @param nd a node whose routine has just returned
+ * @param elapsed duration of the routine in nanoseconds
  */
-int st_join(straph st){
-    node nd;
-    int err;
-    unsigned int i;
-    struct linked_fifo lf;
+void st_nmeasure(node nd, uint64_t elapsed){
+    if (nd->measured == 0) nd->measured = elapsed;
+    else nd->measured = (3*nd->measured + elapsed) / 4;
+}
 
 
-    lf_init(&lf);
 
-    /* Init fifo with straph's entries */
-    for (i = 0; i < st->nb_entries; i++){
-        if (lf_push(&lf, st->entries[i]) == -1) goto error;
+
+
+/**
+ * @brief Compute the critical path of every node
+ *
+ * Walks the plan in reverse topological order: the rank of a
+ * node is its cost plus the highest rank of its children.
+ * Nodes without hint nor measure count as 1ns.
+ *
+ * @param st a compiled straph
+ */
+static void st_rank(straph st){
+    unsigned int i, j;
+    uint64_t best, cost;
+    struct st_plan *plan = st->plan;
+    node nd, ch;
+
+    for (i = plan->nb_nodes; i-- > 0;){
+        nd = plan->order[i];
+
+        best = 0;
+        for (j = plan->adj_off[i]; j < plan->adj_off[i+1]; j++){
+            ch = plan->order[plan->adj[j]];
+            if (ch->rank > best) best = ch->rank;
+        }
+
+        cost = (nd->cost != 0) ? nd->cost : nd->measured;
+        nd->rank = best + ((cost != 0) ? cost : 1);
+    }
+}
+
+
+
+
+
+/**
+ * @brief Get the cpus on which a node must run
+ * @param nd a node
+ * @param setsize where to store the size of the set
+ * @return the set of cpus or NULL if the node can run anywhere
+ */
+const cpu_set_t* st_ncpus(node nd, size_t *setsize){
+    const cpu_set_t *set;
+
+    if (nd->cpuset != NULL){
+        *setsize = nd->setsize;
+        return nd->cpuset;
+    }
+
+    /* Pinned by the placement policy */
+    if (nd->numa >= 0 && (set = bm_nodecpus(nd->numa)) != NULL){
+        *setsize = sizeof(cpu_set_t);
+        return set;
+    }
+
+    return NULL;
+}
+
+
+
+
+
+/**
+ * @brief Tell if a node is executed by a pool
+ * @param st the straph to which the node belongs
+ * @param nd a node
+ * @return true if the node is run by the pool of the straph
+ */
+static inline bool st_pooled(straph st, node nd){
+    return st->pl != NULL && nd->exec_mode != THREAD_EXEC &&
+           nd->exec_mode != PROC_EXEC;
+}
+
+
+
+
+
+/* TODO function to link nodes without IO */
+/**
+ * @brief Creates an execution-edge between two nodes
+ *
+ * Links two nodes creating an execution-edge. 
+ * Execution-edges are directed edges between two nodes
+ * and define the order of the execution of each node.
+ * Nodes are executed following the topological order
+ * defined by the execution-edges.
+ *
+ * @param a node source of the execution-edge
+ * @param b node destination of the execution-edge
+ * @param mode mode of execution. Available options are:
+ *        SEQ_MODE: wait for the termination of node a before
+ *                  launching node b
+ *        PAR_MODE: don't wait for node a to terminate, execute
+ *                  node b in parallel
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int st_nlink(node a, node b, unsigned char mode){
+    void *new_neigh;
+
+    /* Add neighbour to 'a' and set the mode */
+    new_neigh = realloc(a->neigh, (a->nb_neigh+1)*
+        sizeof(struct neighbour));
+    if (new_neigh == NULL) return -1;
+
+    a->neigh = new_neigh;
+    a->neigh[a->nb_neigh].n = b;
+    a->neigh[a->nb_neigh++].run_mode = mode;
+    b->nb_parents++;
+    b->nb_pending = b->nb_parents;
+
+    /* The topology changed */
+    st_ndropplan(a);
+    st_ndropplan(b);
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Add an io-edge between two nodes
+ * 
+ * Adds an io-edge between two nodes. Io-edges represent
+ * data flows between nodes. 
+ *
+ * @param a writer: node source of the io-edge
+ * @param outslot number of the outslot of a
+ * @param b reader: node destination of the io-edge 
+ * @param inslot number of the receiving inslot of b
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int st_addflow(node a, unsigned int outslot,
+               node b, unsigned int inslot ){
+
+    /* Check index buffer */
+    if (outslot >= a->nb_outslots){
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* 
+     TODO: 
+        - increment the count on the buffer
+    */
+
+    if (b->nb_inslots <= inslot){
+        /* Add a new input slot to 'b' */
+
+        /* Realloc if inslot is beyond the capacity */
+        void *tmp = realloc(b->inslots, (inslot+1)*sizeof(void*));
+        if (tmp == NULL){a->nb_neigh--; return -1;}
+
+        /* Set to NULL all new slots */
+        memset((void**) tmp + b->nb_inslots, 0,
+                (inslot+1 - b->nb_inslots)*sizeof(void*));
+
+        b->inslots = tmp;
+        b->nb_inslots = inslot+1;
+
+    } else if (b->inslots[inslot] != NULL){
+        /*
+          Decrement the count of the previous buffer
+          if the slot was already used
+        */
+        ((struct out_buf*) b->inslots[inslot])->nreaders--;
+    }
+
+    b->inslots[inslot] = &a->outslots[outslot];
+    a->outslots[outslot].nreaders++;
+
+    /* The writers and readers of the plan changed */
+    st_ndropplan(a);
+    st_ndropplan(b);
+
+    return st_bufreaders(&a->outslots[outslot]);
+}
+
+
+
+
+
+/**
+ * @brief Append a node to an array of collected nodes, unless
+ *        it was already collected
+ * @param nd node to collect
+ * @param nodes pointer to the array of nodes
+ * @param nb pointer to the number of nodes in the array
+ * @param size pointer to the capacity of the array
+ * @return 0 in case of success or -1 otherwise
+ */
+static int st_visit(node nd, node **nodes, unsigned int *nb, 
+    unsigned int *size){
+    node *tmp;
+
+    if (nd->visited) return 0;
+
+    if (*nb == *size){
+        *size = (*size == 0) ? 16 : 2 * *size;
+        tmp = realloc(*nodes, *size * sizeof(node));
+        if (tmp == NULL) return -1;
+        *nodes = tmp;
+    }
+
+    nd->visited = true;
+    (*nodes)[(*nb)++] = nd;
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Collect every node of a straph
+ *
+ * Walks the straph from its entries and collects every node
+ * reachable through execution-edges, each node only once. 
+ *
+ * @param st a straph
+ * @param nb pointer where to store the number of nodes found
+ * @return a malloc'ed array containing the nodes or NULL in case 
+ *         of error, in this case errno is set. The array is NULL
+ *         as well if the straph has no node (*nb == 0)
+ */
+static node* st_collect(straph st, unsigned int *nb){
+    node *nodes;
+    unsigned int i, j, size, head;
+
+    *nb = 0;
+    size = 0;
+    nodes = NULL;
+
+    for (i = 0; i < st->nb_entries; i++){
+        if (st_visit(st->entries[i], &nodes, nb, &size) == -1) 
+            goto error;
+    }
+
+    /* The array of nodes is also the queue of the walk */
+    for (head = 0; head < *nb; head++){
+        node nd = nodes[head];
+        for (j = 0; j < nd->nb_neigh; j++){
+            if (st_visit(nd->neigh[j].n, &nodes, nb, &size) == -1) 
+                goto error;
+        }
+    }
+
+    /* Clear marks */
+    for (i = 0; i < *nb; i++) nodes[i]->visited = false;
+
+    return nodes;
+
+error:
+    for (i = 0; i < *nb; i++) nodes[i]->visited = false;
+    free(nodes);
+    *nb = 0;
+    return NULL;
+}
+
+
+
+
+
+/**
+ * @brief Free an execution plan
+ * @param plan an execution plan, possibly incomplete
+ */
+static void st_freeplan(struct st_plan *plan){
+
+    free(plan->order);
+    free(plan->adj_off);
+    free(plan->adj);
+    free(plan->adj_mode);
+    free(plan->nb_parents);
+    free(plan->par_off);
+    free(plan->par);
+    free(plan->par_mode);
+    free(plan->wr_off);
+    free(plan->wr);
+    free(plan->rd_off);
+    free(plan->rd);
+    free(plan);
+}
+
+
+
+
+
+/**
+ * @brief Free the execution plan of a straph
+ * @param st a straph
+ */
+static void st_dropplan(straph st){
+    if (st->plan == NULL) return;
+
+    st_freeplan(st->plan);
+    st->plan = NULL;
+}
+
+
+
+
+
+/**
+ * @brief Free the execution plan holding a node, if any
+ * @param nd a node whose links or buffers changed
+ */
+static void st_ndropplan(node nd){
+    straph st = nd->st;
+
+    if (st == NULL || st->plan == NULL) return;
+    if (nd->idx < st->plan->nb_nodes && st->plan->order[nd->idx] == nd){
+        st_dropplan(st);
+    }
+}
+
+
+
+
+
+/**
+ * @brief Find the node of a plan writing into an input slot
+ * @param plan an execution plan
+ * @param src output buffer linked to the input slot
+ * @return the index of the writer or plan->nb_nodes if the
+ *         writer doesn't belong to the plan
+ */
+static unsigned int st_planwriter(struct st_plan *plan, void *src){
+    node w;
+    
+    if (src == NULL) return plan->nb_nodes;
+
+    w = ((struct out_buf*) src)->owner;
+    if (w == NULL || w->idx >= plan->nb_nodes ||
+        plan->order[w->idx] != w) return plan->nb_nodes;
+
+    return w->idx;
+}
+
+
+
+
+
+/**
+ * @brief Build the reverse arrays of a plan: parents of
+ *        each node and writers/readers of each node
+ * @param plan a plan with nodes in topological order,
+ *        children and parents count set
+ * @return 0 in case of success or -1 otherwise
+ */
+static int st_compilerev(struct st_plan *plan){
+    unsigned int i, j, w, nb, nb_edges, nb_flows, *fill;
+    
+    nb = plan->nb_nodes;
+    nb_edges = plan->adj_off[nb];
+
+    /* Count flows */
+    plan->wr_off = calloc(nb+1, sizeof(unsigned int));
+    plan->rd_off = calloc(nb+1, sizeof(unsigned int));
+    plan->par_off = calloc(nb+1, sizeof(unsigned int));
+    fill = calloc(nb+1, sizeof(unsigned int));
+    if (plan->wr_off == NULL || plan->rd_off == NULL || 
+        plan->par_off == NULL || fill == NULL) goto error;
+
+    nb_flows = 0;
+    for (i = 0; i < nb; i++){
+        node nd = plan->order[i];
+        for (j = 0; j < nd->nb_inslots; j++){
+            w = st_planwriter(plan, nd->inslots[j]);
+            if (w == nb) continue;
+            plan->wr_off[i+1]++;
+            plan->rd_off[w+1]++;
+            nb_flows++;
+        }
+        plan->par_off[i+1] = plan->nb_parents[i];
+    }
+    for (i = 0; i < nb; i++){
+        plan->wr_off[i+1]  += plan->wr_off[i];
+        plan->rd_off[i+1]  += plan->rd_off[i];
+        plan->par_off[i+1] += plan->par_off[i];
+    }
+
+    plan->wr = malloc((nb_flows+1) * sizeof(unsigned int));
+    plan->rd = malloc((nb_flows+1) * sizeof(unsigned int));
+    plan->par = malloc((nb_edges+1) * sizeof(unsigned int));
+    plan->par_mode = malloc((nb_edges+1) * sizeof(unsigned char));
+    if (plan->wr == NULL || plan->rd == NULL ||
+        plan->par == NULL || plan->par_mode == NULL) goto error;
+
+    /* Parents */
+    for (i = 0; i < nb; i++){
+        for (j = plan->adj_off[i]; j < plan->adj_off[i+1]; j++){
+            unsigned int ch = plan->adj[j];
+            plan->par[plan->par_off[ch] + fill[ch]] = i;
+            plan->par_mode[plan->par_off[ch] + fill[ch]] = plan->adj_mode[j];
+            fill[ch]++;
+        }
+    }
+
+    /* Writers and readers */
+    memset(fill, 0, (nb+1) * sizeof(unsigned int));
+    for (i = 0; i < nb; i++){
+        node nd = plan->order[i];
+        unsigned int nb_wr = 0;
+        for (j = 0; j < nd->nb_inslots; j++){
+            w = st_planwriter(plan, nd->inslots[j]);
+            if (w == nb) continue;
+            plan->wr[plan->wr_off[i] + nb_wr++] = w;
+            plan->rd[plan->rd_off[w] + fill[w]++] = i;
+        }
+    }
+
+    free(fill);
+    return 0;
+
+error:
+    free(fill);
+    return -1;
+}
+
+
+
+
+
+/**
+ * @brief Choose the NUMA node of a buffer
+ * @param st a compiled straph
+ * @param i index of the writer in the plan
+ * @param buf an output buffer of the writer
+ * @return a NUMA node or -1 if the buffer is left where it is
+ */
+static int st_bufnuma(straph st, unsigned int i, struct out_buf *buf){
+    unsigned int votes[BM_MAXNODES];
+    unsigned int j, k, best;
+    struct st_plan *plan = st->plan;
+    node rd, wr = plan->order[i];
+
+    if (st->placement != PLACE_READER) return wr->numa;
+
+    /* Count the pinned readers of each NUMA node */
+    memset(votes, 0, sizeof votes);
+    for (j = plan->rd_off[i]; j < plan->rd_off[i+1]; j++){
+
+        /* A reader appears once per flow, and flows are grouped */
+        if (j > plan->rd_off[i] && plan->rd[j] == plan->rd[j-1]) continue;
+
+        rd = plan->order[plan->rd[j]];
+        if (rd->numa < 0) continue;
+        for (k = 0; k < rd->nb_inslots; k++){
+            if (rd->inslots[k] == buf) votes[rd->numa]++;
+        }
+    }
+
+    best = 0;
+    for (k = 1; k < BM_MAXNODES; k++){
+        if (votes[k] > votes[best]) best = k;
+    }
+
+    return (votes[best] > 0) ? (int) best : wr->numa;
+}
+
+
+
+
+
+/**
+ * @brief Apply the placement policy of a straph
+ *
+ * Finds the NUMA node of every node of the plan and moves
+ * the buffers accordingly. The placement is only a hint: 
+ * buffers which cannot be moved are left where they are.
+ *
+ * @param st a compiled straph
+ */
+static void st_place(straph st){
+    unsigned int i, j, next;
+    int numa, nb_numa;
+    struct st_plan *plan = st->plan;
+    node nd;
+
+    nb_numa = bm_nbnodes();
+    next = 0;
+
+    for (i = 0; i < plan->nb_nodes; i++){
+        nd = plan->order[i];
+        nd->numa = -1;
+
+        if (st->placement == PLACE_NONE) continue;
+
+        if (nd->cpuset != NULL){
+            nd->numa = bm_setnode(nd->setsize, nd->cpuset);
+            continue;
+        }
+
+        if (st->placement != PLACE_AUTO || nb_numa < 2) continue;
+
+        /* Follow the first placed writer, or parent */
+        for (j = plan->wr_off[i]; j < plan->wr_off[i+1] && 
+             nd->numa < 0; j++){
+            nd->numa = plan->order[plan->wr[j]]->numa;
+        }
+        for (j = plan->par_off[i]; j < plan->par_off[i+1] &&
+             nd->numa < 0; j++){
+            nd->numa = plan->order[plan->par[j]]->numa;
+        }
+
+        /* Head of a flow: next NUMA node having cpus */
+        while (nd->numa < 0){
+            numa = next++ % nb_numa;
+            if (bm_nodecpus(numa) != NULL) nd->numa = numa;
+        }
+    }
+
+    if (st->placement == PLACE_NONE) return;
+
+    /* Place the buffers */
+    for (i = 0; i < plan->nb_nodes; i++){
+        nd = plan->order[i];
+        for (j = 0; j < nd->nb_outslots; j++){
+            if (nd->outslots[j].buf == NULL) continue;
+
+            numa = st_bufnuma(st, i, &nd->outslots[j]);
+            if (numa >= 0) st_bufplace(&nd->outslots[j], numa);
+        }
+    }
+}
+
+
+
+
+
+/**
+ * @brief Compile the execution plan of a straph
+ *
+ * Freezes the topology of a straph into an execution plan: the 
+ * nodes in topological order, their children as compact adjacency
+ * arrays and the number of parents of each node. Every lifecycle
+ * function (st_start, st_join, st_rewind and st_destroy) walks 
+ * this plan instead of rediscovering the graph.
+ * A straph is compiled automatically by st_start when needed, and
+ * the plan is discarded whenever the graph changes: a node added
+ * to the straph (st_addnode), an edge or a flow added to one of 
+ * its nodes (st_nlink, st_addflow), one of their buffers set 
+ * (st_setbuffer) or another placement (st_setplacement).
+ *
+ * @param st an inactive straph
+ * @return 0 in case of success or -1 otherwise, in this case errno
+ *         is set (EINVAL if the execution-edges contain a cycle)
+ */
+int st_compile(straph st){
+    node *nodes;               /* Nodes in discovery order */
+    unsigned int nb;           /* Number of nodes */
+    unsigned int *indeg;       /* Remaining parents (Kahn) */
+    unsigned int i, j, head, tail, nb_edges;
+    struct st_plan *plan;
+
+    nodes = st_collect(st, &nb);
+    if (nodes == NULL && nb == 0 && st->nb_entries > 0) return -1;
+
+    plan = calloc(1, sizeof(struct st_plan));
+    indeg = calloc(nb+1, sizeof(unsigned int));
+    if (plan == NULL || indeg == NULL) goto error;
+
+    /* Count edges and parents using the discovery index */
+    nb_edges = 0;
+    for (i = 0; i < nb; i++) nodes[i]->idx = i;
+    for (i = 0; i < nb; i++){
+        nb_edges += nodes[i]->nb_neigh;
+        for (j = 0; j < nodes[i]->nb_neigh; j++){
+            indeg[nodes[i]->neigh[j].n->idx]++;
+        }
+    }
+
+    plan->nb_nodes   = nb;
+    plan->order      = malloc((nb+1) * sizeof(node));
+    plan->adj_off    = malloc((nb+1) * sizeof(unsigned int));
+    plan->adj        = malloc((nb_edges+1) * sizeof(unsigned int));
+    plan->adj_mode   = malloc((nb_edges+1) * sizeof(unsigned char));
+    plan->nb_parents = malloc((nb+1) * sizeof(unsigned int));
+    if (plan->order == NULL || plan->adj_off  == NULL ||
+        plan->adj   == NULL || plan->adj_mode == NULL ||
+        plan->nb_parents == NULL) goto error;
+
+    for (i = 0; i < nb; i++) plan->nb_parents[i] = indeg[i];
+
+    /* Topological sort (Kahn): order is also the queue */
+    tail = 0;
+    for (i = 0; i < nb; i++){
+        if (indeg[i] == 0) plan->order[tail++] = nodes[i];
+    }
+    for (head = 0; head < tail; head++){
+        node nd = plan->order[head];
+        for (j = 0; j < nd->nb_neigh; j++){
+            if (--indeg[nd->neigh[j].n->idx] == 0){
+                plan->order[tail++] = nd->neigh[j].n;
+            }
+        }
+    }
+
+    /* Some nodes were never freed from their parents */
+    if (tail < nb){
+        errno = EINVAL;
+        goto error;
+    }
+
+    /* Reorder the parent counts and switch to the final index */
+    for (i = 0; i < nb; i++) indeg[i] = plan->nb_parents[plan->order[i]->idx];
+    for (i = 0; i < nb; i++){
+        plan->nb_parents[i] = indeg[i];
+        plan->order[i]->idx = i;
+        plan->order[i]->st = st;
+    }
+
+    /* Adjacency arrays */
+    plan->adj_off[0] = 0;
+    for (i = 0; i < nb; i++){
+        node nd = plan->order[i];
+        plan->adj_off[i+1] = plan->adj_off[i] + nd->nb_neigh;
+        for (j = 0; j < nd->nb_neigh; j++){
+            plan->adj[plan->adj_off[i]+j] = nd->neigh[j].n->idx;
+            plan->adj_mode[plan->adj_off[i]+j] = nd->neigh[j].run_mode;
+        }
+        nd->nb_pending = (plan->nb_parents[i] > 0) ? 
+                          plan->nb_parents[i] : 1;
+    }
+
+    if (st_compilerev(plan) == -1) goto error;
+
+    free(indeg);
+    free(nodes);
+
+    st_dropplan(st);
+    st->plan = plan;
+    st_place(st);
+
+    return 0;
+
+error:
+    if (plan != NULL) st_freeplan(plan);
+    free(indeg);
+    free(nodes);
+    return -1;
+}
+
+
+
+
+
+/**
+ * @brief Tell if a buffer can be used by a node given its
+ *        execution mode
+ * @param nd a PROC_EXEC or GREEN_EXEC node
+ * @param buf a buffer read or written by the node
+ * @return true if a forked node uses a shared buffer or a 
+ *         green node a private one
+ */
+static bool st_shareok(node nd, struct out_buf *buf){
+    if (buf->buf == NULL) return true;
+    return st_bufshared(buf) == (nd->exec_mode == PROC_EXEC);
+}
+
+
+
+
+
+/**
+ * @brief Check the buffers used by the nodes of a straph
+ *
+ * A forked node only sees the shared buffers, a green node 
+ * can't be woken by another process (see gr_forget). Done
+ * before launching anything since the buffers may change
+ * after the compilation.
+ *
+ * @param st a compiled straph
+ * @return 0 if every node can use its buffers or -1 otherwise,
+ *         in this case errno is set to EINVAL
+ */
+static int st_checkbufs(straph st){
+    unsigned int i, j;
+    node nd;
+
+    for (i = 0; i < st->plan->nb_nodes; i++){
+        nd = st->plan->order[i];
+        if (nd->exec_mode != PROC_EXEC && nd->exec_mode != GREEN_EXEC){
+            continue;
+        }
+
+        for (j = 0; j < nd->nb_inslots; j++){
+            if (nd->inslots[j] == NULL || 
+                st_shareok(nd, nd->inslots[j])) continue;
+            errno = EINVAL;
+            return -1;
+        }
+        for (j = 0; j < nd->nb_outslots; j++){
+            if (st_shareok(nd, &nd->outslots[j])) continue;
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief launch each node of a straph
+ *
+ * Activate the nodes of a straph following their
+ * topological order. The straph is compiled first
+ * if it doesn't have an execution plan. 
+ * A node failing to launch is never run, nor are the 
+ * nodes coming after it in the plan: the run still
+ * completes and st_join reports the error.
+ *
+ * @param st straph to launch
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set and no node has been launched
+ *
+ * @see st_compile
+ */
+int st_start(straph st){
+
+    unsigned int i;
+
+    if (st->plan == NULL && st_compile(st) == -1) return -1;
+    if (st_checkbufs(st) == -1) return -1;
+    st_rank(st);
+
+    /* Every node of the plan must terminate */
+    PTH_ERRCK_NC(pthread_mutex_lock(&st->lock))
+    st->completed = false;
+    st->nb_alive = st->plan->nb_nodes;
+    st->launch_err = 0;
+    PTH_ERRCK_NC(pthread_mutex_unlock(&st->lock))
+
+    if (st->plan->nb_nodes == 0) st_complete(st);
+
+    /* Send a start request to each entry (failures go to st_join) */
+    for (i = 0; i < st->nb_entries; i++){
+        st_starter(st, st->entries[i]);
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Sends a start request to a node and launches its
+ *        children when possible
+ * 
+ * Sends a start request to the given node. If the node is launched,
+ * sends a start request to all the children nodes reachable trough 
+ * execution edges with run_mode == PAR_MODE, and so on. 
+ * The nodes still having to request their children are chained 
+ * through their field 'launched', so no allocation is needed
+ * (each node is launched once per run). A child failing to
+ * launch doesn't stop the others (see st_doom). A node waiting
+ * for a place requests its children once launched (see 
+ * st_release).
+ *
+ * @param st the straph to which the node belongs
+ * @param nd the node to launch
+ * @return 0 in case of success or -1 if the node failed to 
+ *         launch, in this case errno is set
+ */
+int st_starter(straph st, node nd){
+
+    /* Launch node */ 
+    switch (st_nstart(st, nd)){
+        case  0: return  0; /* Not launched */
+        case -1: return -1; /* Error        */
+    }
+
+    st_parstart(st, nd);
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Send a start request to the parallel children of a
+ *        launched node, and so on for the children launched
+ * @param st the straph to which the node belongs
+ * @param nd a node which has just been launched
+ */
+static void st_parstart(straph st, node nd){
+
+    node ch, launched;
+    unsigned int i;
+    struct st_plan *plan = st->plan;
+
+    nd->launched = NULL;
+    launched = nd;
+
+    while (launched != NULL){
+        /* Pop next launched node */
+        nd = launched;
+        launched = nd->launched;
+
+        /* Request its parallel children */
+        for (i = plan->adj_off[nd->idx]; i < plan->adj_off[nd->idx+1]; i++){
+            if (plan->adj_mode[i] != PAR_MODE) continue;
+           
+            ch = plan->order[plan->adj[i]];
+            switch (st_nstart(st, ch)){
+                case  0: /* Not launched */
+                case -1: continue; /* Error (doomed) */
+            }
+
+            ch->launched = launched;
+            launched = ch;
+        } 
+    }
+}
+
+
+
+
+
+/**
+ * @brief send a start request to an inactive node
+ *
+ * Try to launch an inactive node by sending a start request. 
+ * Every request decrements atomically the countdown of the
+ * pending parents: the request bringing it to zero launches 
+ * the node. Nodes without parents are launched by their first
+ * request, requests exceeding the countdown are ignored. A node
+ * failing to launch is doomed with its descendants.
+ *
+ * @param st the straph to which the node belongs
+ * @param nd node to which send a start request
+ * @return -1 in case of error, otherwise 1 if the
+ *          node has been launched or 0 if the node
+ *          is not ready (not enough start requests)
+ *          to be launched or waits for a place (see
+ *          st_release)
+ */
+int st_nstart(straph st, node nd){
+
+    /* 
+     Add start request: only the last awaited parent
+     sees the countdown going from 1 to 0 
+    */
+    if (__atomic_fetch_sub(&nd->nb_pending, 1, __ATOMIC_ACQ_REL) != 1){
+        /* The node needs to wait for other parents */
+        return 0;
+    }
+
+    /* The node is ready to be launched: bring node up */
+    switch (st_nup(st, nd)){
+        case -1: st_doom(st, nd, errno);
+                 return -1;
+        case  1: return 0; /* Queued for admission */
+    }
+
+    return 1;
+}
+
+
+
+
+
+/**
+ * @brief Give up a node which failed to launch
+ *
+ * Records the error for st_join, then counts the node and every
+ * node reachable from it in the plan as terminated: they can't
+ * get the start request of the node, so they never run. Their 
+ * output buffers are deactivated, this way the nodes already 
+ * reading them see the end of the data. A node reachable from 
+ * several failed nodes is counted once.
+ *
+ * @param st a started straph
+ * @param nd a node whose launch failed (inactive or terminated)
+ * @param err the error of the launch (errno)
+ */
+static void st_doom(straph st, node nd, int err){
+    struct st_plan *plan = st->plan;
+    unsigned int i, nb = 0;
+    int none = 0;
+    unsigned char inactive;
+    node doomed, ch;
+
+    __atomic_compare_exchange_n(&st->launch_err, &none, err, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    /* Chained through 'launched', never launched in this run */
+    __atomic_store_n(&nd->status, DOOMED, __ATOMIC_RELEASE);
+    nd->launched = NULL;
+    doomed = nd;
+
+    while (doomed != NULL){
+        nd = doomed;
+        doomed = nd->launched;
+        nb++;
+
+        for (i = 0; i < nd->nb_outslots; i++){
+            st_bufstat(nd, i, BUF_INACTIVE);
+        }
+
+        for (i = plan->adj_off[nd->idx]; i < plan->adj_off[nd->idx+1]; i++){
+            ch = plan->order[plan->adj[i]];
+            inactive = INACTIVE;
+            if (!__atomic_compare_exchange_n(&ch->status, &inactive, DOOMED,
+                     false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) continue;
+
+            ch->launched = doomed;
+            doomed = ch;
+        }
+    }
+
+    if (__atomic_sub_fetch(&st->nb_alive, nb, __ATOMIC_ACQ_REL) == 0){
+        st_complete(st);
+    }
+}
+
+
+
+
+
+/**
+ * @brief wrap the execution of every node's routine
+ * 
+ * This function contitues the entry point of every 
+ * new thread created by a node. It wraps the execution
+ * of a node's routine making the thread perform some
+ * additional action: bring node down, launch seq. children
+ * 
+ * @param n a void pointer pointing to the node
+ * @return the value returned by the node's routine
+ */
+void* st_threadwrapper(void *n){
+    void *ret;
+    uint64_t start;
+    node nd = (node) n;
+
+    /* Execute node's routine  */
+    start = st_clock();
+    ret = nd->exec_mode == PROC_EXEC ? st_nfork(nd) : nd->entry(n);
+    st_nmeasure(nd, st_clock() - start);
+
+    st_nfinish(nd, ret);
+
+    return ret;
+}
+
+
+
+
+
+/**
+ * @brief Run the routine of a node in a forked process
+ *
+ * The child gives back the input slots it read and deactivates
+ * its output buffers before exiting, the buffers being shared 
+ * the readers of the other processes see it. The child never 
+ * touches the straph nor its pool: the nodes parked by the 
+ * parent are forgotten. If the child is killed, the readers of
+ * its circular buffers are told so (see cb_fail).
+ *
+ * @param nd an active node whose buffers are shared
+ * @return NULL if the routine returned NULL, (void*) 1 otherwise
+ *         or if the process couldn't run or died
+ */
+void* st_nfork(node nd){
+    unsigned int i;
+    struct inslot *inslot;
+    pid_t pid;
+    int status;
+    void *ret;
+
+    /* The child prints only its own output */
+    fflush(NULL);
+
+    if ((pid = fork()) == -1) return (void*) 1;
+
+    if (pid == 0){
+        gr_forget();
+        ret = nd->entry(nd);
+
+        for (i = 0; i < nd->nb_inslots; i++){
+            inslot = nd->inslots[i];
+            if (inslot != NULL && inslot->src->type == CIR_BUF){
+                cb_finis((struct inslot_c*) inslot);
+            }
+        }
+        for (i = 0; i < nd->nb_outslots; i++){
+            st_bufstat(nd, i, BUF_INACTIVE);
+        }
+
+        fflush(NULL);
+        _exit(ret == NULL ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    while (waitpid(pid, &status, 0) == -1){
+        if (errno != EINTR) return (void*) 1;
+    }
+
+    /* Killed: the readers of its circular buffers get EOWNERDEAD */
+    if (!WIFEXITED(status)){
+        for (i = 0; i < nd->nb_outslots; i++){
+            if (nd->outslots[i].type == CIR_BUF && 
+                nd->outslots[i].buf != NULL){
+                cb_fail(nd->outslots[i].buf);
+            }
+        }
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS){
+        return NULL;
+    }
+    return (void*) 1;
+}
+
+
+
+
+
+/**
+ * @brief terminate the execution of a node
+ *
+ * Brings the node down and launches the children waiting 
+ * for it, then publishes its termination. The node may be
+ * joined as soon as this function returns.
+ *
+ * @param nd a node whose routine has just returned
+ * @param ret the value returned by the node's routine
+ */
+void st_nfinish(node nd, void *ret){
+    unsigned int i;
+    straph st = nd->st;
+    struct st_plan *plan = st->plan;
+
+    /* Bring node down */
+    st_ndown(nd);
+
+    /* Leave the place to the next node */
+    if (st->max_parallel > 0) st_release(st, false);
+
+    /* Iterating: let the run schedule the next nodes */
+    if (st->run_iters > 0){
+        st_runnext(st, nd, ret);
+        return;
+    }
+
+    /* Re-run starter from the neighbours having SEQ_MODE*/
+    for (i = plan->adj_off[nd->idx]; i < plan->adj_off[nd->idx+1]; i++){
+        if (plan->adj_mode[i] != SEQ_MODE) continue;
+        st_starter(st, plan->order[plan->adj[i]]);
+    } 
+
+    /* Publish the termination to the pool */
+    if (st_pooled(st, nd)) pl_done(st->pl, nd, ret);
+
+    /* The last node going down completes the run */
+    if (__atomic_sub_fetch(&st->nb_alive, 1, __ATOMIC_ACQ_REL) == 0){
+        st_complete(st);
+    }
+}
+
+
+
+
+
+/**
+ * @brief Publish the completion of a straph
+ *
+ * Wakes up st_join and makes the eventfd of the straph
+ * readable. This is the last access of a node to the straph:
+ * the straph may be joined as soon as this function returns.
+ *
+ * @param st a straph whose nodes have all terminated
+ */
+static void st_complete(straph st){
+    pthread_mutex_lock(&st->lock);
+
+    st->completed = true;
+    if (st->efd != -1) eventfd_write(st->efd, 1);
+    pthread_cond_broadcast(&st->cond);
+
+    pthread_mutex_unlock(&st->lock);
+}
+
+
+
+
+
+/**
+ * @brief bring up a node to the status active
+ *
+ * Activate an inactive node and start its execution, either
+ * as a task of the straph's pool or in a new thread
+ *
+ * @param st the straph to which the node belongs
+ * @param nd an inactive node to launch
+ * @return 0 in case of success, 1 if the node waits for a place
+ *         (launched later by st_release) or -1 otherwise, in this
+ *         case errno is set and the node is either still 
+ *         inactive or brought down (failed launch)
+ */
+int st_nup(straph st, node nd){
+    unsigned int i;
+    int err;
+    union inslot_any *store;
+    struct out_buf *src;
+
+    /* Check the sources before touching the node */
+    for (i = 0; i < nd->nb_inslots; i++){
+        src = nd->inslots[i];
+        if (src == NULL || src->type == LIN_BUF || src->type == MAP_BUF ||
+            src->type == CIR_BUF) continue;
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* 
+     Storage of the input slots: allocated once
+     and reused by every run of the node
+    */
+    if (nd->nb_isstore < nd->nb_inslots){
+        store = realloc(nd->isstore,
+                    nd->nb_inslots * sizeof(union inslot_any));
+        if (store == NULL) return -1;
+
+        nd->isstore = store;
+        nd->nb_isstore = nd->nb_inslots;
+    }
+    store = nd->isstore;
+
+    /* Create input slots */
+    for (i = 0; i < nd->nb_inslots; i++){
+        src = nd->inslots[i];
+
+        if (src == NULL) continue;
+
+        if (src->type == CIR_BUF) cb_initis(&store[i].c, src);
+        else lb_initis(&store[i].l, src);
+
+        nd->inslots[i] = &store[i];
+    }
+
+
+    /* Activate out buffers */
+    for (i = 0; i < nd->nb_outslots; i++){
+        st_bufstat(nd, i, BUF_ACTIVE);
+    }
+
+    /* Update status */
+    nd->status = ACTIVE;
+    nd->st = st;
+
+    /* Wait for a place if the number of running nodes is limited */
+    if (st->max_parallel > 0 && st_admit(st, nd) == false) return 1;
+
+    if (st_launch(st, nd) == -1){
+        err = errno;
+        st_ndown(nd);
+        if (st->max_parallel > 0) st_release(st, st->run_iters > 0);
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Start the execution of an active node
+ * @param st the straph to which the node belongs
+ * @param nd an active node
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+static int st_launch(straph st, node nd){
+
+    /* Hand the node to the pool */
+    if (st_pooled(st, nd)) return pl_submit(st->pl, nd);
+
+    /* Launch thread (iterating: nobody joins it) */
+    return st_spawn(nd, st->run_iters > 0);
+}
+
+
+
+
+
+/**
+ * @brief Launch the thread of a node
+ * @param nd an active node
+ * @param detached if true the thread is created in detached state
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+static int st_spawn(node nd, bool detached){
+    int err;
+    size_t setsize;
+    const cpu_set_t *set;
+    pthread_attr_t attr;
+
+    PTH_ERRCK_NC(pthread_attr_init(&attr))
+    if (detached){
+        PTH_ERRCK(pthread_attr_setdetachstate(&attr, 
+                  PTHREAD_CREATE_DETACHED), pthread_attr_destroy(&attr);)
+    }
+    if ((set = st_ncpus(nd, &setsize)) != NULL){
+        PTH_ERRCK(pthread_attr_setaffinity_np(&attr, setsize, set),
+                  pthread_attr_destroy(&attr);)
+    }
+
+    err = pthread_create(&nd->id, &attr, st_threadwrapper, nd);
+    pthread_attr_destroy(&attr);
+    if (err != 0){
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief bring down a node to the status terminated
+ *
+ * This function shall be called on a node after it's 
+ * routine has terminated to change it's status to 
+ * TERMINATED and release the input slots.
+ *
+ * @param nd the node to bring down
+ */
+void st_ndown(node nd){
+
+    unsigned int i;
+
+    /* Update status (see st_ndone) */
+    __atomic_store_n(&nd->status, TERMINATED, __ATOMIC_RELEASE);
+
+    /* Release input slots */
+    for (i = 0; i < nd->nb_inslots; i++){
+
+        struct inslot *inslot = nd->inslots[i];
+        if (inslot == NULL) continue;
+
+        /* 
+         Give back the space read but not published yet
+         (a forked node did it in its process, see st_nfork,
+         unless it died: maybe holding a mutex of the buffer)
+        */
+        if (inslot->src->type == CIR_BUF && nd->exec_mode != PROC_EXEC){
+            cb_finis((struct inslot_c*) inslot);
+        } else if (inslot->src->type == CIR_BUF){
+            cb_wake(inslot->src->buf);
+        }
+
+        nd->inslots[i] = inslot->src;   /* Restore src */
+    }
+
+    /* Deactivate out buffers */
+    for (i = 0; i < nd->nb_outslots; i++){
+        st_bufstat(nd,i, BUF_INACTIVE);
+    }
+}
+
+
+
+
+
+/**
+ * @brief join all the threads of a straph
+ *
+ * This function will wait the termination of all 
+ * node's threads and join them. The value retrieved 
+ * by each thread is stored inside the respective node.
+ * After joined the straph is rewinded and every node's
+ * status is brought back from TERMINATED to INACTIVE.
+ * If a node failed to launch the straph is still joined
+ * and rewinded, the error of the launch is returned.
+ *
+ * @param st running straph to join
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int st_join(straph st){
+    node nd;
+    int err;
+    unsigned int i;
+
+    if (st->plan == NULL){
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* 
+     Wait for the last node to publish the completion: 
+     by then every node has been launched
+    */
+    PTH_ERRCK_NC(pthread_mutex_lock(&st->lock))
+    while (st->completed == false){
+        PTH_ERRCK(pthread_cond_wait(&st->cond, &st->lock),
+                  pthread_mutex_unlock(&st->lock);)
+    }
+    st->completed = false;
+    if (st->efd != -1){
+        eventfd_t cnt;
+        eventfd_read(st->efd, &cnt);
+    }
+    PTH_ERRCK_NC(pthread_mutex_unlock(&st->lock))
+
+    /* Join nodes (the doomed ones never ran) */
+    for (i = 0; i < st->plan->nb_nodes; i++){
+        nd = st->plan->order[i];
+
+        if (nd->status == DOOMED){
+            /* Not run */
+        } else if (st_pooled(st, nd)){
+            if (pl_wait(st->pl, nd) == -1) return -1;
+        } else {
+            err = pthread_join(nd->id, &nd->ret);
+            if (err != 0){
+                errno = err;
+                return -1;
+            }
+        }
+
+        nd->status = JOINED;
     }
 
-    /* Join nodes */
-    nd = NULL; 
-    while (1){
+    if (st_rewind(st) == -1) return -1;
 
-        /* Pop and join node */
-        nd = lf_pop(&lf);
-        if (nd == NULL){
-            if (errno == ENOENT) break;
-            goto error;
+    if (st->launch_err != 0){
+        errno = st->launch_err;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief join a straph if it has terminated
+ *
+ * Same as st_join, but doesn't wait: if some node of the
+ * straph is still running the function fails with EBUSY.
+ *
+ * @param st running straph to join
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set (EBUSY if the straph has not
+ *         terminated yet)
+ *
+ * @see st_join
+ */
+int st_tryjoin(straph st){
+    bool completed;
+
+    if (st->plan == NULL){
+        errno = EINVAL;
+        return -1;
+    }
+
+    PTH_ERRCK_NC(pthread_mutex_lock(&st->lock))
+    completed = st->completed;
+    PTH_ERRCK_NC(pthread_mutex_unlock(&st->lock))
+
+    if (completed == false){
+        errno = EBUSY;
+        return -1;
+    }
+
+    return st_join(st);
+}
+
+
+
+
+
+/**
+ * @brief get a file descriptor signaling the completion 
+ *        of a straph
+ *
+ * The file descriptor becomes readable (e.g. for poll, select
+ * or epoll) when every node of a straph launched with st_start 
+ * has terminated, and stays readable until the straph is joined.
+ * It must not be read nor closed by the caller, it is closed by
+ * st_destroy.
+ *
+ * @param st a straph
+ * @return a file descriptor or -1 in case of error, in this
+ *         case errno is set
+ *
+ * @see st_waitany
+ */
+int st_fd(straph st){
+    int fd;
+
+    PTH_ERRCK_NC(pthread_mutex_lock(&st->lock))
+
+    if (st->efd == -1){
+        fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd == -1){
+            pthread_mutex_unlock(&st->lock);
+            return -1;
         }
 
-        err = pthread_join(nd->id, &nd->ret);
-        if (err != 0){
-            errno = err;
-            goto error;
+        /* The straph may have terminated already */
+        if (st->completed) eventfd_write(fd, 1);
+        st->efd = fd;
+    }
+    fd = st->efd;
+
+    PTH_ERRCK_NC(pthread_mutex_unlock(&st->lock))
+
+    return fd;
+}
+
+
+
+
+
+/**
+ * @brief wait for the termination of any of several straphs
+ *
+ * Waits until at least one of the straphs has terminated. The
+ * terminated straph is not joined: st_join (or st_tryjoin) must
+ * still be called before starting it again.
+ *
+ * @param sts array of started straphs
+ * @param nb number of straphs in sts
+ * @param timeout maximum time to wait in milliseconds, a
+ *        negative value means no limit
+ * @return the index in sts of a terminated straph or -1 in
+ *         case of error, in this case errno is set (ETIMEDOUT
+ *         if no straph terminated before the timeout, EBADF if
+ *         the fd of a straph was closed)
+ *
+ * @see st_fd
+ */
+int st_waitany(straph *sts, unsigned int nb, int timeout){
+    struct pollfd *fds;
+    unsigned int i;
+    int ret;
+
+    if (nb == 0){
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((fds = malloc(nb * sizeof(struct pollfd))) == NULL) return -1;
+
+    for (i = 0; i < nb; i++){
+        if ((fds[i].fd = st_fd(sts[i])) == -1){
+            free(fds);
+            return -1;
         }
+        fds[i].events = POLLIN;
+    }
 
-        nd->status = JOINED;
+    ret = poll(fds, nb, timeout);
+    if (ret == 0) errno = ETIMEDOUT;
 
-        /* Collect neighbours */
-        for (i = 0; i < nd->nb_neigh; i++){
-            if (nd->neigh[i].n->status == JOINED) continue;
-            if (lf_push(&lf, nd->neigh[i].n) == -1) goto error;
-        } 
+    for (i = 0; ret > 0 && i < nb; i++){
+        if (fds[i].revents & POLLIN) break;
     }
 
-    if (st_rewind(st) == -1) return -1;
+    /* Only errors reported: a closed fd (EBADF) or else (EIO) */
+    if (ret > 0 && i == nb){
+        errno = EIO;
+        for (i = 0; i < nb; i++){
+            if (fds[i].revents & POLLNVAL) errno = EBADF;
+        }
+        ret = -1;
+    }
+
+    free(fds);
+
+    return ret > 0 ? (int) i : -1;
+}
+
+
+
+
+
+/**
+ * @brief tell if a node has terminated
+ *
+ * Can be called at any time, e.g. while the straph of
+ * the node is running
+ *
+ * @param nd a node
+ * @return 1 if the routine of the node has returned during
+ *         the current run, 0 otherwise
+ */
+int st_ndone(node nd){
+    unsigned char status = __atomic_load_n(&nd->status, __ATOMIC_ACQUIRE);
+    return status == TERMINATED || status == JOINED;
+}
+
+
+
+
+
+/**
+ * @brief Tell if a node can start its next iteration
+ *
+ * During st_run the node can start its iteration k when:
+ *  - it has terminated its iteration k-1
+ *  - each parent linked in SEQ_MODE has terminated its iteration k
+ *  - each parent linked in PAR_MODE has started its iteration k
+ *  - each node reading its output buffers has terminated its
+ *    iteration k-1 (buffers can then be rewinded)
+ *
+ * @param st an iterating straph, st->lock must be held
+ * @param nd a node of the straph
+ * @return true if the node can be launched
+ */
+static bool st_runready(straph st, node nd){
+    unsigned int i, k;
+    node p;
+    struct st_plan *plan = st->plan;
+
+    if (nd->running || nd->iter_started >= st->run_iters) return false;
+    k = nd->iter_started + 1;
+
+    for (i = plan->par_off[nd->idx]; i < plan->par_off[nd->idx+1]; i++){
+        p = plan->order[plan->par[i]];
+        if (plan->par_mode[i] == SEQ_MODE && p->iter_done < k) 
+            return false;
+        if (plan->par_mode[i] == PAR_MODE && p->iter_started < k) 
+            return false;
+    }
+
+    for (i = plan->rd_off[nd->idx]; i < plan->rd_off[nd->idx+1]; i++){
+        p = plan->order[plan->rd[i]];
+        if (p != nd && p->iter_done < k-1) return false;
+    }
+
+    return true;
+}
+
+
+
+
+
+/**
+ * @brief Launch the next iteration of a node
+ * @param st an iterating straph, st->lock must be held
+ * @param nd a node ready to be launched
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case st->run_err is set
+ */
+static int st_runlaunch(straph st, node nd){
+
+    /* Reset the node and its buffers after the previous iteration */
+    if (nd->iter_started > 0) st_nrewind(nd);
+
+    nd->iter_started++;
+    nd->running = true;
+    st->nb_running++;
+
+    if (st_nup(st, nd) == -1){
+        st_runfail(st, nd, errno);
+        return -1;
+    }
 
     return 0;
+}
 
-error:
-    lf_drop(&lf);
-    return -1;
+
+
+
+
+/**
+ * @brief Record the failed launch of an iteration of a node
+ * @param st an iterating straph, st->lock must be held
+ * @param nd a node whose launch failed
+ * @param err the error of the launch (errno)
+ */
+static void st_runfail(straph st, node nd, int err){
+    nd->iter_started--;
+    nd->running = false;
+    st->nb_running--;
+    st->run_err = err;
+    pthread_cond_broadcast(&st->cond);
+}
+
+
+
+
+
+/**
+ * @brief Launch a node if it's ready to start its next 
+ *        iteration, and its parallel children as well
+ * @param st an iterating straph, st->lock must be held
+ * @param nd a node of the straph
+ */
+static void st_runtry(straph st, node nd){
+    node ch, launched;
+    unsigned int i;
+    struct st_plan *plan = st->plan;
+
+    if (st->run_err != 0 || !st_runready(st, nd)) return;
+    if (st_runlaunch(st, nd) == -1) return;
+
+    nd->launched = NULL;
+    launched = nd;
+
+    while (launched != NULL){
+        nd = launched;
+        launched = nd->launched;
+
+        for (i = plan->adj_off[nd->idx]; i < plan->adj_off[nd->idx+1]; i++){
+            if (plan->adj_mode[i] != PAR_MODE) continue;
+
+            ch = plan->order[plan->adj[i]];
+            if (st->run_err != 0 || !st_runready(st, ch)) continue;
+            if (st_runlaunch(st, ch) == -1) return;
+
+            ch->launched = launched;
+            launched = ch;
+        }
+    }
+}
+
+
+
+
+
+/**
+ * @brief Record the termination of an iteration of a node
+ *        and launch the nodes that were waiting for it
+ * @param st an iterating straph
+ * @param nd the node that terminated
+ * @param ret value returned by the node's routine
+ */
+static void st_runnext(straph st, node nd, void *ret){
+    unsigned int i;
+    struct st_plan *plan = st->plan;
+
+    pthread_mutex_lock(&st->lock);
+
+    nd->ret = ret;
+    nd->running = false;
+    nd->iter_done++;
+    st->nb_running--;
+    st->run_left--;
+
+    /* The node itself, its children and its writers may be ready */
+    st_runtry(st, nd);
+    for (i = plan->adj_off[nd->idx]; i < plan->adj_off[nd->idx+1]; i++){
+        st_runtry(st, plan->order[plan->adj[i]]);
+    }
+    for (i = plan->wr_off[nd->idx]; i < plan->wr_off[nd->idx+1]; i++){
+        st_runtry(st, plan->order[plan->wr[i]]);
+    }
+
+    if (st->run_left == 0 || (st->run_err != 0 && st->nb_running == 0)){
+        pthread_cond_broadcast(&st->cond);
+    }
+
+    pthread_mutex_unlock(&st->lock);
+}
+
+
+
+
+
+/**
+ * @brief run a straph several times in a pipelined fashion
+ *
+ * Executes n_iterations times every node of the straph. Instead of
+ * waiting for the whole straph to terminate before running the next
+ * iteration (like st_start/st_join would), each node starts its next
+ * iteration as soon as its inputs are ready: its SEQ_MODE parents
+ * have terminated (PAR_MODE parents have started) the same iteration
+ * and the nodes reading its output buffers have consumed the previous
+ * one. Different stages of the straph thus work on different 
+ * iterations at the same time. 
+ * The value returned by the last iteration of each node is stored
+ * inside the node. The straph is rewinded before returning.
+ *
+ * @param st an inactive straph
+ * @param n_iterations number of times each node is executed
+ * @return 0 in case of success or -1 otherwise, in this
+ *         case errno is set
+ */
+int st_run(straph st, unsigned int n_iterations){
+    unsigned int i;
+    int err;
+    node nd;
+
+    if (n_iterations == 0) return 0;
+    if (st->plan == NULL && st_compile(st) == -1) return -1;
+    if (st_checkbufs(st) == -1) return -1;
+    st_rank(st);
+
+    PTH_ERRCK_NC(pthread_mutex_lock(&st->lock))
+
+    for (i = 0; i < st->plan->nb_nodes; i++){
+        nd = st->plan->order[i];
+        nd->iter_started = 0;
+        nd->iter_done = 0;
+        nd->running = false;
+    }
+
+    st->run_iters  = n_iterations;
+    st->run_left   = (size_t) st->plan->nb_nodes * n_iterations;
+    st->nb_running = 0;
+    st->run_err    = 0;
+
+    /* Launch every ready node */
+    for (i = 0; i < st->plan->nb_nodes; i++){
+        st_runtry(st, st->plan->order[i]);
+    }
+
+    /* Wait the end of the run */
+    while (st->run_left > 0 && 
+           (st->run_err == 0 || st->nb_running > 0)){
+        PTH_ERRCK(pthread_cond_wait(&st->cond, &st->lock),
+                  pthread_mutex_unlock(&st->lock);)
+    }
+
+    err = st->run_err;
+    st->run_iters = 0;
+
+    PTH_ERRCK_NC(pthread_mutex_unlock(&st->lock))
+
+    if (st_rewind(st) == -1) return -1;
+
+    if (err != 0){
+        errno = err;
+        return -1;
+    }
+
+    return 0;
 }
 
 
@@ -665,39 +2478,11 @@ error:
 int st_rewind(straph st){
 
     unsigned int i;
-    struct linked_fifo lf;
-    node nd;
-
-    lf_init(&lf);
-
-    /* Init fifo with straph's entries */
-    for (i = 0; i < st->nb_entries; i++){
-        if (lf_push(&lf, st->entries[i]) == -1){
-            lf_drop(&lf);
-            return -1;
-        }
-    }
-
-    while (1){
-        /* Pop next node */
-        if ((nd = lf_pop(&lf)) == NULL){
-            if (errno == ENOENT) break;
-            return -1;
-        }
 
-        /* Launch node */ 
-        if (st_nrewind(nd) == -1){
-            lf_drop(&lf);
-            return -1;
-        }
+    if (st->plan == NULL) return 0;
 
-        /* Collect node's neighbours */
-        for (i = 0; i < nd->nb_neigh; i++){
-            if (nd->neigh[i].n->status == INACTIVE) continue;
-            if (lf_push(&lf, nd->neigh[i].n) == -1){
-                return -1;
-            }
-        } 
+    for (i = 0; i < st->plan->nb_nodes; i++){
+        if (st_nrewind(st->plan->order[i]) == -1) return -1;
     }
 
     return 0;
@@ -726,7 +2511,8 @@ int st_nrewind(node nd){
         st_bufstat(nd,i, BUF_READY);
     }
 
-    nd->nb_startrequests = 0;
+    nd->nb_pending = (nd->nb_parents > 0) ? nd->nb_parents : 1;
+    nd->done = false;
 
     return 0;
 }
@@ -746,59 +2532,34 @@ int st_nrewind(node nd){
  *         case errno is set
  */
 int st_destroy(straph st){
-    struct linked_fifo lf1,lf2;
-    unsigned int i;
-    node nd = NULL; 
-
-    lf_init(&lf1);
-    lf_init(&lf2);
-
-    /* 
-     Collect nodes to avoid double frees (collected 
-     nodes are marked with status = DOOMED) 
-    */
-
-    
-    for (i = 0; i < st->nb_entries; i++){
-        if (lf_push(&lf1, st->entries[i]) == -1) goto error;
-    }
-    while (1){
-
-        nd = lf_pop(&lf1);
-        if (nd == NULL){
-            if (errno == ENOENT) break;
-            goto error;
-        }
+    node *nodes;
+    unsigned int i, nb;
 
-        /* Skip if already DOOMED  */ 
-        if (nd->status == DOOMED) continue;
-
-        /* Set doomed if not doomed */
-        if (lf_push(&lf2, nd) == -1) goto error;
-        nd->status = DOOMED;
-        
-        /* Collect not neighbours */
-        for (i = 0; i < nd->nb_neigh; i++){
-            if (lf_push(&lf1, nd->neigh[i].n) == -1) goto error;
-        } 
+    if (st->plan != NULL){
+        nodes = st->plan->order;
+        nb = st->plan->nb_nodes;
+    } else {
+        /* Never compiled: collect the nodes */
+        nodes = st_collect(st, &nb);
+        if (nodes == NULL && nb == 0 && st->nb_entries > 0) return -1;
     }
 
     /* Destroy collected nodes */
-    while ((nd = lf_pop(&lf2))){
-        if (st_ndestroy(nd) == -1) goto error;
+    for (i = 0; i < nb; i++){
+        if (st_ndestroy(nodes[i]) == -1) return -1;
     }
-    if (errno != ENOENT) goto error;
 
     /* Free straph */
+    if (st->plan != NULL) st_dropplan(st);
+    else free(nodes);
     free(st->entries);
+    if (st->efd != -1) close(st->efd);
+    pthread_mutex_destroy(&st->adm_lock);
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->lock);
     free(st);
     
     return 0;
-
-error:
-    lf_drop(&lf1);
-    lf_drop(&lf2);
-    return -1;
 }
 
 
@@ -816,17 +2577,18 @@ error:
  *         case errno is set
  */
 int st_ndestroy(node nd){
-    int err;
     unsigned int i;
 
     /* Destroy out bufs */
     if (nd->outslots != NULL){
         for (i = 0; i < nd->nb_outslots; i++){
         
+            free(nd->outslots[i].stage);
             if (nd->outslots[i].buf == NULL) continue;
 
             switch (nd->outslots[i].type){
-                case LIN_BUF: lb_destroy(nd->outslots[i].buf);
+                case LIN_BUF:
+                case MAP_BUF: lb_destroy(nd->outslots[i].buf);
                     break;
                 case CIR_BUF: cb_destroy(nd->outslots[i].buf);
                     break;
@@ -839,14 +2601,10 @@ int st_ndestroy(node nd){
     }
 
     free(nd->inslots);
+    free(nd->isstore);
     free(nd->neigh);
-
-    err = pthread_spin_destroy(&nd->launch_lock);
-    if (err != 0){
-        errno = err;
-        return -1;
-    }
-
+    free(nd->cpuset);
+    gr_destroy(nd->coro);
     free(nd);
 
     return 0;
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "sync.h"
+#include "green.h"
+#include "straph.h"
+
+
+/* Hint to the CPU that the thread is spinning */
+#if defined(__x86_64__) || defined(__i386__)
+#define ST_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define ST_PAUSE() __asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define ST_PAUSE() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+
+
+
+
+/**
+ * @brief Initialize a mutex
+ *
+ * A mutex shared between processes is robust: a process dying
+ * while holding it doesn't block the others (see st_lock).
+ *
+ * @param mutex mutex to initialize
+ * @param pshared true if the mutex is in memory shared between
+ *        processes (see BOPT_SHARED)
+ * @return 0 in case of success, an error number otherwise
+ */
+int st_mutexinit(pthread_mutex_t *mutex, bool pshared){
+    pthread_mutexattr_t attr;
+    int err;
+
+    if (!pshared) return pthread_mutex_init(mutex, NULL);
+
+    if ((err = pthread_mutexattr_init(&attr)) != 0) return err;
+    err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (err == 0) err = pthread_mutexattr_setrobust(&attr, 
+                                                    PTHREAD_MUTEX_ROBUST);
+    if (err == 0) err = pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    return err;
+}
+
+
+
+
+
+/**
+ * @brief Initialize a condition
+ * @param cond condition to initialize
+ * @param pshared true if the condition is in memory shared between
+ *        processes (see BOPT_SHARED)
+ * @return 0 in case of success, an error number otherwise
+ */
+int st_condinit(pthread_cond_t *cond, bool pshared){
+    pthread_condattr_t attr;
+    int err;
+
+    if (!pshared) return pthread_cond_init(cond, NULL);
+
+    if ((err = pthread_condattr_init(&attr)) != 0) return err;
+    err = pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (err == 0) err = pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return err;
+}
+
+
+
+
+
+/**
+ * @brief Recover a robust mutex whose owner died
+ *
+ * The state protected by the mutex may be half updated: *failed
+ * is set for its users to give up, then the mutex is made usable
+ * again.
+ *
+ * @param mutex mutex locked with EOWNERDEAD
+ * @param failed flag telling the state is lost
+ * @return 0 in case of success, an error number otherwise
+ */
+static int st_recover(pthread_mutex_t *mutex, unsigned int *failed){
+    __atomic_store_n(failed, 1, __ATOMIC_SEQ_CST);
+    return pthread_mutex_consistent(mutex);
+}
+
+
+
+
+
+/**
+ * @brief Lock a mutex
+ *
+ * Same as pthread_mutex_lock, except that a robust mutex whose
+ * owner died (see st_mutexinit) is recovered: *failed is set
+ * and the mutex is locked.
+ *
+ * @param mutex mutex to lock
+ * @param failed flag set if the previous owner died
+ * @return 0 in case of success, an error number otherwise
+ */
+int st_lock(pthread_mutex_t *mutex, unsigned int *failed){
+    int err = pthread_mutex_lock(mutex);
+
+    if (err == EOWNERDEAD) err = st_recover(mutex, failed);
+    return err;
+}
+
+
+
+
+
+/**
+ * @brief Wait on a condition
+ *
+ * Same as pthread_cond_wait, except that green nodes don't block 
+ * the thread carrying them: they yield and are resumed once the
+ * condition is broadcasted with st_condbroadcast. Callers must
+ * check again their predicate when the function returns. The
+ * mutex is recovered like with st_lock.
+ *
+ * @param cond condition to wait
+ * @param mutex locked mutex protecting the condition
+ * @param failed flag set if an owner of the mutex died
+ * @return 0 in case of success, an error number otherwise
+ */
+int st_condwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                unsigned int *failed){
+    int err;
+
+    if (gr_ingreen()) return gr_yield(cond, mutex);
+
+    err = pthread_cond_wait(cond, mutex);
+    if (err == EOWNERDEAD) err = st_recover(mutex, failed);
+    return err;
+}
+
+
+
+
+
+/**
+ * @brief Broadcast a condition
+ *
+ * Wakes up the threads waiting on the condition and the green
+ * nodes parked on it. The state signaled must have been updated
+ * holding the mutex associated to the condition.
+ *
+ * @param cond condition to broadcast
+ * @return 0 in case of success, an error number otherwise
+ */
+int st_condbroadcast(pthread_cond_t *cond){
+    int err = pthread_cond_broadcast(cond);
+
+    gr_wake(cond);
+    return err;
+}
+
+
+
+
+
+/**
+ * @brief Arm an event before waiting on it
+ *
+ * Shall be called before checking one last time the state
+ * awaited. If it still isn't the one expected, the caller 
+ * sleeps with st_evwait:
+ *
+ *     seq = st_evprepare(ev);
+ *     if (!awaited_state) st_evwait(ev, seq);
+ *
+ * @param ev an event
+ * @return the sequence number to give to st_evwait
+ */
+unsigned int st_evprepare(struct st_event *ev){
+    __atomic_store_n(&ev->armed, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ev->seq, __ATOMIC_SEQ_CST);
+}
+
+
+
+
+
+/**
+ * @brief Sleep until an event is signaled
+ *
+ * Green nodes yield the worker carrying them instead of
+ * blocking it. The function may return without the event
+ * being signaled.
+ *
+ * @param ev an armed event
+ * @param seq sequence number returned by st_evprepare
+ * @return 0 in case of success, an error number otherwise
+ */
+int st_evwait(struct st_event *ev, unsigned int seq){
+    if (gr_ingreen()) return gr_yieldword(&ev->seq, seq);
+
+    /* Returns at once if a signal came after st_evprepare */
+    if (syscall(SYS_futex, &ev->seq, 
+                ev->pshared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, 
+                seq, NULL, NULL, 0) == -1 &&
+        errno != EAGAIN && errno != EINTR) return errno;
+
+    return 0;
+}
+
+
+
+
+
+/**
+ * @brief Signal an event
+ *
+ * Wakes up every waiter of the event. Shall be called after
+ * updating the state awaited with a sequentially consistent 
+ * store (or stronger).
+ *
+ * @param ev an event
+ */
+void st_evsignal(struct st_event *ev){
+    if (__atomic_load_n(&ev->armed, __ATOMIC_SEQ_CST) == 0 ||
+        __atomic_exchange_n(&ev->armed, 0, __ATOMIC_SEQ_CST) == 0) return;
+
+    __atomic_add_fetch(&ev->seq, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &ev->seq, ev->pshared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+            INT_MAX, NULL, NULL, 0);
+
+    gr_wake(&ev->seq);
+}
+
+
+
+
+
+/**
+ * @brief Let some time pass before polling again an awaited state,
+ *        following a wait policy
+ *
+ * Shall be called in a loop polling the state, before falling back
+ * to a blocking wait:
+ *
+ *     round = 0;
+ *     while (!awaited_state && st_backoff(w, &round));
+ *     if (!awaited_state) ... sleep ...
+ *
+ * - WAIT_BLOCK: no polling.
+ * - WAIT_SPIN: w->spins rounds of pause.
+ * - WAIT_SPINYIELD: w->spins rounds of pause then w->spins rounds
+ *   of sched_yield.
+ * - WAIT_POLL: pause forever, the CPU is yielded every w->spins rounds
+ *   in case the thread awaited shares it.
+ *
+ * Green nodes don't yield nor poll forever: they must give back their
+ * worker to let the other nodes run, they sleep after spinning.
+ *
+ * @param w a wait policy
+ * @param round number of rounds done, set to 0 by the caller
+ *        before the first round
+ * @return true if the caller shall keep polling, false
+ *         if it shall sleep
+ */
+bool st_backoff(const struct st_waitpol *w, unsigned int *round){
+    unsigned int r = (*round)++;
+
+    switch (w->policy){
+        case WAIT_SPIN:
+            if (r >= w->spins) return false;
+            ST_PAUSE();
+            return true;
+
+        case WAIT_SPINYIELD:
+            if (r < w->spins){
+                ST_PAUSE();
+                return true;
+            }
+            if (r >= 2 * w->spins || gr_ingreen()) return false;
+            sched_yield();
+            return true;
+
+        case WAIT_POLL:
+            if (gr_ingreen()){
+                if (r >= w->spins) return false;
+                ST_PAUSE();
+            } else if (w->spins == 0 || r % w->spins == w->spins - 1){
+                sched_yield();
+            } else {
+                ST_PAUSE();
+            }
+            return true;
+    }
+
+    return false;
+}
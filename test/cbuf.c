@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_INTS  (1024*1024)
+#define SIZE_BUF 4096
+#define MAX_READERS 32
+
+/* 
+ Writes the integers from 0 to NB_INTS-1, BATCH by BATCH: 
+ the chunks don't divide the size of the buffer
+*/
+#define BATCH 5
+void* produce(node n){
+    int i, j, batch[BATCH];
+    size_t size;
+
+    for (i = 0; i < NB_INTS; i += BATCH){
+        for (j = 0; j < BATCH; j++) batch[j] = i + j;
+        size = MIN(BATCH, NB_INTS - i) * sizeof(int);
+        if (st_write(n,0,batch,size) != (ssize_t) size) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Checks the integers */
+void* consume(node n){
+    int i, j;
+    for (j = 0; j < NB_INTS; j++){
+        if (st_read(n,0,&i,sizeof(int)) != sizeof(int) || 
+            i != j) return (void*) 1;
+    }
+    return NULL;
+}
+
+/**
+ * Runs a producer and nb_readers consumers linked by a circular
+ * buffer having the option opt set to value (if opt is not -1), 
+ * returns the time taken in seconds
+ */
+double transfer(unsigned int nb_readers, pool pl, unsigned char mode,
+                int opt, size_t value){
+    straph s;
+    node w, r[MAX_READERS];
+    unsigned int i;
+    struct timespec t0, t1;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,CIR_BUF,SIZE_BUF) == -1 ||
+        st_setexec(w,mode) == -1 ||
+        st_setpool(s,pl) == -1) fail("building straph");
+    if (opt != -1 && st_bufopt(w,0,opt,value) == -1) fail("st_bufopt");
+
+    for (i = 0; i < nb_readers; i++){
+        if ((r[i] = st_makenode(consume)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1 ||
+            st_setexec(r[i],mode) == -1) fail("building straph");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (w->ret != NULL) fail("bad write");
+    for (i = 0; i < nb_readers; i++){
+        if (r[i]->ret != NULL) fail("bad read");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+/* Large writes, one chunk each */
+#define SIZE_LARGE (200*1000)
+void* producelarge(node n){
+    static char large[SIZE_LARGE];
+    int k;
+
+    for (k = 0; k < 32; k++){
+        memset(large, k, SIZE_LARGE);
+        if (st_write(n,0,large,SIZE_LARGE) != SIZE_LARGE) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Checks the large writes, read by pieces */
+void* consumelarge(node n){
+    char piece[1000];
+    int k, i, j;
+
+    for (k = 0; k < 32; k++){
+        for (i = 0; i < SIZE_LARGE; i += sizeof piece){
+            if (st_read(n,0,piece,sizeof piece) != sizeof piece) 
+                return (void*) 1;
+            for (j = 0; j < (int) sizeof piece; j++){
+                if (piece[j] != k) return (void*) 1;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Chunks larger than 64KiB */
+void large(void){
+    straph s;
+    node w, r[2];
+    int i;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(producelarge)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,CIR_BUF,1024*1024) == -1) fail("building straph");
+
+    for (i = 0; i < 2; i++){
+        if ((r[i] = st_makenode(consumelarge)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL || r[0]->ret != NULL || r[1]->ret != NULL)
+        fail("bad transfer");
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+/* The reader tells it got the data */
+int got = 0;
+
+/* Writes an int below the threshold, it is sent by st_flush */
+void* produceflush(node n){
+    int i = 42, tries;
+
+    if (st_write(n,0,&i,sizeof(int)) != sizeof(int) ||
+        st_flush(n,0) == -1) return (void*) 1;
+
+    for (tries = 0; tries < 5000; tries++){
+        if (__atomic_load_n(&got, __ATOMIC_SEQ_CST) == 1) return NULL;
+        usleep(1000);
+    }
+    return (void*) 1;
+}
+
+void* consumeflush(node n){
+    int i;
+
+    if (st_read(n,0,&i,sizeof(int)) != sizeof(int) || i != 42) 
+        return (void*) 1;
+    __atomic_store_n(&got, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+/* Data below the threshold of coalescing is published by st_flush */
+void flush(unsigned int nb_readers){
+    straph s;
+    node w, r[2];
+    unsigned int i;
+
+    got = 0;
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produceflush)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,CIR_BUF,SIZE_BUF) == -1 ||
+        st_bufopt(w,0,BOPT_MINCHUNK,1024) == -1) fail("building straph");
+
+    for (i = 0; i < nb_readers; i++){
+        if ((r[i] = st_makenode(consumeflush)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL) fail("data not flushed");
+    for (i = 0; i < nb_readers; i++){
+        if (r[i]->ret != NULL) fail("bad read");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+/* The size of a circular buffer is kept on 32 bits */
+void toolarge(void){
+    node n;
+
+    if ((n = st_makenode(NULL)) == NULL) fail("st_makenode");
+    if (st_setbuffer(n,0,CIR_BUF,(size_t) UINT_MAX + 1) != -1 ||
+        errno != EINVAL) fail("4 GiB circular buffer");
+    if (st_setbuffer(n,0,CIR_BUF,4096) == -1) fail("st_setbuffer");
+    if (st_bufsize(n,0) != 4096) fail("bad size");
+    if (st_ndestroy(n) == -1) fail("st_ndestroy");
+}
+
+int main(void){
+    pool pl;
+
+    if ((pl = st_makepool(1)) == NULL) fail("st_makepool");
+
+    /* One reader: lock-free ring */
+    printf("1 reader:  %f s\n", transfer(1, NULL, THREAD_EXEC, -1, 1));
+
+    /* Green nodes sharing a single worker must yield */
+    printf("1 reader (green): %f s\n", transfer(1, pl, GREEN_EXEC, -1, 1));
+
+    /* Several readers: chunks */
+    printf("2 readers: %f s\n", transfer(2, NULL, THREAD_EXEC, -1, 1));
+    printf("8 readers: %f s\n", transfer(8, NULL, THREAD_EXEC, -1, 1));
+
+    /* Several readers: ring with a cursor per reader */
+    printf("8 readers (broadcast): %f s\n", 
+           transfer(8, NULL, THREAD_EXEC, BOPT_BROADCAST, 1));
+    printf("32 readers (broadcast, green): %f s\n", 
+           transfer(MAX_READERS, pl, GREEN_EXEC, BOPT_BROADCAST, 1));
+
+    /* Mirrored memory: nothing wraps */
+    printf("1 reader (mirror):  %f s\n", 
+           transfer(1, NULL, THREAD_EXEC, BOPT_MIRROR, 1));
+    printf("2 readers (mirror): %f s\n", 
+           transfer(2, NULL, THREAD_EXEC, BOPT_MIRROR, 1));
+
+    /* Small writes coalesced */
+    printf("1 reader (coalescing):  %f s\n", 
+           transfer(1, NULL, THREAD_EXEC, BOPT_MINCHUNK, 512));
+    printf("2 readers (coalescing): %f s\n", 
+           transfer(2, NULL, THREAD_EXEC, BOPT_MINCHUNK, 512));
+    printf("2 readers (max chunk):  %f s\n", 
+           transfer(2, NULL, THREAD_EXEC, BOPT_MAXCHUNK, 8));
+
+    /* Space read given back chunk by chunk and by batches */
+    printf("2 readers (publish each chunk): %f s\n", 
+           transfer(2, NULL, THREAD_EXEC, BOPT_PUBCHUNKS, 1));
+    printf("2 readers (publish 64 chunks):  %f s\n", 
+           transfer(2, NULL, THREAD_EXEC, BOPT_PUBCHUNKS, 64));
+    flush(1);
+    flush(2);
+    large();
+    toolarge();
+
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    return EXIT_SUCCESS;
+}
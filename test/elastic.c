@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_INTS (256*1024)
+#define SIZE_INIT 4096
+#define SIZE_MAX_RING (64*1024)
+#define BATCH 100
+
+/* The consumers read with st_readpeek */
+int peek = 0;
+
+/* Writes the integers by batches */
+void* produce(node n){
+    int batch[BATCH];
+    int i, j;
+
+    for (i = 0; i < NB_INTS; i += BATCH){
+        for (j = 0; j < BATCH; j++) batch[j] = i + j;
+        if (st_write(n,0,batch,sizeof batch) != sizeof batch) 
+            return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Checks the integers, taking a nap from time to time */
+void* consume(node n){
+    const int *view;
+    size_t len;
+    int i, j;
+
+    for (i = 0; i < NB_INTS + BATCH - 1 - (NB_INTS - 1) % BATCH; i++){
+        if (i % 20000 == 0) usleep(2000);
+
+        if (peek){
+            if (st_readpeek(n,0,(const void**) &view,&len) == -1 ||
+                len < sizeof(int)) return (void*) 1;
+            j = view[0];
+            if (st_readconsume(n,0,sizeof(int)) == -1) return (void*) 1;
+        } else if (st_read(n,0,&j,sizeof(int)) != sizeof(int)){
+            return (void*) 1;
+        }
+        if (i != j) return (void*) 1;
+    }
+    return NULL;
+}
+
+/**
+ * Runs a producer and nb_readers slow consumers linked by an 
+ * elastic ring having the option opt set (if not -1), twice. 
+ * Returns the size reached by the ring
+ */
+size_t transfer(unsigned int nb_readers, int opt){
+    straph s;
+    node w, r[2];
+    unsigned int i, run;
+    ssize_t size;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,CIR_BUF,SIZE_INIT) == -1) fail("building straph");
+
+    for (i = 0; i < nb_readers; i++){
+        if ((r[i] = st_makenode(consume)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+
+    if ((opt != -1 && st_bufopt(w,0,opt,1) == -1) ||
+        st_bufopt(w,0,BOPT_ELASTIC,SIZE_MAX_RING) == -1 ||
+        st_bufopt(w,0,BOPT_GROWWAIT,100) == -1 ||
+        st_bufopt(w,0,BOPT_SHRINK,1) == -1) fail("st_bufopt");
+
+    /* Twice: the ring shrinks at the end of the first run */
+    for (run = 0; run < 2; run++){
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+
+        if (w->ret != NULL) fail("bad write");
+        for (i = 0; i < nb_readers; i++){
+            if (r[i]->ret != NULL) fail("bad read");
+        }
+    }
+
+    /* Grown but not beyond the cap */
+    if ((size = st_bufsize(w,0)) == -1) fail("st_bufsize");
+    if (size <= SIZE_INIT || size > SIZE_MAX_RING) fail("bad size");
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    return size;
+}
+
+int main(void){
+    straph s;
+    node n;
+
+    printf("1 reader:  %zu bytes\n", transfer(1, -1));
+    printf("2 readers: %zu bytes\n", transfer(2, -1));
+    printf("2 readers (mirror): %zu bytes\n", transfer(2, BOPT_MIRROR));
+    peek = 1;
+    printf("2 readers (peek):   %zu bytes\n", transfer(2, -1));
+
+    /* The cap can't be below the size of the buffer, nor 4 GiB */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((n = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, n) == -1 ||
+        st_setbuffer(n,0,CIR_BUF,SIZE_INIT) == -1) fail("building straph");
+    if (st_bufopt(n,0,BOPT_ELASTIC,SIZE_INIT-1) != -1 || errno != EINVAL)
+        fail("bad cap accepted");
+    if (st_bufopt(n,0,BOPT_ELASTIC,(size_t) UINT_MAX + 1) != -1 || 
+        errno != EINVAL) fail("4 GiB cap accepted");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_PARENTS 8
+#define NB_RUNS    500
+
+/* Released once every parent is there: they all terminate at once */
+pthread_barrier_t barrier;
+
+/* Number of times the child started */
+unsigned int started;
+
+void* parent(node n){
+    (void) n;
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+void* child(node n){
+    (void) n;
+    __atomic_add_fetch(&started, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+/**
+ * Runs NB_PARENTS nodes terminating together, all of them 
+ * parents of a same node, which must start once per run
+ * @param pl pool running the nodes, NULL for threads
+ * @param mode run mode of the edges
+ */
+void fanin(pool pl, unsigned char mode){
+    straph s;
+    node p, c;
+    unsigned int i, run;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if (pl != NULL && st_setpool(s, pl) == -1) fail("st_setpool");
+    if ((c = st_makenode(child)) == NULL) fail("st_makenode");
+    for (i = 0; i < NB_PARENTS; i++){
+        if ((p = st_makenode(parent)) == NULL) fail("st_makenode");
+        if (st_addnode(s, p) == -1 || 
+            st_nlink(p,c,mode) == -1) fail("building straph");
+    }
+
+    started = 0;
+    for (run = 0; run < NB_RUNS; run++){
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+        if (started != run + 1){
+            fprintf(stderr, "Started %u times in %u runs\n", started, run+1);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+int main(void){
+    pool pl;
+
+    if (pthread_barrier_init(&barrier, NULL, NB_PARENTS) != 0)
+        fail("pthread_barrier_init");
+
+    fanin(NULL, SEQ_MODE);
+    fanin(NULL, PAR_MODE);
+
+    if ((pl = st_makepool(NB_PARENTS)) == NULL) fail("st_makepool");
+    fanin(pl, SEQ_MODE);
+    fanin(pl, PAR_MODE);
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    pthread_barrier_destroy(&barrier);
+    printf("%d parents, %d runs: OK\n", NB_PARENTS, NB_RUNS);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_NODES 2000
+#define NB_RUNS  5
+#define NB_MSGS  100000
+#define SMALLSTACK (64*1024)
+
+/* Set once the pair of green nodes is done */
+unsigned int go;
+
+void* first(node n){
+    int i = 0;
+    st_write(n,0,&i,sizeof(int));
+    return NULL;
+}
+
+/* Waits for the previous node: all the chain is running at once */
+void* increment(node n){
+    int i = -1;
+    if (st_read(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    i++;
+    st_write(n,0,&i,sizeof(int));
+    return (void*)(long) i;
+}
+
+/* Sends the integers through a small ring */
+void* ping(node n){
+    int i;
+    for (i = 0; i < NB_MSGS; i++){
+        if (st_write(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Receives the integers, then releases the idle nodes */
+void* pong(node n){
+    int i, val;
+    for (i = 0; i < NB_MSGS; i++){
+        if (st_read(n,0,&val,sizeof(int)) != sizeof(int) || val != i){
+            __atomic_store_n(&go, 1, __ATOMIC_SEQ_CST);
+            return (void*) 1;
+        }
+    }
+    __atomic_store_n(&go, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+/* Feeds the idle nodes once the pair is done */
+void* release(node n){
+    unsigned int i;
+    int val = 1;
+
+    while (__atomic_load_n(&go, __ATOMIC_SEQ_CST) == 0) usleep(1000);
+    for (i = 0; i < NB_NODES; i++){
+        if (st_write(n,i,&val,sizeof(int)) != sizeof(int)) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Stays parked on its own buffer until released */
+void* idle(node n){
+    int val;
+    if (st_read(n,0,&val,sizeof(int)) != sizeof(int)) return (void*) 1;
+    return NULL;
+}
+
+/**
+ * Runs a pair of green nodes while many others are parked on
+ * unrelated buffers: the pair only wakes itself up
+ */
+void parkedpair(void){
+    unsigned int i;
+    pool pl;
+    straph s;
+    node rel, p, q, nd[NB_NODES];
+    struct timespec start, end;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((pl = st_makepool(2)) == NULL) fail("st_makepool");
+    if (st_setpool(s, pl) == -1) fail("st_setpool");
+
+    if ((rel = st_makenode(release)) == NULL ||
+        (p = st_makenode(ping)) == NULL ||
+        (q = st_makenode(pong)) == NULL) fail("st_makenode");
+    if (st_addnode(s, rel) == -1 || st_addnode(s, p) == -1 ||
+        st_setexec(p, GREEN_EXEC) == -1 ||
+        st_setexec(q, GREEN_EXEC) == -1 ||
+        st_setbuffer(p,0,CIR_BUF,16*sizeof(int)) == -1 ||
+        st_nlink(p,q,PAR_MODE) == -1 ||
+        st_addflow(p,0,q,0) == -1) fail("pair");
+
+    /* The buffers first: the flows point to them */
+    if (st_setbuffer(rel,NB_NODES-1,LIN_BUF,sizeof(int)) == -1)
+        fail("st_setbuffer");
+    for (i = 0; i < NB_NODES; i++){
+        if ((nd[i] = st_makenode(idle)) == NULL) fail("st_makenode");
+        if (st_setexec(nd[i], GREEN_EXEC) == -1 ||
+            st_setbuffer(rel,i,LIN_BUF,sizeof(int)) == -1 ||
+            st_nlink(rel,nd[i],PAR_MODE) == -1 ||
+            st_addflow(rel,i,nd[i],0) == -1) fail("idle nodes");
+    }
+
+    go = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (st_start(s) == -1) fail("st_start");
+    if (st_join(s) == -1) fail("st_join");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (rel->ret != NULL || p->ret != NULL || q->ret != NULL)
+        fail("bad transfer");
+    for (i = 0; i < NB_NODES; i++){
+        if (nd[i]->ret != NULL) fail("bad idle node");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    printf("%d messages beside %d parked nodes: %.3f s\n", NB_MSGS,
+           NB_NODES, (end.tv_sec - start.tv_sec)
+                     + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+/* Uses about depth KiB of stack */
+int deep(int depth){
+    volatile char frame[1024];
+
+    frame[0] = depth;
+    if (depth == 0) return frame[0];
+    return deep(depth - 1) + frame[0];
+}
+
+/* Uses half of a small stack */
+void* shallow(node n){
+    (void) n;
+    deep(SMALLSTACK / 2048);
+    return NULL;
+}
+
+/* Uses twice a small stack */
+void* overflow(node n){
+    (void) n;
+    deep(SMALLSTACK / 512);
+    return NULL;
+}
+
+/**
+ * Runs a green node with a small stack, in a child process
+ * @param entry routine of the node
+ * @return the status of the child
+ */
+int smallstack(void* (*entry)(node)){
+    pool pl;
+    straph s;
+    node nd;
+    pid_t pid;
+    int status;
+
+    fflush(NULL);
+    if ((pid = fork()) == -1) fail("fork");
+    if (pid == 0){
+        if ((s = st_create()) == NULL) fail("st_create");
+        if ((pl = st_makepool(1)) == NULL) fail("st_makepool");
+        if ((nd = st_makenode(entry)) == NULL) fail("st_makenode");
+        if (st_setpool(s, pl) == -1 || st_addnode(s, nd) == -1 ||
+            st_setexec(nd, GREEN_EXEC) == -1 ||
+            st_setstacksize(nd, SMALLSTACK) == -1) fail("building straph");
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+        _exit(nd->ret == NULL ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (waitpid(pid, &status, 0) == -1) fail("waitpid");
+    return status;
+}
+
+int main(void){
+    int i, r;
+    pool pl;
+    straph s;
+    node prev, nd;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((pl = st_makepool(2)) == NULL) fail("st_makepool");
+    if (st_setpool(s, pl) == -1) fail("st_setpool");
+
+    /* A chain of nodes running in parallel, much longer than the pool */
+    if ((prev = st_makenode(first)) == NULL) fail("st_makenode");
+    if (st_addnode(s, prev) == -1 ||
+        st_setbuffer(prev,0,LIN_BUF,sizeof(int)) == -1) fail("first node");
+
+    for (i = 1; i < NB_NODES; i++){
+        if ((nd = st_makenode(increment)) == NULL) fail("st_makenode");
+        if (st_setexec(nd, GREEN_EXEC) == -1 ||
+            st_setbuffer(nd,0,LIN_BUF,sizeof(int)) == -1 ||
+            st_nlink(prev,nd,PAR_MODE) == -1 ||
+            st_addflow(prev,0,nd,0) == -1) fail("chain");
+        prev = nd;
+    }
+
+    for (r = 0; r < NB_RUNS; r++){
+        if (st_start(s) == -1) fail("st_start");
+        if (st_join(s) == -1) fail("st_join");
+        if ((long) prev->ret != NB_NODES-1){
+            fprintf(stderr, "Got %ld\n", (long) prev->ret);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    printf("%d green nodes\n", NB_NODES);
+
+    parkedpair();
+
+    /* An overflow of the stack faults on its guard page */
+    if ((nd = st_makenode(first)) == NULL) fail("st_makenode");
+    if (st_setstacksize(nd, 1) != -1 || errno != EINVAL) 
+        fail("tiny stack");
+    if (st_ndestroy(nd) == -1) fail("st_ndestroy");
+    r = smallstack(shallow);
+    if (!WIFEXITED(r) || WEXITSTATUS(r) != EXIT_SUCCESS) 
+        fail("small stack");
+    r = smallstack(overflow);
+    if (!WIFSIGNALED(r) || WTERMSIG(r) != SIGSEGV) fail("overflow");
+    printf("Stacks: OK\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_RUNS 50
+
+static int go = 0;
+
+/* Waits until the main thread lets it go */
+void* nodewait(node n){
+    (void) n;
+    while (__atomic_load_n(&go, __ATOMIC_SEQ_CST) == 0) usleep(100);
+    return NULL;
+}
+
+void* nodenop(node n){
+    (void) n;
+    return NULL;
+}
+
+static unsigned int ran = 0;
+
+/* Counts its runs */
+void* nodecount(node n){
+    (void) n;
+    __atomic_add_fetch(&ran, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+/* Pins a node on a cpu which doesn't exist: its thread can't start */
+void badaffinity(node n){
+    cpu_set_t *set = CPU_ALLOC(1024);
+    size_t size = CPU_ALLOC_SIZE(1024);
+
+    if (set == NULL) fail("CPU_ALLOC");
+    CPU_ZERO_S(size, set);
+    CPU_SET_S(1000, size, set);
+    if (st_setaffinity(n, size, set) == -1) fail("st_setaffinity");
+    CPU_FREE(set);
+}
+
+/**
+ * Nodes failing to launch: the run completes without them
+ * nor the nodes after them, the error comes with st_join
+ */
+void failedlaunch(void){
+    straph s;
+    node n[4];
+    unsigned int i;
+
+    /* n0 -SEQ-> n1 (fails) -SEQ-> n2, n0 -SEQ-> n3 */
+    if ((s = st_create()) == NULL) fail("st_create");
+    for (i = 0; i < 4; i++){
+        if ((n[i] = st_makenode(nodecount)) == NULL) fail("st_makenode");
+        if (st_setexec(n[i], THREAD_EXEC) == -1) fail("st_setexec");
+    }
+    if (st_addnode(s, n[0]) == -1 ||
+        st_nlink(n[0],n[1],SEQ_MODE) == -1 ||
+        st_nlink(n[1],n[2],SEQ_MODE) == -1 ||
+        st_nlink(n[0],n[3],SEQ_MODE) == -1) fail("building straph");
+    badaffinity(n[1]);
+
+    ran = 0;
+    if (st_start(s) == -1) fail("st_start");
+    if (st_waitany(&s, 1, -1) != 0) fail("st_waitany");
+    if (st_join(s) != -1 || errno != EINVAL) fail("error not reported");
+    if (ran != 2) fail("bad nodes run");
+
+    /* Nothing left behind */
+    if (st_setaffinity(n[1], 0, NULL) == -1) fail("st_setaffinity");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (ran != 6) fail("bad nodes run");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    /* Failing when admitted, the place goes to the next node */
+    if ((s = st_create()) == NULL) fail("st_create");
+    for (i = 0; i < 3; i++){
+        if ((n[i] = st_makenode(nodecount)) == NULL) fail("st_makenode");
+        if (st_addnode(s, n[i]) == -1) fail("st_addnode");
+    }
+    if (st_setmaxparallel(s, 1) == -1) fail("st_setmaxparallel");
+    badaffinity(n[1]);
+
+    ran = 0;
+    if (st_start(s) == -1) fail("st_start");
+    if (st_join(s) != -1 || errno != EINVAL) fail("error not reported");
+    if (ran != 2) fail("bad nodes run");
+
+    badaffinity(n[0]);
+    if (st_setaffinity(n[1], 0, NULL) == -1) fail("st_setaffinity");
+    if (st_start(s) == -1) fail("st_start");
+    if (st_join(s) != -1 || errno != EINVAL) fail("error not reported");
+    if (ran != 4) fail("bad nodes run");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    /* 
+     Failing once admitted from the queue: n0 -PAR-> n2 and 
+     n1 (queued, fails) -PAR-> n2, n2 never gets the request of n1
+    */
+    if ((s = st_create()) == NULL) fail("st_create");
+    for (i = 0; i < 3; i++){
+        if ((n[i] = st_makenode(nodecount)) == NULL) fail("st_makenode");
+    }
+    if (st_addnode(s, n[0]) == -1 || st_addnode(s, n[1]) == -1 ||
+        st_nlink(n[0],n[2],PAR_MODE) == -1 ||
+        st_nlink(n[1],n[2],PAR_MODE) == -1 ||
+        st_setmaxparallel(s, 1) == -1) fail("building straph");
+    badaffinity(n[1]);
+
+    ran = 0;
+    if (st_start(s) == -1) fail("st_start");
+    if (st_join(s) != -1 || errno != EINVAL) fail("error not reported");
+    if (ran != 1) fail("bad nodes run");
+
+    if (st_setaffinity(n[1], 0, NULL) == -1) fail("st_setaffinity");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (ran != 4) fail("bad nodes run");
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+/* Straph of two nodes: a waiting node followed by a quick one */
+straph makestraph(pool pl, node *first){
+    straph s;
+    node n1, n2;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    n1 = st_makenode(nodewait);
+    n2 = st_makenode(nodenop);
+    if (n1 == NULL || n2 == NULL) fail("st_makenode");
+
+    if (st_addnode(s, n1) == -1 ||
+        st_nlink(n1,n2,SEQ_MODE) == -1 ||
+        st_setpool(s, pl) == -1) fail("building straph");
+
+    *first = n1;
+    return s;
+}
+
+int main(void){
+    pool pl;
+    straph s[2];
+    node n[2];
+    struct pollfd pfd;
+    int i, idx;
+
+    if ((pl = st_makepool(2)) == NULL) fail("st_makepool");
+    s[0] = makestraph(NULL, &n[0]);
+    s[1] = makestraph(pl, &n[1]);
+
+    /* Running straphs can't be joined */
+    if (st_start(s[0]) == -1 || st_start(s[1]) == -1) fail("st_start");
+    if (st_tryjoin(s[0]) != -1 || errno != EBUSY) fail("st_tryjoin");
+    if (st_waitany(s, 2, 0) != -1 || errno != ETIMEDOUT) fail("st_waitany");
+    if (st_ndone(n[0]) || st_ndone(n[1])) fail("st_ndone");
+
+    pfd.fd = st_fd(s[1]);
+    pfd.events = POLLIN;
+    if (pfd.fd == -1) fail("st_fd");
+    if (poll(&pfd, 1, 0) != 0) fail("fd readable too early");
+
+    __atomic_store_n(&go, 1, __ATOMIC_SEQ_CST);
+
+    /* Both terminate: join them as they come */
+    for (i = 0; i < 2; i++){
+        if ((idx = st_waitany(s, 2, -1)) == -1) fail("st_waitany");
+        if (!st_ndone(n[idx])) fail("st_ndone");
+        if (st_tryjoin(s[idx]) == -1) fail("st_tryjoin");
+        if (st_tryjoin(s[idx]) != -1 || errno != EBUSY) 
+            fail("joined twice");
+    }
+
+    /* Joined: the fd is not readable anymore */
+    if (poll(&pfd, 1, 0) != 0) fail("fd still readable");
+
+    /* Drive both straphs through their fds */
+    for (i = 0; i < NB_RUNS; i++){
+        if (st_start(s[0]) == -1 || st_start(s[1]) == -1) fail("st_start");
+        if (poll(&pfd, 1, -1) != 1) fail("poll");
+        if (st_tryjoin(s[1]) == -1) fail("st_tryjoin");
+        if (st_join(s[0]) == -1) fail("st_join");
+    }
+
+    /* A closed fd is reported, not waited for */
+    close(st_fd(s[0]));
+    errno = 0;
+    if (st_waitany(s, 1, -1) != -1 || errno != EBADF) fail("closed fd");
+
+    if (st_destroy(s[0]) == -1 || st_destroy(s[1]) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    failedlaunch();
+
+    printf("%d runs\n", NB_RUNS);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+/* More than the windows dropped at once (BM_DROPSIZE) */
+#define NB_BYTES (40*1024*1024 + 123)
+#define BATCH 4096
+
+/* Writes the bytes i % 251, BATCH by BATCH */
+void* produce(node n){
+    unsigned char batch[BATCH];
+    size_t i, j, size;
+
+    for (i = 0; i < NB_BYTES; i += BATCH){
+        size = MIN(BATCH, NB_BYTES - i);
+        for (j = 0; j < size; j++) batch[j] = (i + j) % 251;
+        if (st_write(n,0,batch,size) != (ssize_t) size) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Writes nothing: the data comes from a file */
+void* nothing(node n){
+    char c = 0;
+
+    if (st_write(n,0,&c,1) != -1) return (void*) 1;
+    return NULL;
+}
+
+/* Checks the bytes, read by pieces of variable size */
+void* consume(node n){
+    unsigned char piece[1000];
+    size_t i, j, size;
+
+    for (i = 0; i < NB_BYTES; i += size){
+        size = MIN(1 + i % 1000, NB_BYTES - i);
+        if (st_read(n,0,piece,size) != (ssize_t) size) return (void*) 1;
+        for (j = 0; j < size; j++){
+            if (piece[j] != (i + j) % 251) return (void*) 1;
+        }
+    }
+
+    /* Nothing more */
+    if (st_read(n,0,piece,1) != 0) return (void*) 1;
+    return NULL;
+}
+
+/* Checks the bytes directly into the file */
+void* consumepeek(node n){
+    const unsigned char *view;
+    size_t i, j, len;
+
+    for (i = 0; i < NB_BYTES; i += len){
+        if (st_readpeek(n,0,(const void**) &view,&len) == -1 || len == 0)
+            return (void*) 1;
+        len = MIN(len, 5000);
+        for (j = 0; j < len; j++){
+            if (view[j] != (i + j) % 251) return (void*) 1;
+        }
+        if (st_readconsume(n,0,len) == -1) return (void*) 1;
+    }
+
+    if (st_readpeek(n,0,(const void**) &view,&len) == -1 || len != 0)
+        return (void*) 1;
+    return NULL;
+}
+
+/**
+ * Runs a writer and two readers linked by a MAP_BUF,
+ * the file is kept at path if path is not NULL
+ */
+void transfer(const char *path){
+    straph s;
+    node w, r[2];
+    unsigned int i;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL ||
+        (r[0] = st_makenode(consume)) == NULL ||
+        (r[1] = st_makenode(consumepeek)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,MAP_BUF,2*NB_BYTES) == -1) fail("building straph");
+    if (path != NULL && st_bufretain(w,0,path) == -1) fail("st_bufretain");
+    for (i = 0; i < 2; i++){
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL) fail("bad write");
+    if (r[0]->ret != NULL || r[1]->ret != NULL) fail("bad read");
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+/**
+ * Makes the mappings of more than size bytes fail
+ * @param size Size of the mappings still possible
+ * @param lim Where to store the limit to restore
+ */
+void limitmaps(size_t size, struct rlimit *lim){
+    struct rlimit newlim;
+    unsigned long pages;
+    FILE *f;
+
+    if ((f = fopen("/proc/self/statm", "r")) == NULL) fail("fopen");
+    if (fscanf(f, "%lu", &pages) != 1) fail("fscanf");
+    fclose(f);
+
+    if (getrlimit(RLIMIT_AS, lim) == -1) fail("getrlimit");
+    newlim.rlim_cur = pages * sysconf(_SC_PAGESIZE) + size;
+    newlim.rlim_max = lim->rlim_max;
+    if (setrlimit(RLIMIT_AS, &newlim) == -1) fail("setrlimit");
+}
+
+/* A file is kept as it was when it can't be mapped */
+void failedretain(const char *path){
+    struct rlimit lim;
+    struct stat st;
+    node w;
+    int fd;
+
+    if ((fd = open(path, O_WRONLY | O_TRUNC)) == -1) fail("open");
+    if (write(fd, "data", 4) != 4) fail("write");
+    close(fd);
+
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_setbuffer(w,0,MAP_BUF,2*NB_BYTES) == -1) fail("st_setbuffer");
+
+    limitmaps(NB_BYTES, &lim);
+    if (st_bufretain(w,0,path) != -1) fail("mapping not limited");
+    if (setrlimit(RLIMIT_AS, &lim) == -1) fail("setrlimit");
+    if (stat(path, &st) == -1) fail("stat");
+    if (st.st_size != 4) fail("file truncated");
+
+    /* A file created for the buffer is removed */
+    unlink(path);
+    limitmaps(NB_BYTES, &lim);
+    if (st_bufretain(w,0,path) != -1) fail("mapping not limited");
+    if (setrlimit(RLIMIT_AS, &lim) == -1) fail("setrlimit");
+    if (stat(path, &st) != -1 || errno != ENOENT) fail("file left");
+
+    if (st_ndestroy(w) == -1) fail("st_ndestroy");
+}
+
+int main(void){
+    char path[] = "/tmp/straph-mapfile.XXXXXX";
+    struct stat st;
+    straph s;
+    node w, r;
+    int fd;
+
+    /* Anonymous file */
+    transfer(NULL);
+
+    /* Kept file, holding exactly the data */
+    if ((fd = mkstemp(path)) == -1) fail("mkstemp");
+    close(fd);
+    transfer(path);
+    if (stat(path, &st) == -1) fail("stat");
+    if (st.st_size != NB_BYTES) fail("bad file size");
+
+    /* Read again by another straph, without writer */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(nothing)) == NULL ||
+        (r = st_makenode(consume)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,MAP_BUF,1) == -1 ||
+        st_bufopen(w,0,path) == -1 ||
+        st_nlink(w,r,SEQ_MODE) == -1 ||
+        st_addflow(w,0,r,0) == -1) fail("building straph");
+    if (st_bufsize(w,0) != NB_BYTES) fail("bad size");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL) fail("file written");
+    if (r->ret != NULL) fail("bad read");
+
+    /* A file that can't be mapped leaves the buffer as it was */
+    if (st_bufopen(w,0,"/tmp") != -1) fail("directory mapped");
+    if (st_bufsize(w,0) != NB_BYTES) fail("bad size");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL) fail("file written");
+    if (r->ret != NULL) fail("bad read");
+
+    failedretain(path);
+
+    /* Only MAP_BUF maps files */
+    if (st_setbuffer(w,0,LIN_BUF,16) == -1) fail("st_setbuffer");
+    if (st_bufretain(w,0,path) != -1 || errno != EINVAL)
+        fail("file kept by a LIN_BUF");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    unlink(path);
+
+    printf("Mapped files: OK\n");
+
+    return EXIT_SUCCESS;
+}
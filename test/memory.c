@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_BYTES (256*1024)
+#define SIZE_BUF (64*1024)
+#define BATCH 1000
+
+/* Writes the bytes i % 251, BATCH by BATCH */
+void* produce(node n){
+    unsigned char batch[BATCH];
+    size_t i, j, size;
+
+    for (i = 0; i < NB_BYTES; i += BATCH){
+        size = MIN(BATCH, NB_BYTES - i);
+        for (j = 0; j < size; j++) batch[j] = (i + j) % 251;
+        if (st_write(n,0,batch,size) != (ssize_t) size) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Checks the bytes, read by pieces of variable size */
+void* consume(node n){
+    unsigned char piece[100];
+    size_t i, j, size;
+
+    for (i = 0; i < NB_BYTES; i += size){
+        size = MIN(1 + i % 100, NB_BYTES - i);
+        if (st_read(n,0,piece,size) != (ssize_t) size) return (void*) 1;
+        for (j = 0; j < size; j++){
+            if (piece[j] != (i + j) % 251) return (void*) 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Transfers NB_BYTES through a buffer with the given memory options
+ * @param type Type of the buffer
+ * @param mirror true to mirror a circular buffer
+ * @param flags Memory options (BMEM_*)
+ * @return false if the options are not allowed by the system
+ */
+bool transfer(unsigned char type, bool mirror, int flags){
+    straph s;
+    node w, r;
+    size_t size, sizemirror;
+    unsigned int run;
+
+    /* A linear buffer holds all the data */
+    size = type == LIN_BUF ? NB_BYTES : SIZE_BUF - 100;
+    sizemirror = flags & BMEM_HUGETLB ? 2*1024*1024 : SIZE_BUF;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL ||
+        (r = st_makenode(consume)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,type,size) == -1 ||
+        st_nlink(w,r,PAR_MODE) == -1 ||
+        st_addflow(w,0,r,0) == -1) fail("building straph");
+    if (mirror && st_bufopt(w,0,BOPT_MIRROR,1) == -1) fail("st_bufopt");
+
+    if (st_bufopt(w,0,BOPT_MEMORY,flags) == -1){
+        /* Locked memory is limited by RLIMIT_MEMLOCK */
+        if ((flags & BMEM_LOCK) == 0 ||
+            (errno != EPERM && errno != ENOMEM && errno != EAGAIN))
+            fail("st_bufopt");
+        if (st_destroy(s) == -1) fail("st_destroy");
+        return false;
+    }
+
+    for (run = 0; run < 2; run++){
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+        if (w->ret != NULL) fail("bad write");
+        if (r->ret != NULL) fail("bad read");
+
+        /* Same type and size: the memory is kept, still mirrored */
+        if (st_setbuffer(w,0,type,size) == -1) fail("st_setbuffer");
+        if (mirror && st_bufsize(w,0) != (ssize_t) sizemirror) 
+            fail("buffer not reused");
+    }
+
+    /* Another size needs another buffer (unless mirrored in the same) */
+    if (st_setbuffer(w,0,type,size * 2) == -1) fail("st_setbuffer");
+    if (!mirror && st_bufsize(w,0) != (ssize_t) size * 2) 
+        fail("buffer reused");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL || r->ret != NULL) fail("bad transfer");
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    return true;
+}
+
+int main(void){
+    int flags[] = {0, BMEM_HUGE, BMEM_PREFAULT, BMEM_HUGETLB,
+                   BMEM_HUGE | BMEM_PREFAULT, BMEM_PREFAULT | BMEM_LOCK};
+    unsigned int i;
+    straph s;
+    node w;
+
+    for (i = 0; i < sizeof(flags) / sizeof(int); i++){
+        if (transfer(LIN_BUF, false, flags[i]) == false){
+            printf("Memory options %#x: not allowed\n", flags[i]);
+            continue;
+        }
+        transfer(CIR_BUF, false, flags[i]);
+        transfer(CIR_BUF, true, flags[i]);
+        printf("Memory options %#x: OK\n", flags[i]);
+    }
+
+    /* Unknown options */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,CIR_BUF,SIZE_BUF) == -1) fail("building straph");
+    if (st_bufopt(w,0,BOPT_MEMORY,0x10) != -1 || errno != EINVAL)
+        fail("bad option accepted");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    printf("Memory: OK\n");
+
+    return EXIT_SUCCESS;
+}
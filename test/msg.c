@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_MSGS  20000
+#define SMALL    64         /* Size of the buffers of the readers */
+#define LARGE    (100*1000) /* Larger than MAX_CKDATASIZE */
+#define SIZE_BUF 4096
+
+/* 
+ Size of the message k: mostly small messages (some empty), 
+ every 1000th message is LARGE
+*/
+size_t msgsize(int k){
+    return (k % 1000 == 999) ? LARGE : k % SMALL;
+}
+
+/* 
+ Writes the messages, the bytes of the message k are all 
+ equal to k % 256. Half of them are built in place.
+*/
+void* produce(node n){
+    static char large[LARGE];
+    char *msg;
+    size_t size;
+    int k;
+
+    for (k = 0; k < NB_MSGS; k++){
+        size = msgsize(k);
+        if (k % 2){
+            if ((msg = st_writereserve(n,0,size)) == NULL) return (void*) 1;
+            memset(msg, k % 256, size);
+            if (st_writecommit(n,0,size) != (ssize_t) size) return (void*) 1;
+        } else {
+            memset(large, k % 256, size);
+            if (st_write(n,0,large,size) != (ssize_t) size) return (void*) 1;
+        }
+    }
+    return NULL;
+}
+
+/* Checks the content of a message */
+int checkmsg(const char *msg, ssize_t size, int k){
+    ssize_t i;
+
+    if (size != (ssize_t) msgsize(k)) return -1;
+    for (i = 0; i < size; i++){
+        if (msg[i] != (char) (k % 256)) return -1;
+    }
+    return 0;
+}
+
+/* Reads the messages one by one, the large ones don't fit */
+void* consume(node n){
+    static __thread char large[LARGE];
+    char small[SMALL];
+    ssize_t size;
+    int k;
+
+    for (k = 0; k < NB_MSGS; k++){
+        size = st_readmsg(n,0,small,SMALL);
+        if (size == -1){
+            if (errno != EMSGSIZE || st_msgsize(n,0) != LARGE) 
+                return (void*) 1;
+            size = st_readmsg(n,0,large,LARGE);
+            if (checkmsg(large, size, k) == -1) return (void*) 1;
+        } else if (checkmsg(small, size, k) == -1){
+            return (void*) 1;
+        }
+    }
+
+    /* Every message was read */
+    if (st_readmsg(n,0,small,SMALL) != -1 || errno != ENODATA) 
+        return (void*) 1;
+    return NULL;
+}
+
+/* Reads the messages by batches */
+void* consumev(node n){
+    static __thread char bufs[8][LARGE];
+    struct iovec iov[8];
+    ssize_t nb, i;
+    int k;
+
+    for (k = 0; k < NB_MSGS; k += nb){
+        for (i = 0; i < 8; i++){
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len  = LARGE;
+        }
+
+        if ((nb = st_readmsgv(n,0,iov,8)) <= 0) return (void*) 1;
+        for (i = 0; i < nb; i++){
+            if (checkmsg(iov[i].iov_base, iov[i].iov_len, k+i) == -1)
+                return (void*) 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Runs a producer and nb_readers consumers (alternating single and 
+ * batched reads) linked by a circular buffer in message mode
+ */
+void transfer(unsigned int nb_readers, bool mirror){
+    straph s;
+    node w, r[4];
+    unsigned int i;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,CIR_BUF,SIZE_BUF) == -1 ||
+        st_bufopt(w,0,BOPT_MIRROR,mirror) == -1 ||
+        st_bufopt(w,0,BOPT_MESSAGE,1) == -1 ||
+        st_setexec(w,THREAD_EXEC) == -1) fail("building straph");
+
+    for (i = 0; i < nb_readers; i++){
+        r[i] = st_makenode(i % 2 ? consumev : consume);
+        if (r[i] == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1 ||
+            st_setexec(r[i],THREAD_EXEC) == -1) fail("building straph");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+
+    if (w->ret != NULL) fail("bad write");
+    for (i = 0; i < nb_readers; i++){
+        if (r[i]->ret != NULL) fail("bad read");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+int main(void){
+
+    transfer(1, false);
+    transfer(2, false);
+    transfer(4, true);
+
+    printf("Messages: OK\n");
+
+    return EXIT_SUCCESS;
+}
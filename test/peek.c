@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_BYTES (1024*1024)
+#define BATCH 37
+
+/* Writes the bytes i % 251, BATCH by BATCH */
+void* produce(node n){
+    unsigned char batch[BATCH];
+    size_t i, j, size;
+
+    for (i = 0; i < NB_BYTES; i += BATCH){
+        size = MIN(BATCH, NB_BYTES - i);
+        for (j = 0; j < size; j++) batch[j] = (i + j) % 251;
+        if (st_write(n,0,batch,size) != (ssize_t) size) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* 
+ Checks the bytes directly into the buffer, consuming 
+ a part of each view only. A few reads go through st_read.
+*/
+void* consume(node n){
+    const unsigned char *view;
+    unsigned char c;
+    size_t i, j, len;
+
+    i = 0;
+    while (i < NB_BYTES){
+        if (i % 1000 == 0){
+            if (st_read(n,0,&c,1) != 1 || c != i % 251) return (void*) 1;
+            i++;
+            continue;
+        }
+
+        if (st_readpeek(n,0,(const void**) &view,&len) == -1 || 
+            len == 0) return (void*) 1;
+
+        len = MIN(len, 1 + i % 13);
+        for (j = 0; j < len; j++){
+            if (view[j] != (i + j) % 251) return (void*) 1;
+        }
+        if (st_readconsume(n,0,len) == -1) return (void*) 1;
+        i += len;
+    }
+
+    /* Everything was read: peeking past the end gives nothing */
+    if (st_readpeek(n,0,(const void**) &view,&len) == -1 || len != 0 ||
+        st_readconsume(n,0,0) == -1 || st_read(n,0,&c,1) != 0)
+        return (void*) 1;
+
+    return NULL;
+}
+
+/**
+ * Runs a producer and nb_readers consumers linked by a buffer
+ * of the given type and size, with the option opt (if not -1)
+ */
+void transfer(unsigned char type, size_t size, 
+              unsigned int nb_readers, int opt){
+    straph s;
+    node w, r[4];
+    unsigned int i;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,type,size) == -1 ||
+        st_setexec(w,THREAD_EXEC) == -1) fail("building straph");
+    if (opt != -1 && st_bufopt(w,0,opt,1) == -1) fail("st_bufopt");
+
+    for (i = 0; i < nb_readers; i++){
+        if ((r[i] = st_makenode(consume)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1 ||
+            st_setexec(r[i],THREAD_EXEC) == -1) fail("building straph");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+
+    if (w->ret != NULL) fail("bad write");
+    for (i = 0; i < nb_readers; i++){
+        if (r[i]->ret != NULL) fail("bad read");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+int main(void){
+
+    /* Linear buffer */
+    transfer(LIN_BUF, NB_BYTES, 2, -1);
+
+    /* Circular buffer: ring, chunks, broadcast, mirrored */
+    transfer(CIR_BUF, 4000, 1, -1);
+    transfer(CIR_BUF, 4000, 2, -1);
+    transfer(CIR_BUF, 4000, 4, BOPT_BROADCAST);
+    transfer(CIR_BUF, 4000, 1, BOPT_MIRROR);
+    transfer(CIR_BUF, 4000, 2, BOPT_MIRROR);
+
+    printf("Views: OK\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_INTS  (256*1024)
+#define SIZE_BUF (128*1024)
+
+static int nb_misplaced = 0;
+
+/* Counts the executions of a node pinned on cpu 0 out of it */
+void checkcpu(void){
+    if (sched_getcpu() != 0) __atomic_add_fetch(&nb_misplaced, 1, 
+                                                __ATOMIC_SEQ_CST);
+}
+
+/* Writes the integers from 0 to NB_INTS-1 */
+void* produce(node n){
+    int i;
+    checkcpu();
+    for (i = 0; i < NB_INTS; i++){
+        if (st_write(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Forwards the integers */
+void* forward(node n){
+    int i, j;
+    for (j = 0; j < NB_INTS; j++){
+        if (st_read(n,0,&i,sizeof(int)) != sizeof(int) ||
+            st_write(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Checks the integers */
+void* consume(node n){
+    int i, j;
+    checkcpu();
+    for (j = 0; j < NB_INTS; j++){
+        if (st_read(n,0,&i,sizeof(int)) != sizeof(int) || 
+            i != j) return (void*) 1;
+    }
+    return NULL;
+}
+
+int main(void){
+    pool pl;
+    straph s;
+    node n1, n2, n3;
+    cpu_set_t cpus;
+    unsigned char policies[] = {PLACE_NONE, PLACE_WRITER,
+                                PLACE_READER, PLACE_AUTO};
+    unsigned int i;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((pl = st_makepool(2)) == NULL) fail("st_makepool");
+
+    n1 = st_makenode(produce);
+    n2 = st_makenode(forward);
+    n3 = st_makenode(consume);
+    if (n1 == NULL || n2 == NULL || n3 == NULL) fail("st_makenode");
+
+    if (st_addnode(s, n1) == -1 ||
+        st_nlink(n1,n2,PAR_MODE) == -1 ||
+        st_nlink(n2,n3,PAR_MODE) == -1 ||
+        st_setbuffer(n1,0,CIR_BUF,SIZE_BUF) == -1 ||
+        st_setbuffer(n2,0,CIR_BUF,SIZE_BUF) == -1 ||
+        st_addflow(n1,0,n2,0) == -1 ||
+        st_addflow(n2,0,n3,0) == -1) fail("building straph");
+
+    /* Producer in its own thread, the others in the pool */
+    if (st_setexec(n1, THREAD_EXEC) == -1 ||
+        st_setexec(n2, GREEN_EXEC) == -1 ||
+        st_setpool(s, pl) == -1) fail("st_setexec");
+
+    if (st_setaffinity(n1, sizeof cpus, &cpus) == -1 ||
+        st_setaffinity(n3, sizeof cpus, &cpus) == -1) fail("st_setaffinity");
+
+    for (i = 0; i < sizeof policies; i++){
+        if (st_setplacement(s, policies[i]) == -1) fail("st_setplacement");
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+        if (n1->ret != NULL || n2->ret != NULL || n3->ret != NULL){
+            fprintf(stderr, "Bad data with policy %d\n", policies[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (nb_misplaced != 0){
+        fprintf(stderr, "%d executions out of cpu 0\n", nb_misplaced);
+        return EXIT_FAILURE;
+    }
+
+    /* Empty sets are refused, NULL clears the affinity */
+    CPU_ZERO(&cpus);
+    if (st_setaffinity(n1, sizeof cpus, &cpus) != -1 || errno != EINVAL)
+        fail("empty set accepted");
+    if (st_setaffinity(n1, 0, NULL) == -1) fail("st_setaffinity");
+    if (st_setplacement(s, PLACE_AUTO+1) != -1) fail("bad policy accepted");
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    printf("%d ints through %d policies\n", NB_INTS, (int) sizeof policies);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_NODES 8
+
+/* Writes 1 */
+void* one(node n){
+    int i = 1;
+    st_write(n,0,&i,sizeof(int));
+    return NULL;
+}
+
+/* Forwards the value incremented */
+void* increment(node n){
+    int i = -1;
+    if (st_read(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    i++;
+    st_write(n,0,&i,sizeof(int));
+    return (void*)(long) i;
+}
+
+/* Does nothing */
+void* nothing(node n){
+    (void) n;
+    return NULL;
+}
+
+/* Checks that every edge goes forward in the plan of a straph */
+void checkorder(straph s, unsigned int nb){
+    unsigned int i, j;
+    node nd;
+
+    if (s->plan == NULL) fail("not compiled");
+    if (s->plan->nb_nodes != nb) fail("bad number of nodes");
+    for (i = 0; i < nb; i++){
+        nd = s->plan->order[i];
+        if (nd->idx != i) fail("bad index");
+        for (j = 0; j < nd->nb_neigh; j++){
+            if (nd->neigh[j].n->idx <= i) fail("not in topological order");
+        }
+    }
+}
+
+int main(void){
+    /* Edges of a DAG, linked in an order unrelated to the result */
+    static const unsigned int edges[][2] = {
+        {5,7}, {0,3}, {3,6}, {1,3}, {2,5}, {6,7}, {0,2}, {4,6}, {1,4}
+    };
+    straph s;
+    node n[NB_NODES], extra;
+    unsigned int i;
+
+    /* Topological order */
+    if ((s = st_create()) == NULL) fail("st_create");
+    for (i = 0; i < NB_NODES; i++){
+        if ((n[i] = st_makenode(nothing)) == NULL) fail("st_makenode");
+    }
+    if (st_addnode(s, n[1]) == -1 || st_addnode(s, n[0]) == -1)
+        fail("st_addnode");
+    for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++){
+        if (st_nlink(n[edges[i][0]], n[edges[i][1]], 
+                     i % 2 ? SEQ_MODE : PAR_MODE) == -1) fail("st_nlink");
+    }
+    if (st_compile(s) == -1) fail("st_compile");
+    checkorder(s, NB_NODES);
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+
+    /* A cycle is rejected, by st_compile as by st_start */
+    if (st_nlink(n[7], n[3], SEQ_MODE) == -1) fail("st_nlink");
+    if (s->plan != NULL) fail("plan kept after st_nlink");
+    if (st_compile(s) != -1 || errno != EINVAL) fail("cycle compiled");
+    if (st_start(s) != -1 || errno != EINVAL) fail("cycle started");
+    if (st_destroy(s) == -1) fail("st_destroy");
+    printf("Order: OK\n");
+
+    /* Recompiled after the graph changes */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((n[0] = st_makenode(one)) == NULL ||
+        (n[1] = st_makenode(increment)) == NULL) fail("st_makenode");
+    if (st_addnode(s, n[0]) == -1 ||
+        st_setbuffer(n[0],0,LIN_BUF,sizeof(int)) == -1 ||
+        st_nlink(n[0],n[1],SEQ_MODE) == -1 ||
+        st_addflow(n[0],0,n[1],0) == -1) fail("building straph");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    checkorder(s, 2);
+    if ((long) n[1]->ret != 2) fail("bad result");
+
+    /* A new node linked after a run */
+    if ((extra = st_makenode(increment)) == NULL) fail("st_makenode");
+    if (st_setbuffer(n[1],0,LIN_BUF,sizeof(int)) == -1) fail("st_setbuffer");
+    if (s->plan != NULL) fail("plan kept after st_setbuffer");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (st_nlink(n[1],extra,SEQ_MODE) == -1) fail("st_nlink");
+    if (s->plan != NULL) fail("plan kept after st_nlink");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    checkorder(s, 3);
+
+    /* Then a flow between nodes already compiled */
+    if (st_addflow(n[1],0,extra,0) == -1) fail("st_addflow");
+    if (s->plan != NULL) fail("plan kept after st_addflow");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    checkorder(s, 3);
+    if (s->plan->wr_off[2] - s->plan->wr_off[1] != 1 ||
+        s->plan->wr_off[3] - s->plan->wr_off[2] != 1) fail("bad writers");
+    if ((long) extra->ret != 3) fail("bad result");
+    if (st_destroy(s) == -1) fail("st_destroy");
+    printf("Recompilation: OK\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_RUNS 200
+#define FANOUT  32
+
+static unsigned int count = 0;
+
+void* nodecount(node n){
+    (void) n;
+    __atomic_add_fetch(&count, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+void* nodewrite(node n){
+    char buf = 'A';
+    st_write(n,0,&buf,1);
+    return NULL;
+}
+
+void* readandcheck(node n){
+    char buf = 0;
+    st_read(n,0,&buf,1);
+    if (buf == 'A') return NULL;
+    else return (void*) 1;
+}
+
+static const char *names = "rabcde";
+static node prionodes[6];
+static char order[8];
+static unsigned int nb_order = 0;
+
+/* Records the execution order */
+void* noderecord(node n){
+    int i;
+    for (i = 0; prionodes[i] != n; i++);
+    order[__atomic_fetch_add(&nb_order, 1, __ATOMIC_SEQ_CST)] = names[i];
+    return NULL;
+}
+
+/*
+ Single worker: once r terminates, b has the highest priority
+ and c starts the longest chain (c->d->e), a comes last
+*/
+void priorities(void){
+    pool pl;
+    straph s;
+    node *nd = prionodes;
+    int i;
+
+    if ((pl = st_makepool(1)) == NULL) fail("st_makepool");
+    if ((s  = st_create()) == NULL) fail("st_create");
+
+    for (i = 0; i < 6; i++){
+        if ((nd[i] = st_makenode(noderecord)) == NULL) fail("st_makenode");
+        if (st_setcost(nd[i], 1000) == -1) fail("st_setcost");
+    }
+
+    if (st_addnode(s, nd[0]) == -1 ||
+        st_nlink(nd[0],nd[1],SEQ_MODE) == -1 ||
+        st_nlink(nd[0],nd[2],SEQ_MODE) == -1 ||
+        st_nlink(nd[0],nd[3],SEQ_MODE) == -1 ||
+        st_nlink(nd[3],nd[4],SEQ_MODE) == -1 ||
+        st_nlink(nd[4],nd[5],SEQ_MODE) == -1 ||
+        st_setpriority(nd[2], 5) == -1 ||
+        st_setpool(s, pl) == -1) fail("building straph");
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+
+    if (nb_order != 6 || memcmp(order, "rbcdea", 6) != 0){
+        fprintf(stderr, "Executed in order %.6s\n", order);
+        exit(EXIT_FAILURE);
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+}
+
+#define MAXPAR 4
+
+static unsigned int nb_par = 0;
+static unsigned int max_par = 0;
+
+/* Tracks how many nodes run at the same time */
+void* nodepar(node n){
+    unsigned int cur, max;
+    (void) n;
+
+    cur = __atomic_add_fetch(&nb_par, 1, __ATOMIC_SEQ_CST);
+    max = __atomic_load_n(&max_par, __ATOMIC_SEQ_CST);
+    while (cur > max && !__atomic_compare_exchange_n(&max_par, &max, cur,
+                          false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    usleep(1000);
+    __atomic_sub_fetch(&nb_par, 1, __ATOMIC_SEQ_CST);
+
+    return NULL;
+}
+
+/* Wide PAR fan-out limited to MAXPAR nodes, with and without pool */
+void maxparallel(void){
+    pool pl;
+    straph s;
+    node root, nd;
+    struct st_stats stats;
+    int i;
+
+    if ((pl = st_makepool(8)) == NULL) fail("st_makepool");
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((root = st_makenode(nodepar)) == NULL) fail("st_makenode");
+    if (st_addnode(s, root) == -1) fail("st_addnode");
+
+    for (i = 0; i < FANOUT; i++){
+        if ((nd = st_makenode(nodepar)) == NULL) fail("st_makenode");
+        if (st_nlink(root,nd,PAR_MODE) == -1) fail("st_nlink");
+    }
+
+    if (st_setmaxparallel(s, MAXPAR) == -1) fail("st_setmaxparallel");
+
+    for (i = 0; i < 2; i++){
+        if (i == 1 && st_setpool(s, pl) == -1) fail("st_setpool");
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    }
+
+    if (st_getstats(s, &stats) == -1) fail("st_getstats");
+    if (max_par > MAXPAR || stats.nb_admitted != 2*(FANOUT+1) ||
+        stats.nb_delayed == 0 || stats.max_queued == 0 ||
+        stats.nb_queued != 0 || stats.nb_running != 0){
+        fprintf(stderr, "%u nodes in parallel, stats %lu/%lu/%u/%u/%u\n",
+            max_par, stats.nb_admitted, stats.nb_delayed, 
+            stats.max_queued, stats.nb_queued, stats.nb_running);
+        exit(EXIT_FAILURE);
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+}
+
+#define NB_STEAL 8
+
+static node stealnodes[NB_STEAL];
+static unsigned int first[2];
+static unsigned int nb_first = 0;
+static unsigned int go = 0;
+
+/* The first two nodes started wait for each other */
+void* nodesteal(node n){
+    unsigned int i, k;
+
+    for (i = 0; stealnodes[i] != n; i++);
+    k = __atomic_fetch_add(&nb_first, 1, __ATOMIC_SEQ_CST);
+    if (k < 2) first[k] = i;
+    while (__atomic_load_n(&nb_first, __ATOMIC_SEQ_CST) < 2) usleep(100);
+    return NULL;
+}
+
+/*
+ Two workers: the one terminating r queues the tasks and runs
+ the most recent one, the other one steals the oldest one
+*/
+void stealing(void){
+    pool pl;
+    straph s;
+    node r;
+    int i;
+
+    if ((pl = st_makepool(2)) == NULL) fail("st_makepool");
+    if ((s  = st_create()) == NULL) fail("st_create");
+    if ((r = st_makenode(nodecount)) == NULL) fail("st_makenode");
+    if (st_addnode(s, r) == -1 || st_setpool(s, pl) == -1) 
+        fail("building straph");
+
+    for (i = 0; i < NB_STEAL; i++){
+        if ((stealnodes[i] = st_makenode(nodesteal)) == NULL) 
+            fail("st_makenode");
+        if (st_setcost(stealnodes[i], 1000) == -1 ||
+            st_nlink(r,stealnodes[i],SEQ_MODE) == -1) fail("st_nlink");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (MIN(first[0], first[1]) != 0 || 
+        MAX(first[0], first[1]) != NB_STEAL-1){
+        fprintf(stderr, "Started %u and %u first\n", first[0], first[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+}
+
+/* Waits for the go of the main thread */
+void* nodego(node n){
+    (void) n;
+    while (__atomic_load_n(&go, __ATOMIC_SEQ_CST) == 0) usleep(100);
+    return NULL;
+}
+
+/* The keys of the queues can't change once a node is launched */
+void busykeys(void){
+    straph s;
+    node n;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((n = st_makenode(nodego)) == NULL) fail("st_makenode");
+    if (st_addnode(s, n) == -1) fail("st_addnode");
+
+    if (st_start(s) == -1) fail("st_start");
+    if (st_setpriority(n, 1) != -1 || errno != EBUSY) 
+        fail("priority of a running node");
+    if (st_setcost(n, 1000) != -1 || errno != EBUSY) 
+        fail("cost of a running node");
+    __atomic_store_n(&go, 1, __ATOMIC_SEQ_CST);
+    if (st_join(s) == -1) fail("st_join");
+
+    if (st_setpriority(n, 1) == -1 || st_setcost(n, 1000) == -1)
+        fail("keys of a joined node");
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+int main(void){
+    int i;
+    pool pl;
+    straph s;
+    node n1, n2, n3, nf;
+
+    if ((pl = st_makepool(2)) == NULL) fail("st_makepool");
+    if ((s  = st_create()) == NULL) fail("st_create");
+
+    n1 = st_makenode(nodewrite);
+    n2 = st_makenode(readandcheck);
+    n3 = st_makenode(readandcheck);
+    if (n1 == NULL || n2 == NULL || n3 == NULL) fail("st_makenode");
+
+    /* n3 reads in parallel: give it its own thread */
+    if (st_addnode(s, n1) == -1 ||
+        st_nlink(n1,n2,SEQ_MODE) == -1 ||
+        st_nlink(n1,n3,PAR_MODE) == -1 ||
+        st_setbuffer(n1,0,LIN_BUF,1) == -1 ||
+        st_addflow(n1,0,n2,0) == -1 ||
+        st_addflow(n1,0,n3,0) == -1 ||
+        st_setexec(n3,THREAD_EXEC) == -1 ||
+        st_setpool(s, pl) == -1) fail("building straph");
+
+    /* Wide fan-out run by the workers */
+    for (i = 0; i < FANOUT; i++){
+        if ((nf = st_makenode(nodecount)) == NULL) fail("st_makenode");
+        if (st_nlink(n2,nf,SEQ_MODE) == -1) fail("st_nlink");
+    }
+
+    for (i = 0; i < NB_RUNS; i++){
+        if (st_start(s) == -1) fail("st_start");
+        if (st_join(s) == -1) fail("st_join");
+        if (n1->ret != NULL || n2->ret != NULL || n3->ret != NULL){
+            fprintf(stderr, "Wrong result at run %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (count != NB_RUNS*FANOUT){
+        fprintf(stderr, "Fan-out run %u times\n", count);
+        return EXIT_FAILURE;
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    priorities();
+    maxparallel();
+    stealing();
+    busykeys();
+
+    printf("%d runs\n", NB_RUNS);
+    return EXIT_SUCCESS;
+}
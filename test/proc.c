@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "straph.h"
+#include "io.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_INTS 100000
+#define SIZE_BUF 4096
+
+/* Process of the straph */
+pid_t mainpid;
+
+/* Writes its pid then the integers 0 to NB_INTS - 1 */
+void* produce(node n){
+    pid_t pid = getpid();
+    int i;
+
+    if (st_write(n,0,&pid,sizeof(pid_t)) != sizeof(pid_t)) return (void*) 1;
+    for (i = 0; i < NB_INTS; i++){
+        if (st_write(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Writes a few integers then dies */
+void* crash(node n){
+    int i;
+
+    for (i = 0; i < 10; i++){
+        if (st_write(n,0,&i,sizeof(int)) != sizeof(int)) return NULL;
+    }
+    raise(SIGKILL);
+    return NULL;
+}
+
+/* Type of the buffer in use, the next crash kills its writer */
+unsigned char crashtype;
+bool crashing;
+
+/* Writes a few integers then dies holding a mutex of the buffer */
+void* crashlocked(node n){
+    struct out_buf *ob = &n->outslots[0];
+    int i;
+
+    for (i = 0; i < 10; i++){
+        if (st_write(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    }
+    if (st_flush(n,0) == -1) return (void*) 1;
+    if (!crashing) return NULL;
+
+    if (ob->type == CIR_BUF){
+        pthread_mutex_lock(&((struct c_buf*) ob->buf)->lock_refs);
+    } else {
+        pthread_mutex_lock(&((struct l_buf*) ob->buf)->mutex);
+    }
+    raise(SIGKILL);
+    return NULL;
+}
+
+/* Reads the integers, then the crash (or the end of the data) */
+void* consumecrash(node n){
+    int i, val;
+    ssize_t ret;
+
+    for (i = 0; i < 10; i++){
+        if (st_read(n,0,&val,sizeof(int)) != sizeof(int) || val != i)
+            return (void*) 1;
+    }
+
+    /* A crash only ends the data of a linear buffer */
+    ret = st_read(n,0,&val,sizeof(int));
+    if (ret == -1 && crashing && errno == EOWNERDEAD) return NULL;
+    return ret == 0 && (!crashing || crashtype == LIN_BUF) ? 
+           NULL : (void*) 1;
+}
+
+/**
+ * Kills a forked writer holding a mutex of a buffer
+ * @param type Type of the buffer
+ * @param nbreaders Number of readers (1 for the ring of a CIR_BUF,
+ *        2 for its chunks)
+ */
+void crashheld(unsigned char type, unsigned int nbreaders){
+    straph s;
+    node w, r[2];
+    unsigned int i, run;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(crashlocked)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setexec(w, PROC_EXEC) == -1 ||
+        st_setbuffer(w,0,type,SIZE_BUF) == -1) fail("building straph");
+
+    /* Before the flows for the ring, after for the chunks */
+    if (nbreaders == 1 && st_bufopt(w,0,BOPT_SHARED,1) == -1) 
+        fail("st_bufopt");
+    for (i = 0; i < nbreaders; i++){
+        if ((r[i] = st_makenode(consumecrash)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+    if (nbreaders > 1 && st_bufopt(w,0,BOPT_SHARED,1) == -1) 
+        fail("st_bufopt");
+
+    /* The buffer is usable again after the crash */
+    crashtype = type;
+    for (run = 0; run < 2; run++){
+        crashing = run == 0;
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+        if ((w->ret == NULL) == crashing) fail("bad crash");
+        for (i = 0; i < nbreaders; i++){
+            if (r[i]->ret != NULL) fail("bad read");
+        }
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+/* Checks the pid of the writer then the integers */
+void* consume(node n){
+    pid_t pid;
+    int i, val;
+
+    if (st_read(n,0,&pid,sizeof(pid_t)) != sizeof(pid_t)) return (void*) 1;
+    if ((pid == mainpid) == (getpid() == mainpid)) return (void*) 1;
+    for (i = 0; i < NB_INTS; i++){
+        if (st_read(n,0,&val,sizeof(int)) != sizeof(int) || val != i)
+            return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Reads the integers until the end of the data */
+void* consumeall(node n){
+    int i = 0, val;
+    ssize_t ret;
+
+    while ((ret = st_read(n,0,&val,sizeof(int))) == sizeof(int)){
+        if (val != i++) return (void*) 1;
+    }
+    return ret == 0 && i == 10 ? NULL : (void*) 1;
+}
+
+/**
+ * Runs a writer and nbreaders readers linked by a shared buffer
+ * @param type Type of the buffer
+ * @param size Size of the buffer
+ * @param nbreaders Number of readers
+ * @param forkw true to fork the writer, false to fork the readers
+ */
+void transfer(unsigned char type, size_t size,
+              unsigned int nbreaders, bool forkw){
+    straph s;
+    node w, r[2];
+    unsigned int i, run;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,type,size) == -1) fail("building straph");
+    if (st_setexec(w, forkw ? PROC_EXEC : THREAD_EXEC) == -1)
+        fail("st_setexec");
+
+    /* Before the flows for the ring, after for the chunks */
+    if (nbreaders == 1 && st_bufopt(w,0,BOPT_SHARED,1) == -1)
+        fail("st_bufopt");
+    for (i = 0; i < nbreaders; i++){
+        if ((r[i] = st_makenode(consume)) == NULL) fail("st_makenode");
+        if (st_setexec(r[i], forkw ? THREAD_EXEC : PROC_EXEC) == -1)
+            fail("st_setexec");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+    if (nbreaders > 1 && st_bufopt(w,0,BOPT_SHARED,1) == -1)
+        fail("st_bufopt");
+
+    /* The buffers stay shared from a run to the other */
+    for (run = 0; run < 2; run++){
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+        if (w->ret != NULL) fail("bad write");
+        for (i = 0; i < nbreaders; i++){
+            if (r[i]->ret != NULL) fail("bad read");
+        }
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+int main(void){
+    straph s, s2;
+    node w, r, w2, r2;
+
+    mainpid = getpid();
+
+    transfer(CIR_BUF, SIZE_BUF, 1, true);
+    transfer(CIR_BUF, SIZE_BUF, 2, true);
+    transfer(CIR_BUF, SIZE_BUF, 1, false);
+    transfer(LIN_BUF, (NB_INTS + 1) * sizeof(int), 1, true);
+    transfer(LIN_BUF, (NB_INTS + 1) * sizeof(int), 2, false);
+    printf("Transfers: OK\n");
+
+    /* A crash ends the data of the node */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(crash)) == NULL ||
+        (r = st_makenode(consumeall)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setexec(w, PROC_EXEC) == -1 ||
+        st_setbuffer(w,0,LIN_BUF,SIZE_BUF) == -1 ||
+        st_bufopt(w,0,BOPT_SHARED,1) == -1 ||
+        st_nlink(w,r,PAR_MODE) == -1 ||
+        st_addflow(w,0,r,0) == -1) fail("building straph");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret == NULL) fail("crash not reported");
+    if (r->ret != NULL) fail("bad read");
+
+    /* Shared buffers are left as they are */
+    if (st_bufopt(w,0,BOPT_SHARED,1) == -1) fail("st_bufopt");
+    if (st_bufopt(w,0,BOPT_SHARED,0) != -1 || errno != EINVAL)
+        fail("buffer unshared");
+    if (st_bufopt(w,0,BOPT_SEGMENT,SIZE_BUF) != -1 || errno != EINVAL)
+        fail("shared buffer segmented");
+    crashheld(LIN_BUF, 1);
+    crashheld(CIR_BUF, 1);
+    crashheld(CIR_BUF, 2);
+    printf("Crash: OK\n");
+
+    /* A forked node only uses shared buffers */
+    if (st_setbuffer(w,0,CIR_BUF,SIZE_BUF) == -1) fail("st_setbuffer");
+    if (st_start(s) != -1 || errno != EINVAL) fail("private buffer used");
+
+    /* Checked before launching anything, even for the children */
+    if ((s2 = st_create()) == NULL) fail("st_create");
+    if ((w2 = st_makenode(produce)) == NULL ||
+        (r2 = st_makenode(consume)) == NULL) fail("st_makenode");
+    if (st_addnode(s2, w2) == -1 ||
+        st_setexec(r2, PROC_EXEC) == -1 ||
+        st_setbuffer(w2,0,LIN_BUF,(NB_INTS + 1) * sizeof(int)) == -1 ||
+        st_nlink(w2,r2,SEQ_MODE) == -1 ||
+        st_addflow(w2,0,r2,0) == -1) fail("building straph");
+    if (st_start(s2) != -1 || errno != EINVAL) fail("private buffer used");
+    if (st_ndone(w2)) fail("node launched");
+    if (st_bufopt(w2,0,BOPT_SHARED,1) == -1) fail("st_bufopt");
+    if (st_start(s2) == -1 || st_join(s2) == -1) fail("st_start");
+    if (w2->ret != NULL || r2->ret != NULL) fail("bad transfer");
+    if (st_destroy(s2) == -1) fail("st_destroy");
+
+    /* Elastic buffers can't be shared */
+    if (st_bufopt(w,0,BOPT_ELASTIC,4*SIZE_BUF) == -1) fail("st_bufopt");
+    if (st_bufopt(w,0,BOPT_SHARED,1) != -1 || errno != EINVAL)
+        fail("elastic buffer shared");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    printf("Processes: OK\n");
+
+    return EXIT_SUCCESS;
+}
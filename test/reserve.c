@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+#include "io.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_RECORDS 100000
+#define MAX_RECORD 64
+
+/* 
+ Builds in place records of variable size: the record k 
+ has 1 + k % MAX_RECORD bytes all equal to k % 256. 
+ Only part of the space reserved is used.
+*/
+void* produce(node n){
+    unsigned char *rec;
+    size_t size;
+    int k;
+
+    for (k = 0; k < NB_RECORDS; k++){
+        size = 1 + k % MAX_RECORD;
+        if ((rec = st_writereserve(n,0,MAX_RECORD)) == NULL) 
+            return (void*) 1;
+        memset(rec, k % 256, size);
+        if (st_writecommit(n,0,size) != (ssize_t) size) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Checks the records */
+void* consume(node n){
+    unsigned char rec[MAX_RECORD];
+    size_t size, i;
+    int k;
+
+    for (k = 0; k < NB_RECORDS; k++){
+        size = 1 + k % MAX_RECORD;
+        if (st_read(n,0,rec,size) != (ssize_t) size) return (void*) 1;
+        for (i = 0; i < size; i++){
+            if (rec[i] != k % 256) return (void*) 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Runs a producer and nb_readers consumers linked by a buffer
+ * of the given type and size, with the option opt (if not -1)
+ */
+void transfer(unsigned char type, size_t size, 
+              unsigned int nb_readers, int opt){
+    straph s;
+    node w, r[4];
+    unsigned int i;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,type,size) == -1 ||
+        st_setexec(w,THREAD_EXEC) == -1) fail("building straph");
+    if (opt != -1 && st_bufopt(w,0,opt,1) == -1) fail("st_bufopt");
+
+    for (i = 0; i < nb_readers; i++){
+        if ((r[i] = st_makenode(consume)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1 ||
+            st_setexec(r[i],THREAD_EXEC) == -1) fail("building straph");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+
+    if (w->ret != NULL) fail("bad write");
+    for (i = 0; i < nb_readers; i++){
+        if (r[i]->ret != NULL) fail("bad read");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+/* Set once the writer is done: the readers don't free anything before */
+unsigned int go;
+
+/* Fills a circular buffer whose reader died (marked as failed) */
+void* fillfailed(node n){
+    struct c_buf *cb = n->outslots[0].buf;
+    unsigned int i;
+    void *mem;
+    int err = 0;
+
+    cb->failed = 1;
+    for (i = 0; i < 2 * 4096 / 64; i++){
+        if ((mem = st_writereserve(n,0,64)) == NULL){
+            err = errno;
+            break;
+        }
+        memset(mem, 0, 64);
+        if (st_writecommit(n,0,64) != 64) break;
+    }
+    cb->failed = 0;
+    __atomic_store_n(&go, 1, __ATOMIC_SEQ_CST);
+
+    /* The space is waited for, not staged */
+    return err == EOWNERDEAD ? NULL : (void*) 1;
+}
+
+void* waitgo(node n){
+    (void) n;
+    while (__atomic_load_n(&go, __ATOMIC_SEQ_CST) == 0) usleep(1000);
+    return NULL;
+}
+
+/* A reservation fails when waiting for space does */
+void failedspace(void){
+    straph s;
+    node w, r[2];
+    unsigned int i;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(fillfailed)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,CIR_BUF,4096) == -1) fail("building straph");
+    for (i = 0; i < 2; i++){
+        if ((r[i] = st_makenode(waitgo)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL) fail("failed wait not reported");
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+}
+
+/* Misuse of the API */
+void errors(void){
+    node n;
+
+    if ((n = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_setbuffer(n,0,CIR_BUF,4096) == -1) fail("st_setbuffer");
+
+    if (st_writereserve(n,1,16) != NULL || errno != EINVAL)
+        fail("reserve on a bad slot");
+    if (st_writereserve(n,0,16) == NULL) fail("st_writereserve");
+    if (st_writecommit(n,0,17) != -1 || errno != EINVAL)
+        fail("commit beyond the reservation");
+
+    /* Nothing to commit without a reservation */
+    if (st_setbuffer(n,1,LIN_BUF,64) == -1) fail("st_setbuffer");
+    if (st_writecommit(n,1,0) != -1 || errno != EINVAL)
+        fail("commit without reservation");
+    if (st_writereserve(n,1,16) == NULL) fail("st_writereserve");
+    if (st_writecommit(n,1,16) != 16) fail("st_writecommit");
+    if (st_writecommit(n,1,0) != -1 || errno != EINVAL)
+        fail("reservation committed twice");
+    if (st_setbuffer(n,2,CIR_BUF,4096) == -1 ||
+        st_bufopt(n,2,BOPT_MESSAGE,1) == -1) fail("st_bufopt");
+    if (st_writecommit(n,2,0) != -1 || errno != EINVAL)
+        fail("empty message committed");
+
+    if (st_ndestroy(n) == -1) fail("st_ndestroy");
+}
+
+int main(void){
+
+    /* Linear buffer */
+    transfer(LIN_BUF, NB_RECORDS * MAX_RECORD, 1, -1);
+
+    /* Circular buffer: ring, chunks, broadcast, mirrored */
+    transfer(CIR_BUF, 4000, 1, -1);
+    transfer(CIR_BUF, 4000, 2, -1);
+    transfer(CIR_BUF, 4000, 4, BOPT_BROADCAST);
+    transfer(CIR_BUF, 4000, 1, BOPT_MIRROR);
+    transfer(CIR_BUF, 4000, 2, BOPT_MIRROR);
+
+    errors();
+    failedspace();
+
+    printf("Reservations: OK\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_ITERS 100
+
+static int produced = 0;
+static int consumed = 0;
+
+/* Writes the number of the iteration */
+void* produce(node n){
+    int i = produced++;
+    st_write(n,0,&i,sizeof(int));
+    return NULL;
+}
+
+/* Forwards the number doubled */
+void* transform(node n){
+    int i = -1;
+    if (st_read(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    i *= 2;
+    st_write(n,0,&i,sizeof(int));
+    return NULL;
+}
+
+/* Checks that iterations arrive in order */
+void* consume(node n){
+    int i = -1;
+    if (st_read(n,0,&i,sizeof(int)) != sizeof(int) || 
+        i != 2*consumed++) {
+        fprintf(stderr, "Got %d at iteration %d\n", i, consumed-1);
+        exit(EXIT_FAILURE);
+    }
+    return NULL;
+}
+
+int main(void){
+    pool pl;
+    straph s;
+    node n1, n2, n3;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+
+    n1 = st_makenode(produce);
+    n2 = st_makenode(transform);
+    n3 = st_makenode(consume);
+    if (n1 == NULL || n2 == NULL || n3 == NULL) fail("st_makenode");
+
+    if (st_addnode(s, n1) == -1 ||
+        st_nlink(n1,n2,SEQ_MODE) == -1 ||
+        st_nlink(n2,n3,SEQ_MODE) == -1 ||
+        st_setbuffer(n1,0,LIN_BUF,sizeof(int)) == -1 ||
+        st_setbuffer(n2,0,LIN_BUF,sizeof(int)) == -1 ||
+        st_addflow(n1,0,n2,0) == -1 ||
+        st_addflow(n2,0,n3,0) == -1) fail("building straph");
+
+    /* One thread per node */
+    if (st_run(s, NB_ITERS) == -1) fail("st_run");
+    if (consumed != NB_ITERS) fail("missing iterations");
+
+    /* Run by a pool */
+    if ((pl = st_makepool(2)) == NULL) fail("st_makepool");
+    if (st_setpool(s, pl) == -1) fail("st_setpool");
+    produced = consumed = 0;
+    if (st_run(s, NB_ITERS) == -1) fail("st_run");
+    if (consumed != NB_ITERS) fail("missing iterations");
+
+    /* Still usable as a one shot straph */
+    produced = consumed = 0;
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (consumed != 1) fail("missing iteration");
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+    if (st_destroypool(pl) == -1) fail("st_destroypool");
+
+    printf("%d iterations\n", NB_ITERS);
+    return EXIT_SUCCESS;
+}
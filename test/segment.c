@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_BYTES (1024*1024)
+#define SIZE_SEG 4000
+#define BATCH 37
+
+/* 
+ Writes the bytes i % 251, BATCH by BATCH. One batch out of 
+ two is built in place.
+*/
+void* produce(node n){
+    unsigned char batch[BATCH], *mem;
+    size_t i, j, size;
+
+    for (i = 0; i < NB_BYTES; i += BATCH){
+        size = MIN(BATCH, NB_BYTES - i);
+        if (i % 2 == 0){
+            for (j = 0; j < size; j++) batch[j] = (i + j) % 251;
+            if (st_write(n,0,batch,size) != (ssize_t) size) 
+                return (void*) 1;
+        } else {
+            if ((mem = st_writereserve(n,0,size)) == NULL) 
+                return (void*) 1;
+            for (j = 0; j < size; j++) mem[j] = (i + j) % 251;
+            if (st_writecommit(n,0,size) != (ssize_t) size) 
+                return (void*) 1;
+        }
+    }
+    return NULL;
+}
+
+/* Checks the bytes, read by pieces of variable size */
+void* consume(node n){
+    unsigned char piece[100];
+    size_t i, j, size;
+
+    for (i = 0; i < NB_BYTES; i += size){
+        size = MIN(1 + i % 100, NB_BYTES - i);
+        if (st_read(n,0,piece,size) != (ssize_t) size) return (void*) 1;
+        for (j = 0; j < size; j++){
+            if (piece[j] != (i + j) % 251) return (void*) 1;
+        }
+    }
+
+    /* Nothing more */
+    if (st_read(n,0,piece,1) != 0) return (void*) 1;
+    return NULL;
+}
+
+/* Checks the bytes directly into the segments */
+void* consumepeek(node n){
+    const unsigned char *view;
+    size_t i, j, len;
+
+    for (i = 0; i < NB_BYTES; i += len){
+        if (st_readpeek(n,0,(const void**) &view,&len) == -1 || 
+            len == 0 || len > SIZE_SEG) return (void*) 1;
+        for (j = 0; j < len; j++){
+            if (view[j] != (i + j) % 251) return (void*) 1;
+        }
+        if (st_readconsume(n,0,len) == -1) return (void*) 1;
+    }
+
+    if (st_readpeek(n,0,(const void**) &view,&len) == -1 || len != 0)
+        return (void*) 1;
+    return NULL;
+}
+
+/* Fills a buffer of 10 bytes */
+void* producefull(node n){
+    char data[8] = {0};
+
+    if (st_write(n,0,data,8) != 8 || st_write(n,0,data,8) != 2 ||
+        st_write(n,0,data,8) != -1 || errno != ENOSPC) return (void*) 1;
+    return NULL;
+}
+
+int main(void){
+    straph s;
+    node w, r[2];
+    unsigned int i, run;
+
+    /* Segmented buffer, read twice: the segments are reused */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL ||
+        (r[0] = st_makenode(consume)) == NULL ||
+        (r[1] = st_makenode(consumepeek)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,LIN_BUF,16) == -1 ||
+        st_bufopt(w,0,BOPT_SEGMENT,SIZE_SEG) == -1) fail("building straph");
+    for (i = 0; i < 2; i++){
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+
+    for (run = 0; run < 2; run++){
+        if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+        if (w->ret != NULL) fail("bad write");
+        if (r[0]->ret != NULL || r[1]->ret != NULL) fail("bad read");
+
+        /* Memory used as needed */
+        if (st_bufsize(w,0) != 
+            (NB_BYTES + SIZE_SEG - 1) / SIZE_SEG * SIZE_SEG) fail("bad size");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    /* Contiguous buffer: no write beyond its size */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(producefull)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,LIN_BUF,10) == -1) fail("building straph");
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    if (w->ret != NULL) fail("write not short");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    printf("Segments: OK\n");
+
+    return EXIT_SUCCESS;
+}
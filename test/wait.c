@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include "straph.h"
+
+/**
+ * Terminates the program printing an error message
+ * @param msg Error message
+ * @param line Number of the line
+ * @param func Name of the function
+ *
+ * @note Do not use this function direclty, rather use
+ *       the wrapping macro "fail(msg)
+ */
+void _fail(const char* msg, int line, const char* func){
+    fprintf(stderr, "Error at line %d (function %s):\n",line,func);
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+#define fail(x) _fail(x, __LINE__, __func__)
+
+#define NB_INTS 100000
+
+/* Writes the integers one by one */
+void* produce(node n){
+    int i;
+
+    for (i = 0; i < NB_INTS; i++){
+        if (st_write(n,0,&i,sizeof(int)) != sizeof(int)) return (void*) 1;
+    }
+    return NULL;
+}
+
+/* Checks the integers */
+void* consume(node n){
+    int i, j;
+
+    for (i = 0; i < NB_INTS; i++){
+        if (st_read(n,0,&j,sizeof(int)) != sizeof(int) || i != j) 
+            return (void*) 1;
+    }
+    return NULL;
+}
+
+/**
+ * Runs a producer and nb_readers consumers linked by a buffer
+ * of the given type and size waiting with the given policy,
+ * returns the time taken in seconds
+ */
+double transfer(unsigned char type, size_t size, 
+                unsigned int nb_readers, int policy){
+    straph s;
+    node w, r[2];
+    unsigned int i;
+    struct timespec t0, t1;
+
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((w = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, w) == -1 ||
+        st_setbuffer(w,0,type,size) == -1 ||
+        st_bufopt(w,0,BOPT_WAIT,policy) == -1 ||
+        st_bufopt(w,0,BOPT_SPINS,100) == -1) fail("building straph");
+
+    for (i = 0; i < nb_readers; i++){
+        if ((r[i] = st_makenode(consume)) == NULL) fail("st_makenode");
+        if (st_nlink(w,r[i],PAR_MODE) == -1 ||
+            st_addflow(w,0,r[i],0) == -1) fail("building straph");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (st_start(s) == -1 || st_join(s) == -1) fail("st_start");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (w->ret != NULL) fail("bad write");
+    for (i = 0; i < nb_readers; i++){
+        if (r[i]->ret != NULL) fail("bad read");
+    }
+
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+int main(void){
+    const char *names[] = {"block", "spin", "spin-yield", "poll"};
+    straph s;
+    node n;
+    int p;
+
+    for (p = WAIT_BLOCK; p <= WAIT_POLL; p++){
+        printf("%-10s  linear: %f s", names[p], 
+               transfer(LIN_BUF, NB_INTS*sizeof(int), 1, p));
+        printf("  linear x2: %f s", 
+               transfer(LIN_BUF, NB_INTS*sizeof(int), 2, p));
+        printf("  ring: %f s", transfer(CIR_BUF, 4096, 1, p));
+        printf("  chunks: %f s\n", transfer(CIR_BUF, 4096, 2, p));
+    }
+
+    /* Unknown policy */
+    if ((s = st_create()) == NULL) fail("st_create");
+    if ((n = st_makenode(produce)) == NULL) fail("st_makenode");
+    if (st_addnode(s, n) == -1 ||
+        st_setbuffer(n,0,CIR_BUF,4096) == -1) fail("building straph");
+    if (st_bufopt(n,0,BOPT_WAIT,WAIT_POLL+1) != -1 || errno != EINVAL)
+        fail("bad policy accepted");
+    if (st_destroy(s) == -1) fail("st_destroy");
+
+    return EXIT_SUCCESS;
+}